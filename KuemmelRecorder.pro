@@ -8,12 +8,12 @@ QT       += core widgets concurrent multimedia multimediawidgets
 CONFIG   += link_pkgconfig c++17
 CONFIG   -= exceptions rtti
 
-PKGCONFIG += portaudio-2.0 sqlite3 poppler-qt5 flac
+PKGCONFIG += sqlite3 poppler-qt5
 
 TARGET   = KuemmelRecorder
 TEMPLATE = app
 
-LIBS += -lmp3lame
+include(recording/recording.pri)
 
 SOURCES += \
     main/main.cpp \
@@ -26,17 +26,12 @@ SOURCES += \
     presentation/presenterbase.cpp \
     presentation/mediapresenter.cpp \
     recording/configuratorpane.cpp \
-    recording/coordinator.cpp \
     recording/errorwidget.cpp \
     recording/fancyprogressbar.cpp \
-    recording/lameencoderstream.cpp \
-    recording/levelcalculator.cpp \
     recording/statusview.cpp \
-    recording/external/pa_ringbuffer.c \
     presentation/pixmapdisplaywidget.cpp
 
 HEADERS += \
-    util/misc.h \
     main/mainwindow.h \
     main/aboutpane.h \
     presentation/presentationtab.h \
@@ -46,14 +41,9 @@ HEADERS += \
     presentation/presenterbase.h \
     presentation/mediapresenter.h \
     recording/configuratorpane.h \
-    recording/coordinator.h \
     recording/errorwidget.h \
     recording/fancyprogressbar.h \
-    recording/lameencoderstream.h \
     recording/statusview.h \
-    recording/levelcalculator.h \
-    recording/external/pa_memorybarrier.h \
-    recording/external/pa_ringbuffer.h \
     presentation/pixmapdisplaywidget.h
 
 FORMS    += \
@@ -0,0 +1,556 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QTemporaryDir>
+#include <QEventLoop>
+#include <QTextStream>
+#include <QThread>
+#include <QTimer>
+#include <QtMath>
+
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "stagestats.h"
+
+#include "recording/audiosource.h"
+#include "recording/coordinator.h"
+#include "recording/encoderregistry.h"
+#include "recording/encoderstream.h"
+#include "recording/gainkernels.h"
+#include "recording/levelcalculator.h"
+#include "recording/levelkernels.h"
+#include "recording/virtualaudiobackend.h"
+#include "util/trace.h"
+
+/*
+ * Feeds synthetic or recorded audio through the recording pipeline as
+ * fast as it goes, without a sound card or a GUI, and reports how long
+ * every stage takes per block. Meant for catching performance regressions
+ * on build machines; the exit code is nonzero if the level kernels
+ * disagree, a level or encoder stage allocates once it is warmed up, or
+ * the pipeline reports an error.
+ *
+ * With --virtual, the pipeline also runs behind the real audio callback,
+ * driven by the virtual device with the jitter and stalls asked for.
+ */
+
+using namespace Recording;
+using Bench::StageStats;
+
+namespace {
+    struct Options
+    {
+        qint64 frames = 0;
+        qint64 blockFrames = 480;
+        QStringList formats;
+        QString outputDir;
+        double pace = 0;          // multiple of realtime to feed the pipeline at, 0 is flat out
+
+        bool virtualDevice = false;
+        VirtualDeviceConfig device;
+        double drainStallMsecs = 0;
+        double drainStallIntervalMsecs = 0;
+    };
+
+    // Swallows whatever an encoder writes, so that the disk stays out of the timings
+    class NullDevice : public QIODevice
+    {
+    public:
+        NullDevice() { open(QIODevice::WriteOnly); }
+        bool isSequential() const override { return true; }
+
+    protected:
+        qint64 readData(char *, qint64) override { return -1; }
+        qint64 writeData(const char *, qint64 len) override { return len; }
+    };
+
+    QTextStream &out()
+    {
+        static QTextStream stream(stdout);
+        return stream;
+    }
+
+    // Calls f(samples, frames) for every block of the run
+    template <typename F>
+    void forEachBlock(const AudioSource &source, const Options &options, F f)
+    {
+        for (qint64 pos = 0; pos < options.frames; )
+        {
+            qint64 frames = qMin(options.blockFrames, options.frames - pos);
+            const float *samples = source.block(pos, &frames);
+            f(samples, frames);
+            pos += frames;
+        }
+    }
+
+    qint64 blockCount(const Options &options)
+    {
+        // loop wraparounds can split a few more blocks
+        return options.frames / options.blockFrames + 64;
+    }
+
+    bool sameStats(const Kernels::LevelStats &a, const Kernels::LevelStats &b, int channels)
+    {
+        if (a.frames != b.frames)
+            return false;
+
+        for (int c = 0; c < channels; ++c)
+        {
+            // sums of squares are added up in a different order
+            const double tolerance = 1e-5 * qMax(1.0, std::fabs(a.sumSquares[c]));
+            if (a.peak[c] != b.peak[c] || a.clipped[c] != b.clipped[c]
+                    || std::fabs(a.sumSquares[c] - b.sumSquares[c]) > tolerance)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Times every level kernel the CPU supports and checks it against the scalar one.
+    // Returns the number of kernels that got a different result.
+    int benchKernels(const AudioSource &source, const Options &options, std::vector<StageStats> &stages)
+    {
+        const StreamFormat format = source.format();
+        const bool stereo = format.channels == 2;
+        int mismatches = 0;
+
+        std::vector<qint16> int16Block(size_t(options.blockFrames * format.channels));
+
+        const Kernels::LevelKernelSet &scalar = Kernels::scalarLevelKernels();
+        Kernels::LevelStats reference, referenceInt16;
+
+        for (const Kernels::LevelKernelSet *set : { &scalar, &Kernels::sse2LevelKernels(), &Kernels::avx2LevelKernels() })
+        {
+            Kernels::LevelStats stats;
+
+            if (stereo && set->analyzeFloat)
+            {
+                StageStats stage(QStringLiteral("levels %1 float").arg(QLatin1String(set->name)), blockCount(options));
+                stage.setRealtime(true);
+                forEachBlock(source, options, [&](const float *samples, qint64 frames) {
+                    stage.begin();
+                    set->analyzeFloat(samples, frames, stats);
+                    stage.end(frames);
+                });
+                stages.push_back(stage);
+            }
+            else if (!stereo && set->analyzeMultichannel)
+            {
+                StageStats stage(QStringLiteral("levels %1 %2ch").arg(QLatin1String(set->name)).arg(format.channels),
+                                 blockCount(options));
+                stage.setRealtime(true);
+                forEachBlock(source, options, [&](const float *samples, qint64 frames) {
+                    stage.begin();
+                    set->analyzeMultichannel(samples, frames, format.channels, stats);
+                    stage.end(frames);
+                });
+                stages.push_back(stage);
+            }
+            else
+            {
+                continue;
+            }
+
+            if (set == &scalar)
+                reference = stats;
+            else if (!sameStats(reference, stats, format.channels))
+            {
+                out() << "MISMATCH: " << set->name << " level kernel differs from the scalar one" << "\n";
+                ++mismatches;
+            }
+
+            if (!stereo || !set->analyzeInt16)
+                continue;
+
+            Kernels::LevelStats statsInt16;
+            StageStats stage(QStringLiteral("levels %1 int16").arg(QLatin1String(set->name)), blockCount(options));
+            stage.setRealtime(true);
+            forEachBlock(source, options, [&](const float *samples, qint64 frames) {
+                for (qint64 i = 0; i < frames * 2; ++i)
+                    int16Block[size_t(i)] = qint16(qBound(-32768.0f, std::round(samples[i] * 32768.0f), 32767.0f));
+
+                stage.begin();
+                set->analyzeInt16(int16Block.data(), frames, statsInt16);
+                stage.end(frames);
+            });
+            stages.push_back(stage);
+
+            if (set == &scalar)
+                referenceInt16 = statsInt16;
+            else if (!sameStats(referenceInt16, statsInt16, 2))
+            {
+                out() << "MISMATCH: " << set->name << " int16 level kernel differs from the scalar one" << "\n";
+                ++mismatches;
+            }
+        }
+
+        return mismatches;
+    }
+
+    StageStats benchLevelCalculator(const AudioSource &source, const Options &options)
+    {
+        LevelCalculator calculator;
+        calculator.setFormat(source.format());
+
+        StageStats stage(QStringLiteral("level calculator"), blockCount(options));
+        stage.setRealtime(true);
+        forEachBlock(source, options, [&](const float *samples, qint64 frames) {
+            stage.begin();
+            calculator.processAudio(samples, frames);
+            stage.end(frames);
+        });
+
+        return stage;
+    }
+
+    // One encoder on its own, in the drain thread instead of a worker
+    bool benchEncoder(const EncoderType &type, const AudioSource &source, const Options &options,
+                      std::vector<StageStats> &stages)
+    {
+        const StreamFormat inFormat = source.format();
+
+        // the same channels the coordinator would hand it
+        const bool mixdown = type.maxChannels && inFormat.channels > type.maxChannels;
+        StreamFormat format = inFormat;
+        if (mixdown)
+            format.channels = 2;
+
+        std::vector<float> weights(size_t(2 * inFormat.channels), 0.0f);
+        for (int c = 0; c < inFormat.channels; ++c)
+        {
+            const int route = Coordinator::defaultMixdownRoute(c, inFormat.channels);
+            const float gain = route == Coordinator::MixdownCenter ? float(M_SQRT1_2) : 1.0f;
+            if (route & Coordinator::MixdownLeft)
+                weights[size_t(c)] = gain;
+            if (route & Coordinator::MixdownRight)
+                weights[size_t(inFormat.channels + c)] = gain;
+        }
+
+        std::unique_ptr<EncoderStream> stream(type.create());
+        QObject::connect(stream.get(), &EncoderStream::error, [&type](const QString &message) {
+            out() << type.id << ": " << message << "\n";
+        });
+
+        NullDevice device;
+        EncoderTags tags;
+        tags.artist = QStringLiteral("recordingbench");
+        tags.title = QStringLiteral("Benchmark");
+
+        if (!stream->open(tags, format, &device))
+        {
+            out() << type.id << ": can't open the encoder" << "\n";
+            return false;
+        }
+
+        // encoders may work in place, so they get a copy
+        std::vector<float> block(size_t(options.blockFrames * format.channels));
+        bool ok = true;
+
+        StageStats stage(QStringLiteral("encoder %1").arg(type.id), blockCount(options));
+        stage.setRealtime(true);
+        forEachBlock(source, options, [&](const float *samples, qint64 frames) {
+            if (mixdown)
+                Kernels::mixToStereo(samples, inFormat.channels, block.data(), frames, weights.data());
+            else
+                std::copy(samples, samples + frames * format.channels, block.begin());
+
+            stage.begin();
+            qint64 written = ok ? stream->writeAudio(block.data(), frames) : 0;
+            stage.end(frames);
+
+            if (written < 0)
+                ok = false;
+        });
+
+        stage.beginFinish();
+        stream->close();
+        stage.endFinish();
+
+        stages.push_back(stage);
+        return ok;
+    }
+
+    // Prints what the coordinator has to say, errors make the run fail
+    void watch(Coordinator &coordinator, bool *ok, DropoutStats *dropouts)
+    {
+        QObject::connect(&coordinator, &Coordinator::error, [ok](const QString &message) {
+            // an empty one clears the last error
+            if (message.isEmpty())
+                return;
+            out() << "error: " << message << "\n";
+            *ok = false;
+        });
+        QObject::connect(&coordinator, &Coordinator::warning, [](const QString &message) {
+            out() << "warning: " << message << "\n";
+        });
+        QObject::connect(&coordinator, &Coordinator::dropoutStatsChanged, [dropouts](const DropoutStats &stats) {
+            *dropouts = stats;
+        });
+    }
+
+    // Everything behind the audio callback, encoder threads and files included
+    bool benchPipeline(const AudioSource &source, const Options &options, std::vector<StageStats> &stages)
+    {
+        Coordinator coordinator;
+        bool ok = true;
+        DropoutStats dropouts;
+        watch(coordinator, &ok, &dropouts);
+
+        coordinator.startOffline(source.format());
+        coordinator.setSaveDir(options.outputDir);
+        coordinator.setRecordingFormats(options.formats);
+        coordinator.startRecording();
+
+        if (!coordinator.isRecording())
+            return false;
+
+        const StreamFormat format = coordinator.streamFormat();
+        const auto start = std::chrono::steady_clock::now();
+        qint64 position = 0;
+
+        // the encoder threads do the bigger part of the work
+        StageStats stage(QStringLiteral("pipeline"), blockCount(options));
+        stage.setCountOtherThreads(true);
+        forEachBlock(source, options, [&](const float *samples, qint64 frames) {
+            if (options.pace > 0)
+            {
+                const double due = position / (format.sampleRate * options.pace);
+                std::this_thread::sleep_until(start + std::chrono::duration<double>(due));
+            }
+
+            stage.begin();
+            coordinator.feedOffline(samples, frames);
+            stage.end(frames);
+
+            position += frames;
+        });
+
+        stage.beginFinish();
+        coordinator.stopRecording();
+        stage.endFinish();
+
+        // errors from the encoder threads arrive queued
+        QCoreApplication::processEvents();
+
+        stages.push_back(stage);
+
+        if (dropouts.droppedFrames || dropouts.encoderDroppedFrames)
+        {
+            out() << "pipeline dropped " << dropouts.droppedFrames << " frames in the ring buffer, "
+                  << dropouts.encoderDroppedFrames << " in the encoder queues";
+            if (options.pace <= 0)
+                out() << " (the encoders can't keep up flat out, try --pace)";
+            out() << "\n";
+        }
+
+        return ok;
+    }
+
+    // The real audio callback, called by the virtual device at its own pace. This is
+    // about what a busy machine does to the recording, and how long the callback takes.
+    bool runVirtualDevice(const Options &options)
+    {
+        Coordinator coordinator;
+        bool ok = true;
+        DropoutStats dropouts;
+        watch(coordinator, &ok, &dropouts);
+
+        CallbackTimingSnapshot timing;
+        QObject::connect(&coordinator, &Coordinator::callbackTimingUpdate, [&timing](const CallbackTimingSnapshot &t) {
+            timing = t;
+        });
+
+        const VirtualDeviceConfig &config = options.device;
+        coordinator.setBackend(std::make_unique<VirtualAudioBackend>(config));
+        coordinator.setSaveDir(options.outputDir);
+        coordinator.setRecordingFormats(options.formats);
+        coordinator.setRecordingDevice(VirtualAudioBackend::INPUT_DEVICE);
+        coordinator.startRecording();
+
+        if (!coordinator.isRecording())
+            return false;
+
+        const StreamFormat format = coordinator.streamFormat();
+
+        // blocks the drain loop now and then, like a busy GUI thread would
+        QTimer drainStall;
+        QObject::connect(&drainStall, &QTimer::timeout, [&options]() {
+            QThread::usleep((unsigned long)(options.drainStallMsecs * 1000));
+        });
+        if (options.drainStallMsecs > 0 && options.drainStallIntervalMsecs > 0)
+            drainStall.start(int(options.drainStallIntervalMsecs));
+
+        QEventLoop loop;
+        QTimer::singleShot(int(options.frames * 1000 / (format.sampleRate * config.speed)), &loop, &QEventLoop::quit);
+        loop.exec();
+
+        drainStall.stop();
+        const qint64 recorded = coordinator.samplesRecorded();
+        coordinator.stopRecording();
+        coordinator.setRecordingDevice(paNoDevice);
+        QCoreApplication::processEvents();
+
+        out() << "virtual device at " << config.speed << "x: recorded " << recorded << " frames, "
+              << dropouts.droppedFrames << " dropped in the ring buffer (peak fill "
+              << qRound(dropouts.ringBufferPeakFill * 100) << "%), "
+              << dropouts.inputOverflows << " input overflows, "
+              << dropouts.encoderDroppedFrames << " dropped in the encoder queues" << "\n";
+
+        if (timing.callbacks)
+        {
+            out() << "audio callback: p50 " << timing.p50Nanos / 1000 << " us, p99 " << timing.p99Nanos / 1000
+                  << " us, p99.9 " << timing.p999Nanos / 1000 << " us, max " << timing.maxNanos / 1000
+                  << " us of " << timing.budgetNanos / 1000 << " us, " << timing.overBudget << " of "
+                  << timing.callbacks << " over budget" << "\n";
+        }
+
+        return ok;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("recordingbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the recording pipeline without audio hardware.");
+    parser.addHelpOption();
+
+    QCommandLineOption inputOption("input", "WAV file to feed instead of the test signal.", "file");
+    QCommandLineOption secondsOption("seconds", "Length of the run in seconds of audio.", "seconds", "60");
+    QCommandLineOption channelsOption("channels", "Channels of the test signal.", "channels", "2");
+    QCommandLineOption rateOption("rate", "Sample rate of the test signal.", "rate", "48000");
+    QCommandLineOption blockOption("block", "Frames per block, like one audio callback.", "frames", "480");
+    QCommandLineOption formatsOption("formats", "Comma separated encoder ids for the pipeline run.", "ids", "mp3-192,flac,wav");
+    QCommandLineOption outputOption("output-dir", "Where the pipeline run writes its files, a temporary directory by default.", "dir");
+    QCommandLineOption paceOption("pace", "Feed the pipeline at this multiple of realtime instead of flat out.", "factor", "0");
+    QCommandLineOption virtualOption("virtual", "Also record from the virtual device, through the real audio callback.");
+    QCommandLineOption speedOption("speed", "Virtual device: run its clock this many times faster than realtime.", "factor", "1");
+    QCommandLineOption hwBuffersOption("hw-buffers", "Virtual device: buffers it holds before input is lost.", "buffers", "4");
+    QCommandLineOption jitterOption("jitter", "Virtual device: callbacks come up to this late.", "ms", "0");
+    QCommandLineOption stallOption("stall", "Virtual device: the callback thread stalls this long, every --stall-every.", "ms", "0");
+    QCommandLineOption stallEveryOption("stall-every", "Virtual device: time between callback stalls.", "ms", "1000");
+    QCommandLineOption drainStallOption("drain-stall", "Virtual device: the drain loop stalls this long, every --drain-stall-every.", "ms", "0");
+    QCommandLineOption drainStallEveryOption("drain-stall-every", "Virtual device: time between drain loop stalls.", "ms", "1000");
+    QCommandLineOption traceOption("trace", "Record a trace of the run for chrome://tracing or ui.perfetto.dev.", "file");
+    parser.addOptions({ inputOption, secondsOption, channelsOption, rateOption, blockOption,
+                        formatsOption, outputOption, paceOption, virtualOption, speedOption,
+                        hwBuffersOption, jitterOption, stallOption, stallEveryOption,
+                        drainStallOption, drainStallEveryOption, traceOption });
+    parser.process(app);
+
+    AudioSource source;
+    if (parser.isSet(inputOption))
+    {
+        QString errorString;
+        source = AudioSource::fromWav(parser.value(inputOption), &errorString);
+        if (!source.isValid())
+        {
+            out() << parser.value(inputOption) << ": " << errorString << "\n";
+            out().flush();
+            return 2;
+        }
+    }
+    else
+    {
+        StreamFormat format;
+        format.sampleRate = qMax(8000, parser.value(rateOption).toInt());
+        format.channels = qBound(1, parser.value(channelsOption).toInt(), int(StreamFormat::MAX_CHANNELS));
+
+        // ten seconds are plenty to loop over, and keep 32 channels small
+        source = AudioSource::synthetic(format, qint64(format.sampleRate) * 10);
+    }
+
+    const StreamFormat format = source.format();
+
+    Options options;
+    options.frames = qint64(parser.value(secondsOption).toDouble() * format.sampleRate);
+    options.blockFrames = qBound<qint64>(1, parser.value(blockOption).toLongLong(), 65536);
+    options.formats = parser.value(formatsOption).split(QLatin1Char(','));
+    options.formats.removeAll(QString());
+    options.pace = parser.value(paceOption).toDouble();
+
+    options.virtualDevice = parser.isSet(virtualOption);
+    options.device.source = std::make_shared<AudioSource>(source);
+    options.device.framesPerBuffer = int(options.blockFrames);
+    options.device.speed = qMax(0.01, parser.value(speedOption).toDouble());
+    options.device.hardwareBuffers = qMax(1, parser.value(hwBuffersOption).toInt());
+    options.device.jitterMsecs = parser.value(jitterOption).toDouble();
+    options.device.stallMsecs = parser.value(stallOption).toDouble();
+    options.device.stallIntervalMsecs = parser.value(stallEveryOption).toDouble();
+    options.drainStallMsecs = parser.value(drainStallOption).toDouble();
+    options.drainStallIntervalMsecs = parser.value(drainStallEveryOption).toDouble();
+
+    QTemporaryDir tempDir;
+    options.outputDir = parser.isSet(outputOption) ? parser.value(outputOption) : tempDir.path();
+    QDir().mkpath(options.outputDir);
+
+    out() << format.channels << " channels at " << format.sampleRate << " Hz, "
+          << options.frames << " frames in blocks of " << options.blockFrames << "\n";
+    out().flush();
+
+    std::vector<StageStats> stages;
+    int result = 0;
+
+    if (parser.isSet(traceOption))
+        Util::Trace::start();
+
+    if (benchKernels(source, options, stages))
+        result = 1;
+
+    stages.push_back(benchLevelCalculator(source, options));
+
+    for (const QString &id : options.formats)
+    {
+        const EncoderType *type = findEncoderType(id);
+        if (!type)
+        {
+            out() << id << ": unknown encoder" << "\n";
+            result = 1;
+            continue;
+        }
+
+        if (!benchEncoder(*type, source, options, stages))
+            result = 1;
+    }
+
+    if (!benchPipeline(source, options, stages))
+        result = 1;
+
+    if (options.virtualDevice && !runVirtualDevice(options))
+        result = 1;
+
+    if (parser.isSet(traceOption))
+    {
+        Util::Trace::stop();
+
+        QString errorString;
+        if (!Util::Trace::exportChromeJson(parser.value(traceOption), &errorString))
+        {
+            out() << parser.value(traceOption) << ": " << errorString << "\n";
+            result = 1;
+        }
+    }
+
+    out() << "\n" << StageStats::reportHeader() << "\n";
+    for (const StageStats &stage : stages)
+        out() << stage.report(format.sampleRate) << "\n";
+
+    for (const StageStats &stage : stages)
+    {
+        if (stage.allocates())
+        {
+            out() << "ALLOCATES: " << stage.name() << " allocated " << stage.steadyAllocations()
+                  << " times after warming up" << "\n";
+            result = 1;
+        }
+    }
+
+    out().flush();
+    return result;
+}
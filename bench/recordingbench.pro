@@ -0,0 +1,23 @@
+#-------------------------------------------------
+#
+# Headless benchmark of the recording pipeline, runs without a sound card
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+CONFIG   += console c++17
+CONFIG   -= app_bundle exceptions rtti
+
+TARGET   = recordingbench
+TEMPLATE = app
+
+include(../recording/recording.pri)
+
+SOURCES += \
+    main.cpp \
+    stagestats.cpp
+
+HEADERS += \
+    stagestats.h
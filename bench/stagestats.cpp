@@ -0,0 +1,136 @@
+#include "stagestats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    // blocks at the start of a stage that may allocate
+    const size_t WARMUP_BLOCKS = 16;
+
+    // only the thread that runs the stage counts, and only while it is timed
+    thread_local bool t_counting = false;
+    thread_local qint64 t_allocations = 0;
+
+    // every allocation, for the stages that count other threads
+    std::atomic<qint64> g_allocations { 0 };
+    thread_local qint64 t_totalAllocations = 0;
+
+    void *allocate(std::size_t size)
+    {
+        if (t_counting)
+            ++t_allocations;
+        ++t_totalAllocations;
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+        // exceptions are off, so there is no bad_alloc to throw
+        void *p = std::malloc(size ? size : 1);
+        if (!p)
+            std::abort();
+        return p;
+    }
+}
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace Bench {
+
+StageStats::StageStats(const QString &name, qint64 expectedBlocks)
+    : m_name(name)
+{
+    // so that recording the timings doesn't allocate while counting
+    m_blockNanos.reserve(size_t(expectedBlocks));
+}
+
+void StageStats::begin()
+{
+    if (m_countOtherThreads && m_blockNanos.size() == WARMUP_BLOCKS)
+    {
+        m_processStart = g_allocations.load(std::memory_order_relaxed);
+        m_threadStart = t_totalAllocations;
+    }
+
+    t_allocations = 0;
+    t_counting = true;
+    m_start = Clock::now();
+}
+
+void StageStats::end(qint64 frames)
+{
+    const Clock::time_point now = Clock::now();
+    t_counting = false;
+
+    const qint64 nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_start).count();
+    m_blockNanos.push_back(nanos);
+    m_totalNanos += nanos;
+    m_frames += frames;
+    if (m_blockNanos.size() > WARMUP_BLOCKS)
+        m_allocations += t_allocations;
+
+    // what happened elsewhere since the warmup, all of this thread's own allocations left out
+    if (m_countOtherThreads && m_blockNanos.size() > WARMUP_BLOCKS)
+        m_otherAllocations = g_allocations.load(std::memory_order_relaxed) - m_processStart
+                - (t_totalAllocations - m_threadStart);
+}
+
+void StageStats::beginFinish()
+{
+    m_start = Clock::now();
+}
+
+void StageStats::endFinish()
+{
+    m_finishNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count();
+}
+
+QString StageStats::reportHeader()
+{
+    return QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8 %9")
+            .arg(QStringLiteral("stage"), -28)
+            .arg(QStringLiteral("frames/s"), 12)
+            .arg(QStringLiteral("realtime"), 10)
+            .arg(QStringLiteral("p50 us"), 9)
+            .arg(QStringLiteral("p90 us"), 9)
+            .arg(QStringLiteral("p99 us"), 9)
+            .arg(QStringLiteral("max us"), 9)
+            .arg(QStringLiteral("allocs/blk"), 11)
+            .arg(QStringLiteral("finish ms"), 10);
+}
+
+QString StageStats::report(int sampleRate) const
+{
+    std::vector<qint64> sorted = m_blockNanos;
+    std::sort(sorted.begin(), sorted.end());
+
+    auto percentile = [&sorted](double p) {
+        if (sorted.empty())
+            return 0.0;
+        size_t i = std::min(sorted.size() - 1, size_t(p * double(sorted.size())));
+        return sorted[i] / 1000.0;
+    };
+
+    const double seconds = m_totalNanos / 1e9;
+    const double framesPerSecond = seconds > 0 ? m_frames / seconds : 0;
+    const double steadyBlocks = qMax<double>(1.0, double(sorted.size()) - double(WARMUP_BLOCKS));
+
+    return QStringLiteral("%1 %2 %3 %4 %5 %6 %7 %8 %9")
+            .arg(m_name, -28)
+            .arg(framesPerSecond, 12, 'f', 0)
+            .arg(QString::number(framesPerSecond / sampleRate, 'f', 1) + QLatin1Char('x'), 10)
+            .arg(percentile(0.5), 9, 'f', 1)
+            .arg(percentile(0.9), 9, 'f', 1)
+            .arg(percentile(0.99), 9, 'f', 1)
+            .arg(sorted.empty() ? 0.0 : sorted.back() / 1000.0, 9, 'f', 1)
+            .arg(steadyAllocations() / steadyBlocks, 11, 'f', 2)
+            .arg(m_finishNanos / 1e6, 10, 'f', 1);
+}
+
+} // namespace Bench
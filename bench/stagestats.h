@@ -0,0 +1,70 @@
+#ifndef BENCH_STAGESTATS_H
+#define BENCH_STAGESTATS_H
+
+#include <QString>
+
+#include <chrono>
+#include <vector>
+
+namespace Bench {
+
+/*
+ * Timing of one pipeline stage, block by block.
+ *
+ * Between begin() and end(), every operator new on the calling thread is
+ * counted, which is how allocations in code that should be realtime-safe
+ * show up. The first few blocks may allocate, for buffers that are set up
+ * on first use. malloc() from C libraries (LAME, libFLAC) isn't seen.
+ *
+ * A stage that has other threads work for it, like the encoder threads
+ * of the pipeline, can count theirs as well, from the end of the warmup
+ * to the last block.
+ */
+class StageStats
+{
+public:
+    StageStats(const QString &name, qint64 expectedBlocks);
+
+    // Must not allocate once warmed up, see allocates()
+    void setRealtime(bool realtime) { m_realtime = realtime; }
+
+    // Counts the allocations of every thread. Only for one stage at a time.
+    void setCountOtherThreads(bool count) { m_countOtherThreads = count; }
+
+    void begin();
+    void end(qint64 frames);
+
+    // Work that isn't per block, like closing the files at the end
+    void beginFinish();
+    void endFinish();
+
+    QString name() const { return m_name; }
+
+    // A realtime stage that allocated after the warmup
+    bool allocates() const { return m_realtime && steadyAllocations() > 0; }
+    qint64 steadyAllocations() const { return m_allocations + m_otherAllocations; }
+
+    // One line for the report, `sampleRate` gives the realtime factor
+    QString report(int sampleRate) const;
+    static QString reportHeader();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    QString m_name;
+    std::vector<qint64> m_blockNanos;
+    qint64 m_frames { 0 };
+    qint64 m_totalNanos { 0 };
+    qint64 m_finishNanos { 0 };
+    qint64 m_allocations { 0 };        // after the warmup
+    qint64 m_otherAllocations { 0 };   // of the other threads, after the warmup
+    qint64 m_processStart { 0 };       // the process wide count when the warmup ended
+    qint64 m_threadStart { 0 };        // and the one of this thread
+    bool m_realtime { false };
+    bool m_countOtherThreads { false };
+    Clock::time_point m_start;
+};
+
+} // namespace Bench
+
+#endif // BENCH_STAGESTATS_H
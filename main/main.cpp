@@ -1,9 +1,13 @@
 #include "mainwindow.h"
 #include <QApplication>
 
+#include "util/trace.h"
+
 #include <QFont>
 #include <QFontDatabase>
 #include <QTranslator>
+#include <QThread>
+#include <QDebug>
 
 int main(int argc, char *argv[])
 {
@@ -22,10 +26,28 @@ int main(int argc, char *argv[])
     // setup font substitution, since windows fonts miss some glyphs
     QFontDatabase::addApplicationFont(":/DejaVuSans.ttf");
 
+    // KUEMMELRECORDER_TRACE=<file> records a trace for chrome://tracing or
+    // ui.perfetto.dev until the application quits
+    const QString traceFile = QString::fromLocal8Bit(qgetenv("KUEMMELRECORDER_TRACE"));
+    if (!traceFile.isEmpty()) {
+        QThread::currentThread()->setObjectName(QStringLiteral("GUI"));
+        Util::Trace::start();
+    }
+
     // create and show the main window
     MainWindow w;
 
     w.show();
 
-    return a.exec();
+    int result = a.exec();
+
+    if (!traceFile.isEmpty()) {
+        Util::Trace::stop();
+
+        QString errorString;
+        if (!Util::Trace::exportChromeJson(traceFile, &errorString))
+            qWarning() << "Could not write the trace to" << traceFile << ":" << errorString;
+    }
+
+    return result;
 }
@@ -29,12 +29,17 @@ MainWindow::MainWindow(QWidget *parent) :
     // Setup the recording subsystem
     m_recorder = new Recording::Coordinator(this);
     m_recorderThread = new QThread(this);
+    m_recorderThread->setObjectName(QStringLiteral("Recording"));
     m_recorder->moveToThread(m_recorderThread);
     QObject::connect(m_recorderThread, &QThread::finished, m_recorder, &QObject::deleteLater); // this is legal and even recommended by the docs for QThread::finished
     m_recorderThread->start();
 
     QObject::connect(m_recorder, &Recording::Coordinator::statusUpdate, ui->recordStatus, &Recording::StatusView::handleStatusUpdate);
+    QObject::connect(m_recorder, &Recording::Coordinator::streamFormatChanged, ui->recordStatus, &Recording::StatusView::setStreamFormat);
+    QObject::connect(m_recorder, &Recording::Coordinator::dropoutStatsChanged, ui->recordStatus, &Recording::StatusView::handleDropoutStats);
+    QObject::connect(m_recorder, &Recording::Coordinator::callbackTimingUpdate, ui->recordStatus, &Recording::StatusView::handleCallbackTiming);
     QObject::connect(m_recorder, &Recording::Coordinator::error, ui->recordError, &Recording::ErrorWidget::displayError);
+    QObject::connect(m_recorder, &Recording::Coordinator::warning, ui->recordError, &Recording::ErrorWidget::displayTemporaryWarning);
 
     Recording::ConfiguratorPane *recordpane = new Recording::ConfiguratorPane(this);
     recordpane->hookupCoordinator(m_recorder);
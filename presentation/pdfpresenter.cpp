@@ -1,6 +1,8 @@
 #include "pdfpresenter.h"
 #include "ui_pdfpresenter.h"
 
+#include "util/trace.h"
+
 #include <poppler-qt5.h>
 #include <QGridLayout>
 #include <QLabel>
@@ -17,6 +19,8 @@ namespace {
     const int ICON_SIZE = 200;
 
     QPixmap createImage(std::shared_ptr<Poppler::Document> pdf, int pageno, int maxWidth, int maxHeight) {
+        TRACE_ZONE("pdf", "createImage");
+
         std::unique_ptr<Poppler::Page> page(pdf->page(pageno));
         if (!page)
             return QPixmap();
@@ -44,6 +48,7 @@ namespace {
     }
 
     std::pair<int /*pageno */, QPixmap> createThumbnail(std::shared_ptr<Poppler::Document> pdf, int pageno) {
+        TRACE_ZONE("pdf", "createThumbnail");
         return std::pair<int, QPixmap>(pageno, createImage(pdf, pageno, ICON_SIZE, ICON_SIZE));
     }
 }
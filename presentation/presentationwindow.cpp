@@ -7,6 +7,8 @@
 #include <QDesktopWidget>
 #include <QCloseEvent>
 
+#include "util/trace.h"
+
 #ifdef Q_OS_WIN32
 #   include <QtWin>
 #endif
@@ -98,6 +100,8 @@ void PresentationWindow::setScreen(const QRect &screen)
 
 void PresentationWindow::setWidget(QWidget *presentation)
 {
+    TRACE_ZONE("presentation", "setWidget");
+
     if ((presentation == m_widget) || !presentation)
         return;
 
@@ -128,6 +132,8 @@ void PresentationWindow::handleWidgetDestroy()
 
 void PresentationWindow::updateStack()
 {
+    TRACE_ZONE("presentation", "updateStack");
+
     if (!m_screen.isEmpty() && isBlank()) {
         m_stack->setCurrentWidget(m_blankLbl);
         this->setVisible(true);
@@ -0,0 +1,63 @@
+#include "audiobackend.h"
+
+namespace Recording {
+
+PortAudioBackend::PortAudioBackend()
+{
+    Pa_Initialize();
+}
+
+PortAudioBackend::~PortAudioBackend()
+{
+    Pa_Terminate();
+}
+
+QString PortAudioBackend::name() const
+{
+    return QStringLiteral("PortAudio");
+}
+
+PaDeviceIndex PortAudioBackend::deviceCount() const
+{
+    return Pa_GetDeviceCount();
+}
+
+const PaDeviceInfo *PortAudioBackend::deviceInfo(PaDeviceIndex device) const
+{
+    return Pa_GetDeviceInfo(device);
+}
+
+PaError PortAudioBackend::isFormatSupported(const PaStreamParameters *input, const PaStreamParameters *output,
+                                            double sampleRate) const
+{
+    return Pa_IsFormatSupported(input, output, sampleRate);
+}
+
+PaError PortAudioBackend::openStream(PaStream **stream, const PaStreamParameters *input, const PaStreamParameters *output,
+                                     double sampleRate, unsigned long framesPerBuffer, PaStreamFlags flags,
+                                     PaStreamCallback *callback, void *userData)
+{
+    return Pa_OpenStream(stream, input, output, sampleRate, framesPerBuffer, flags, callback, userData);
+}
+
+PaError PortAudioBackend::startStream(PaStream *stream)
+{
+    return Pa_StartStream(stream);
+}
+
+PaError PortAudioBackend::stopStream(PaStream *stream)
+{
+    return Pa_StopStream(stream);
+}
+
+PaError PortAudioBackend::closeStream(PaStream *stream)
+{
+    return Pa_CloseStream(stream);
+}
+
+const PaStreamInfo *PortAudioBackend::streamInfo(PaStream *stream) const
+{
+    return Pa_GetStreamInfo(stream);
+}
+
+} // namespace Recording
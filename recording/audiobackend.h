@@ -0,0 +1,69 @@
+#ifndef RECORDING_AUDIOBACKEND_H
+#define RECORDING_AUDIOBACKEND_H
+
+#include <QString>
+
+#include <portaudio.h>
+
+namespace Recording {
+
+/*
+ * The part of PortAudio the coordinator and the additional inputs use,
+ * so that something else can stand in for the sound card, like the
+ * virtual device used for load tests.
+ *
+ * The calls mirror their Pa_* counterparts, including the error codes
+ * and the callback signature: a backend runs the coordinator's real
+ * callback, from whatever thread it likes. Device indices and stream
+ * handles only mean something to the backend that handed them out.
+ */
+class AudioBackend
+{
+public:
+    virtual ~AudioBackend() = default;
+
+    virtual QString name() const = 0;
+
+    virtual PaDeviceIndex deviceCount() const = 0;
+    // nullptr for indices the backend doesn't know
+    virtual const PaDeviceInfo *deviceInfo(PaDeviceIndex device) const = 0;
+
+    virtual PaError isFormatSupported(const PaStreamParameters *input, const PaStreamParameters *output,
+                                      double sampleRate) const = 0;
+
+    virtual PaError openStream(PaStream **stream, const PaStreamParameters *input, const PaStreamParameters *output,
+                               double sampleRate, unsigned long framesPerBuffer, PaStreamFlags flags,
+                               PaStreamCallback *callback, void *userData) = 0;
+    virtual PaError startStream(PaStream *stream) = 0;
+    virtual PaError stopStream(PaStream *stream) = 0;
+    virtual PaError closeStream(PaStream *stream) = 0;
+    virtual const PaStreamInfo *streamInfo(PaStream *stream) const = 0;
+};
+
+// The real thing. PortAudio is initialized for as long as this exists.
+class PortAudioBackend : public AudioBackend
+{
+public:
+    PortAudioBackend();
+    ~PortAudioBackend() override;
+
+    QString name() const override;
+
+    PaDeviceIndex deviceCount() const override;
+    const PaDeviceInfo *deviceInfo(PaDeviceIndex device) const override;
+
+    PaError isFormatSupported(const PaStreamParameters *input, const PaStreamParameters *output,
+                              double sampleRate) const override;
+
+    PaError openStream(PaStream **stream, const PaStreamParameters *input, const PaStreamParameters *output,
+                       double sampleRate, unsigned long framesPerBuffer, PaStreamFlags flags,
+                       PaStreamCallback *callback, void *userData) override;
+    PaError startStream(PaStream *stream) override;
+    PaError stopStream(PaStream *stream) override;
+    PaError closeStream(PaStream *stream) override;
+    const PaStreamInfo *streamInfo(PaStream *stream) const override;
+};
+
+} // namespace Recording
+
+#endif // RECORDING_AUDIOBACKEND_H
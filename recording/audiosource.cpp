@@ -0,0 +1,180 @@
+#include "audiosource.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <QtMath>
+
+#include <cmath>
+#include <cstring>
+
+namespace Recording {
+
+namespace {
+    const quint16 WAVE_FORMAT_PCM        = 0x0001;
+    const quint16 WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+    const quint16 WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+    // Speech-like bursts: on for a while, then a pause, a bit different per channel
+    const double BURST_ON_SECONDS  = 2.3;
+    const double BURST_OFF_SECONDS = 0.9;
+
+    quint16 readU16(const char *p) { return qFromLittleEndian<quint16>(reinterpret_cast<const uchar *>(p)); }
+    quint32 readU32(const char *p) { return qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(p)); }
+
+    float convertSample(const char *p, quint16 formatTag, int bits)
+    {
+        if (formatTag == WAVE_FORMAT_IEEE_FLOAT)
+        {
+            quint32 bits = readU32(p);
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+
+        switch (bits)
+        {
+        case 16:
+            return qint16(readU16(p)) / 32768.0f;
+        case 24:
+        {
+            qint32 v = qint32(quint32(uchar(p[0])) << 8 | quint32(uchar(p[1])) << 16 | quint32(uchar(p[2])) << 24);
+            return float(v >> 8) / 8388608.0f;
+        }
+        default:
+            return float(qint32(readU32(p)) / 2147483648.0);
+        }
+    }
+}
+
+AudioSource AudioSource::synthetic(const StreamFormat &format, qint64 frames)
+{
+    AudioSource source;
+    source.m_format = format;
+    source.m_frames = qMax<qint64>(frames, 1);
+    source.m_samples.resize(size_t(source.m_frames * format.channels));
+
+    const double rate = format.sampleRate;
+    quint32 noise = 0x12345678;
+
+    for (int c = 0; c < format.channels; ++c)
+    {
+        const double frequency = 220.0 * (1.0 + 0.37 * c);
+        const double period = BURST_ON_SECONDS + BURST_OFF_SECONDS + 0.13 * c;
+
+        for (qint64 i = 0; i < source.m_frames; ++i)
+        {
+            const double t = i / rate;
+            const bool on = std::fmod(t, period) < BURST_ON_SECONDS;
+
+            // xorshift, the same every run
+            noise ^= noise << 13;
+            noise ^= noise >> 17;
+            noise ^= noise << 5;
+            const float n = (float(noise) / 4294967296.0f - 0.5f) * 0.01f;
+
+            const float s = on ? 0.25f * float(std::sin(2.0 * M_PI * frequency * t)) : 0.0f;
+            source.m_samples[size_t(i * format.channels + c)] = s + n;
+        }
+    }
+
+    return source;
+}
+
+AudioSource AudioSource::fromWav(const QString &fileName, QString *errorString)
+{
+    AudioSource source;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        *errorString = file.errorString();
+        return source;
+    }
+
+    const QByteArray data = file.readAll();
+    if (data.size() < 12 || !data.startsWith("RIFF") || data.mid(8, 4) != "WAVE")
+    {
+        *errorString = QStringLiteral("not a RIFF/WAVE file");
+        return source;
+    }
+
+    quint16 formatTag = 0;
+    int channels = 0, bits = 0;
+    quint32 sampleRate = 0;
+    qint64 dataOffset = -1, dataSize = 0;
+
+    for (qint64 pos = 12; pos + 8 <= data.size(); )
+    {
+        const char *chunk = data.constData() + pos;
+        const qint64 size = readU32(chunk + 4);
+        const qint64 available = qMin(size, data.size() - pos - 8);
+
+        if (std::memcmp(chunk, "fmt ", 4) == 0 && available >= 16)
+        {
+            formatTag  = readU16(chunk + 8);
+            channels   = readU16(chunk + 10);
+            sampleRate = readU32(chunk + 12);
+            bits       = readU16(chunk + 22);
+
+            // the subformat GUID starts with the format tag
+            if (formatTag == WAVE_FORMAT_EXTENSIBLE && available >= 40)
+                formatTag = readU16(chunk + 32);
+        }
+        else if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            dataOffset = pos + 8;
+            dataSize = available;
+            break;
+        }
+
+        // chunks are padded to an even size
+        pos += 8 + size + (size & 1);
+    }
+
+    const bool pcm = formatTag == WAVE_FORMAT_PCM && (bits == 16 || bits == 24 || bits == 32);
+    const bool ieee = formatTag == WAVE_FORMAT_IEEE_FLOAT && bits == 32;
+
+    if (!pcm && !ieee)
+    {
+        *errorString = QStringLiteral("unsupported sample format (tag %1, %2 bits)").arg(formatTag).arg(bits);
+        return source;
+    }
+    if (channels < 1 || channels > StreamFormat::MAX_CHANNELS || sampleRate == 0)
+    {
+        *errorString = QStringLiteral("unsupported format (%1 channels at %2 Hz)").arg(channels).arg(sampleRate);
+        return source;
+    }
+    if (dataOffset < 0)
+    {
+        *errorString = QStringLiteral("no audio data");
+        return source;
+    }
+
+    const int sampleBytes = bits / 8;
+    const qint64 frames = dataSize / (sampleBytes * channels);
+    if (frames == 0)
+    {
+        *errorString = QStringLiteral("no audio data");
+        return source;
+    }
+
+    source.m_format.sampleRate = int(sampleRate);
+    source.m_format.channels = channels;
+    source.m_frames = frames;
+    source.m_samples.resize(size_t(frames * channels));
+
+    const char *in = data.constData() + dataOffset;
+    for (size_t i = 0; i < source.m_samples.size(); ++i)
+        source.m_samples[i] = convertSample(in + i * size_t(sampleBytes), formatTag, bits);
+
+    return source;
+}
+
+const float *AudioSource::block(qint64 position, qint64 *frames) const
+{
+    const qint64 offset = position % m_frames;
+    *frames = qMin(*frames, m_frames - offset);
+    return m_samples.data() + offset * m_format.channels;
+}
+
+} // namespace Recording
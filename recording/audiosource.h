@@ -0,0 +1,45 @@
+#ifndef RECORDING_AUDIOSOURCE_H
+#define RECORDING_AUDIOSOURCE_H
+
+#include <QString>
+
+#include <vector>
+
+#include "streamformat.h"
+
+namespace Recording {
+
+/*
+ * Test audio for the virtual device and the benchmark, held in memory as
+ * interleaved floats so that reading it doesn't show up in the timings.
+ *
+ * Runs longer than the source loop it from the start, which keeps the
+ * memory needed for long runs with many channels bounded.
+ */
+class AudioSource
+{
+public:
+    // Deterministic test signal: a sine per channel with some noise on top,
+    // switched on and off like speech so that the silence detection has
+    // something to do. The loop is `frames` long.
+    static AudioSource synthetic(const StreamFormat &format, qint64 frames);
+
+    // 16, 24 and 32 bit integer or 32 bit float PCM, plain or extensible
+    static AudioSource fromWav(const QString &fileName, QString *errorString);
+
+    bool isValid() const { return m_frames > 0; }
+    StreamFormat format() const { return m_format; }
+
+    // The block starting at `position` frames into the run. At most
+    // `frames` long, shorter where the loop wraps around.
+    const float *block(qint64 position, qint64 *frames) const;
+
+private:
+    StreamFormat m_format;
+    std::vector<float> m_samples;
+    qint64 m_frames { 0 };
+};
+
+} // namespace Recording
+
+#endif // RECORDING_AUDIOSOURCE_H
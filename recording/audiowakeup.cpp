@@ -0,0 +1,123 @@
+#include "audiowakeup.h"
+
+#include <QDebug>
+#include <QTimer>
+
+#if defined(Q_OS_WIN)
+#  include <QWinEventNotifier>
+#  include <windows.h>
+#else
+#  include <QSocketNotifier>
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <cstdint>
+#  if defined(Q_OS_LINUX)
+#    include <sys/eventfd.h>
+#  endif
+#endif
+
+namespace Recording {
+
+namespace {
+    // the drain loop polled this often before it was woken up by the callback
+    const int FALLBACK_POLL_MSECS = 40;
+}
+
+AudioWakeup::AudioWakeup(QObject *parent) : QObject(parent)
+{
+#if defined(Q_OS_WIN)
+    m_event = CreateEventW(nullptr, FALSE, FALSE, nullptr); // auto-reset
+    if (!m_event)
+    {
+        qWarning() << "AudioWakeup: CreateEvent failed:" << GetLastError();
+        startFallbackTimer();
+        return;
+    }
+
+    auto *n = new QWinEventNotifier(m_event, this);
+    QObject::connect(n, &QWinEventNotifier::activated, this, &AudioWakeup::handleActivated);
+#else
+#  if defined(Q_OS_LINUX)
+    m_readFd = m_writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#  else
+    int fds[2];
+    if (pipe(fds) == 0)
+    {
+        for (int fd : fds)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        m_readFd = fds[0];
+        m_writeFd = fds[1];
+    }
+#  endif
+
+    if (m_readFd < 0)
+    {
+        qWarning() << "AudioWakeup: Could not create wakeup file descriptor";
+        startFallbackTimer();
+        return;
+    }
+
+    auto *n = new QSocketNotifier(m_readFd, QSocketNotifier::Read, this);
+    QObject::connect(n, &QSocketNotifier::activated, this, &AudioWakeup::handleActivated);
+#endif
+}
+
+AudioWakeup::~AudioWakeup()
+{
+#if defined(Q_OS_WIN)
+    if (m_event)
+        CloseHandle(m_event);
+#else
+    if (m_writeFd >= 0 && m_writeFd != m_readFd)
+        ::close(m_writeFd);
+    if (m_readFd >= 0)
+        ::close(m_readFd);
+#endif
+}
+
+void AudioWakeup::notify()
+{
+#if defined(Q_OS_WIN)
+    if (m_event)
+        SetEvent(m_event);
+#elif defined(Q_OS_LINUX)
+    uint64_t one = 1;
+    if (m_writeFd >= 0 && ::write(m_writeFd, &one, sizeof(one)) < 0)
+    {
+        // counter is saturated, which means a wakeup is pending anyway
+    }
+#else
+    char one = 1;
+    if (m_writeFd >= 0 && ::write(m_writeFd, &one, sizeof(one)) < 0)
+    {
+        // pipe is full, which means a wakeup is pending anyway
+    }
+#endif
+}
+
+void AudioWakeup::startFallbackTimer()
+{
+    qWarning() << "AudioWakeup: Polling every" << FALLBACK_POLL_MSECS << "ms instead";
+
+    auto *timer = new QTimer(this);
+    QObject::connect(timer, &QTimer::timeout, this, &AudioWakeup::woken);
+    timer->start(FALLBACK_POLL_MSECS);
+}
+
+void AudioWakeup::handleActivated()
+{
+#if !defined(Q_OS_WIN)
+    // reset the level-triggered notifier
+    char buf[64];
+    while (::read(m_readFd, buf, sizeof(buf)) > 0)
+    {
+    }
+#endif
+
+    emit woken();
+}
+
+} // namespace Recording
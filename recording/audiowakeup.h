@@ -0,0 +1,47 @@
+#ifndef RECORDING_AUDIOWAKEUP_H
+#define RECORDING_AUDIOWAKEUP_H
+
+#include <QObject>
+
+namespace Recording {
+
+/*
+ * Lets the audio callback wake up the drain loop.
+ *
+ * notify() is realtime-safe: It doesn't lock or allocate, it is a single
+ * non-blocking write to an eventfd (Linux), a pipe (other unixes) or a
+ * SetEvent() call (Windows). The other end is hooked into the Qt event
+ * loop of the thread this object lives in, which then emits woken().
+ *
+ * If the system can't give us any of these, woken() is emitted by a
+ * timer instead, often enough that the ring buffer doesn't overflow.
+ */
+class AudioWakeup : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AudioWakeup(QObject *parent = nullptr);
+    ~AudioWakeup();
+
+    void notify();
+
+signals:
+    void woken();
+
+private slots:
+    void handleActivated();
+
+private:
+    void startFallbackTimer();
+
+#ifdef Q_OS_WIN
+    void *m_event { nullptr };
+#else
+    int m_readFd { -1 };
+    int m_writeFd { -1 };
+#endif
+};
+
+} // namespace Recording
+
+#endif // RECORDING_AUDIOWAKEUP_H
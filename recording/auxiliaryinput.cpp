@@ -0,0 +1,256 @@
+#include "auxiliaryinput.h"
+
+#include <QtMath>
+
+#include <cmath>
+#include <cstring>
+
+namespace Recording {
+
+namespace {
+    const double RING_BUFFER_SECONDS = 2.0;
+
+    // Where the drift control keeps the ring buffer, at least three device buffers
+    const double TARGET_FILL_SECONDS = 0.05;
+
+    // Further off than this, the loop would take too long: drop or pad right away
+    const double RESYNC_SECONDS = 0.25;
+
+    // Control loop, errors in seconds of fill, about critically damped. 10 ms off make 500 ppm.
+    const double FILL_SMOOTHING = 0.05;
+    const double PROPORTIONAL_GAIN = 0.05;
+    const double INTEGRAL_GAIN = 0.0006;
+    const double MAX_CORRECTION = 0.005;
+
+    const qint64 INPUT_CAPACITY = 2 * AuxiliaryInput::MAX_PULL_FRAMES + 8;
+
+    // Catmull-Rom between x0 and x1
+    inline float interpolate(float xm1, float x0, float x1, float x2, float t)
+    {
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+        return ((c3 * t + c2) * t + c1) * t + x0;
+    }
+}
+
+AuxiliaryInput::AuxiliaryInput(AudioBackend &backend, PaDeviceIndex device, const StreamFormat &format)
+    : m_backend(backend), m_device(device), m_format(format)
+{
+    m_output = std::make_unique<float[]>(size_t(MAX_PULL_FRAMES * format.channels));
+}
+
+AuxiliaryInput::~AuxiliaryInput()
+{
+    stop();
+}
+
+QString AuxiliaryInput::name() const
+{
+    const PaDeviceInfo *info = m_backend.deviceInfo(m_device);
+    return info ? QString::fromLocal8Bit(info->name) : QString();
+}
+
+bool AuxiliaryInput::start(const PaStreamParameters &params)
+{
+    stop();
+
+    m_inChannels = params.channelCount;
+
+    int frames = int(qNextPowerOfTwo(quint32(m_format.sampleRate * RING_BUFFER_SECONDS)));
+    m_ringbufferData = std::make_unique<float[]>(size_t(frames * m_inChannels));
+    PaUtil_InitializeRingBuffer(&m_ringbuffer, m_inChannels * int(sizeof(float)), frames, m_ringbufferData.get());
+
+    m_input = std::make_unique<float[]>(size_t(INPUT_CAPACITY * m_inChannels));
+    std::memset(m_input.get(), 0, size_t(m_inChannels) * sizeof(float));
+    m_inputFill = 1;
+    m_inputPos = 1;
+    m_fraction = 0;
+
+    m_primed = false;
+    m_integral = 0;
+    m_ratio = 1.0;
+    m_maxCallbackFrames = 0;
+    m_overflowed = false;
+
+    PaError err = m_backend.openStream(&m_stream, &params, nullptr, m_format.sampleRate,
+                                       paFramesPerBufferUnspecified, paNoFlag,
+                                       &AuxiliaryInput::audioCallback, this);
+    if (err != paNoError)
+    {
+        m_stream = nullptr;
+        m_errorString = Pa_GetErrorText(err);
+        return false;
+    }
+
+    err = m_backend.startStream(m_stream);
+    if (err != paNoError)
+    {
+        m_errorString = Pa_GetErrorText(err);
+        stop();
+        return false;
+    }
+
+    return true;
+}
+
+void AuxiliaryInput::stop()
+{
+    if (!m_stream)
+        return;
+
+    m_backend.stopStream(m_stream);
+    m_backend.closeStream(m_stream);
+    m_stream = nullptr;
+}
+
+int AuxiliaryInput::audioCallback(const void *inputBuffer, void */*outputBuffer*/,
+                                  unsigned long framesPerBuffer,
+                                  const PaStreamCallbackTimeInfo */*timeInfo*/,
+                                  PaStreamCallbackFlags statusFlags, void *userData)
+{
+    AuxiliaryInput *self = static_cast<AuxiliaryInput*>(userData);
+
+    if (!inputBuffer)
+        return paContinue;
+
+    if (int(framesPerBuffer) > self->m_maxCallbackFrames.load(std::memory_order_relaxed))
+        self->m_maxCallbackFrames.store(int(framesPerBuffer), std::memory_order_relaxed);
+
+    ring_buffer_size_t written = PaUtil_WriteRingBuffer(&self->m_ringbuffer, inputBuffer, ring_buffer_size_t(framesPerBuffer));
+
+    if ((unsigned long)written < framesPerBuffer || (statusFlags & paInputOverflow))
+        self->m_overflowed.store(true, std::memory_order_relaxed);
+
+    return paContinue;
+}
+
+bool AuxiliaryInput::takeDiscontinuity()
+{
+    bool result = m_discontinuity;
+    m_discontinuity = false;
+    return result;
+}
+
+void AuxiliaryInput::updateRatio(qint64 frames)
+{
+    const double rate = m_format.sampleRate;
+    const qint64 available = PaUtil_GetRingBufferReadAvailable(&m_ringbuffer);
+    const qint64 fill = available + (m_inputFill - m_inputPos - 1);
+    const double target = qMax(rate * TARGET_FILL_SECONDS, 3.0 * m_maxCallbackFrames.load(std::memory_order_relaxed));
+
+    // Way too much, e.g. after the drain loop was stuck: drop the oldest
+    if (fill - target > rate * RESYNC_SECONDS)
+    {
+        PaUtil_AdvanceRingBufferReadIndex(&m_ringbuffer, ring_buffer_size_t(qMin(available, qint64(fill - target))));
+        m_fillAverage = target;
+        m_discontinuity = true;
+        return;
+    }
+
+    if (!m_primed)
+    {
+        // pad with silence until there is enough to run from
+        if (fill < target)
+            return;
+
+        m_primed = true;
+        m_fillAverage = fill;
+    }
+
+    m_fillAverage += (fill - m_fillAverage) * FILL_SMOOTHING;
+
+    double error = (m_fillAverage - target) / rate;
+    m_integral = qBound(-MAX_CORRECTION, m_integral + INTEGRAL_GAIN * error * frames / rate, MAX_CORRECTION);
+    m_ratio = 1.0 + qBound(-MAX_CORRECTION, PROPORTIONAL_GAIN * error + m_integral, MAX_CORRECTION);
+}
+
+// Moves what is still needed to the front and reads more behind it
+bool AuxiliaryInput::refill()
+{
+    const qint64 keep = m_inputFill - (m_inputPos - 1);
+    std::memmove(m_input.get(), m_input.get() + (m_inputPos - 1) * m_inChannels, size_t(keep * m_inChannels) * sizeof(float));
+    m_inputFill = keep;
+    m_inputPos = 1;
+
+    ring_buffer_size_t read = PaUtil_ReadRingBuffer(&m_ringbuffer, m_input.get() + m_inputFill * m_inChannels,
+                                                    ring_buffer_size_t(INPUT_CAPACITY - m_inputFill));
+    m_inputFill += read;
+
+    return read > 0;
+}
+
+const float *AuxiliaryInput::pull(qint64 frames)
+{
+    frames = qMin(frames, MAX_PULL_FRAMES);
+
+    if (m_overflowed.exchange(false, std::memory_order_relaxed))
+        m_discontinuity = true;
+
+    updateRatio(frames);
+
+    const int outChannels = m_format.channels;
+    float *out = m_output.get();
+    qint64 i = 0;
+
+    for (; m_primed && i < frames; ++i)
+    {
+        // the interpolation needs one frame before the position and two after it
+        while (m_inputPos + 2 >= m_inputFill)
+        {
+            if (!refill())
+            {
+                // the device fell behind, wait until it has caught up again
+                m_primed = false;
+                m_discontinuity = true;
+                break;
+            }
+        }
+        if (!m_primed)
+            break;
+
+        const float *x = m_input.get() + (m_inputPos - 1) * m_inChannels;
+        const float t = float(m_fraction);
+        float *o = out + i * outChannels;
+
+        if (m_inChannels == outChannels)
+        {
+            for (int c = 0; c < outChannels; ++c)
+                o[c] = interpolate(x[c], x[c + m_inChannels], x[c + 2 * m_inChannels], x[c + 3 * m_inChannels], t);
+        }
+        else if (outChannels > 2)
+        {
+            // into the first two channels of a multichannel input, mono on both
+            const int in = m_inChannels;
+            o[0] = interpolate(x[0], x[in], x[2 * in], x[3 * in], t);
+            o[1] = in > 1 ? interpolate(x[1], x[1 + in], x[1 + 2 * in], x[1 + 3 * in], t) : o[0];
+            for (int c = 2; c < outChannels; ++c)
+                o[c] = 0.0f;
+        }
+        else if (m_inChannels == 1)
+        {
+            float v = interpolate(x[0], x[1], x[2], x[3], t);
+            for (int c = 0; c < outChannels; ++c)
+                o[c] = v;
+        }
+        else
+        {
+            // stereo into mono
+            float l = interpolate(x[0], x[2], x[4], x[6], t);
+            float r = interpolate(x[1], x[3], x[5], x[7], t);
+            o[0] = 0.5f * (l + r);
+        }
+
+        m_fraction += m_ratio;
+        qint64 step = qint64(m_fraction);
+        m_fraction -= step;
+        m_inputPos += step;
+    }
+
+    if (i < frames)
+        std::memset(out + i * outChannels, 0, size_t((frames - i) * outChannels) * sizeof(float));
+
+    return out;
+}
+
+} // namespace Recording
@@ -0,0 +1,109 @@
+#ifndef RECORDING_AUXILIARYINPUT_H
+#define RECORDING_AUXILIARYINPUT_H
+
+#include <QString>
+
+#include <atomic>
+#include <memory>
+
+#include <portaudio.h>
+
+#include "audiobackend.h"
+#include "external/pa_ringbuffer.h"
+#include "prerollbuffer.h"
+#include "streamformat.h"
+
+namespace Recording {
+
+/*
+ * A further input device recorded alongside the main one, e.g. a room
+ * microphone on a second USB interface.
+ *
+ * The device runs its own stream, whose callback only copies
+ * into a lock-free ring buffer. The drain loop pulls exactly as many
+ * frames as it got from the main input and resamples on the way, so the
+ * two stay in step although their clocks drift apart: a slow control
+ * loop keeps the ring buffer at its target fill by nudging the
+ * resampling ratio by a few hundred ppm. Both devices have to run at the
+ * same nominal sample rate, the resampler (cubic interpolation) is only
+ * meant for drift, not for rate conversion.
+ *
+ * Pulled audio comes in the main input's channel layout, a multichannel
+ * main input gets it in its first two channels. Whenever the device
+ * can't deliver, the gap is filled with silence.
+ */
+class AuxiliaryInput
+{
+public:
+    // Frames per pull() at most
+    static constexpr qint64 MAX_PULL_FRAMES = 4096;
+
+    AuxiliaryInput(AudioBackend &backend, PaDeviceIndex device, const StreamFormat &format);
+    ~AuxiliaryInput();
+
+    // Opens the device at the format's sample rate. The channel count in
+    // params is what the device delivers, mono and stereo are fine.
+    bool start(const PaStreamParameters &params);
+    void stop();
+    QString errorString() const { return m_errorString; }
+
+    PaDeviceIndex device() const { return m_device; }
+    QString name() const;
+
+    // Drain loop only. The next frames of this device on the main input's clock,
+    // valid until the next call.
+    const float *pull(qint64 frames);
+
+    // Whether audio had to be dropped or padded since the last call
+    bool takeDiscontinuity();
+
+    // How much faster than the main input this device currently seems to run
+    double driftPpm() const { return (m_ratio - 1.0) * 1e6; }
+
+    // Kept in step with the main input's pre-roll by the drain loop
+    PreRollBuffer &preRoll() { return m_preRoll; }
+
+private:
+    static int audioCallback(const void *inputBuffer, void *outputBuffer,
+                             unsigned long framesPerBuffer,
+                             const PaStreamCallbackTimeInfo *timeInfo,
+                             PaStreamCallbackFlags statusFlags,
+                             void *userData);
+
+    void updateRatio(qint64 frames);
+    bool refill();
+
+    AudioBackend &m_backend;
+    PaDeviceIndex m_device;
+    StreamFormat  m_format;
+    int           m_inChannels { 2 };
+    PaStream     *m_stream { nullptr };
+    QString       m_errorString;
+
+    // written by the callback
+    std::unique_ptr<float[]> m_ringbufferData;
+    PaUtilRingBuffer m_ringbuffer {};
+    std::atomic<int> m_maxCallbackFrames { 0 };
+    std::atomic_bool m_overflowed { false };
+
+    // resampler input: one frame of history, then what was read from the ring buffer
+    std::unique_ptr<float[]> m_input;
+    qint64 m_inputFill { 0 };
+    qint64 m_inputPos { 1 };    // frame at or before the current position
+    double m_fraction { 0 };    // between m_inputPos and the frame after it
+
+    std::unique_ptr<float[]> m_output;
+
+    // drift control
+    bool   m_primed { false };
+    double m_fillAverage { 0 };
+    double m_integral { 0 };
+    double m_ratio { 1.0 };     // input frames per output frame
+    bool   m_discontinuity { false };
+
+    PreRollBuffer m_preRoll;
+};
+
+} // namespace Recording
+
+#endif // RECORDING_AUXILIARYINPUT_H
@@ -0,0 +1,261 @@
+#include "bufferedfilewriter.h"
+
+#include <QMutexLocker>
+
+#include <cstring>
+
+#if defined(Q_OS_WIN)
+#  include <windows.h>
+#  include <io.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+namespace Recording {
+
+namespace {
+    const qint64 BLOCK_SIZE = 256 * 1024;
+    const size_t BLOCK_ALIGNMENT = 4096;
+
+    // how far disk space is reserved ahead of the data
+    const qint64 PREALLOCATE_STEP = 32 * 1024 * 1024;
+}
+
+BufferedFileWriter::BufferedFileWriter(const QString &fileName, QObject *parent)
+    : QIODevice(parent), m_file(fileName), m_thread(this)
+{
+}
+
+BufferedFileWriter::~BufferedFileWriter()
+{
+    close();
+
+    for (Block &b : m_blocks)
+        qFreeAligned(b.data);
+}
+
+bool BufferedFileWriter::open(OpenMode mode)
+{
+    if (mode & ReadOnly)
+    {
+        setErrorString(tr("Can only be opened for writing"));
+        return false;
+    }
+
+    if (!m_file.open(mode | Unbuffered))
+    {
+        setErrorString(m_file.errorString());
+        return false;
+    }
+
+    m_freeCount = 0;
+    for (Block &b : m_blocks)
+    {
+        if (!b.data)
+            b.data = static_cast<char*>(qMallocAligned(size_t(BLOCK_SIZE), BLOCK_ALIGNMENT));
+        b.used = 0;
+        m_free[m_freeCount++] = &b;
+    }
+
+    m_current = m_free[--m_freeCount];
+    m_current->offset = 0;
+    m_queueHead = 0;
+    m_queueSize = 0;
+    m_stopping = false;
+    m_failed = false;
+    m_size = m_file.size();
+    m_allocated = m_size;
+    m_canPreallocate = true;
+
+    m_thread.start();
+
+    return QIODevice::open(mode | Unbuffered);
+}
+
+void BufferedFileWriter::close()
+{
+    if (!isOpen())
+        return;
+
+    if (!waitForIdle())
+        setErrorString(m_error);
+
+    {
+        QMutexLocker lock(&m_mutex);
+        m_stopping = true;
+        m_queued.wakeAll();
+    }
+    m_thread.wait();
+
+    // give back the space we reserved but didn't need
+    if (m_allocated > m_size)
+        m_file.resize(m_size);
+
+    m_file.close();
+
+    QIODevice::close();
+}
+
+bool BufferedFileWriter::syncToDisk()
+{
+    if (!waitForIdle())
+        return false;
+
+    // the writer thread is idle, so we can touch the file
+    return syncFile(&m_file);
+}
+
+bool BufferedFileWriter::syncFile(QFileDevice *file)
+{
+    if (!file->flush())
+        return false;
+
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers(HANDLE(_get_osfhandle(file->handle())));
+#elif defined(Q_OS_LINUX)
+    return fdatasync(file->handle()) == 0;
+#else
+    return fsync(file->handle()) == 0;
+#endif
+}
+
+qint64 BufferedFileWriter::readData(char *, qint64)
+{
+    return -1;
+}
+
+qint64 BufferedFileWriter::writeData(const char *data, qint64 size)
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        if (m_failed)
+        {
+            setErrorString(m_error);
+            return -1;
+        }
+    }
+
+    // we are called before QIODevice moves the position
+    const qint64 start = pos();
+
+    if (m_current->used && start != m_current->offset + m_current->used)
+        submit();
+    if (!m_current->used)
+        m_current->offset = start;
+
+    qint64 done = 0;
+    while (done < size)
+    {
+        qint64 n = qMin(size - done, BLOCK_SIZE - m_current->used);
+        memcpy(m_current->data + m_current->used, data + done, size_t(n));
+        m_current->used += n;
+        done += n;
+
+        if (m_current->used == BLOCK_SIZE)
+        {
+            submit();
+            m_current->offset = start + done;
+        }
+    }
+
+    m_size = qMax(m_size, start + size);
+
+    return size;
+}
+
+// Queues the current block and takes a free one, waiting for the disk if there is none
+void BufferedFileWriter::submit()
+{
+    QMutexLocker lock(&m_mutex);
+
+    m_queue[(m_queueHead + m_queueSize) % BLOCK_COUNT] = m_current;
+    ++m_queueSize;
+    m_queued.wakeOne();
+
+    while (!m_freeCount)
+        m_written.wait(&m_mutex);
+
+    m_current = m_free[--m_freeCount];
+    m_current->used = 0;
+}
+
+bool BufferedFileWriter::waitForIdle()
+{
+    if (m_current && m_current->used)
+        submit();
+
+    QMutexLocker lock(&m_mutex);
+    while (m_queueSize)
+        m_written.wait(&m_mutex);
+
+    return !m_failed;
+}
+
+void BufferedFileWriter::writeLoop()
+{
+    for (;;)
+    {
+        Block *block;
+        {
+            QMutexLocker lock(&m_mutex);
+            while (!m_queueSize && !m_stopping)
+                m_queued.wait(&m_mutex);
+
+            if (!m_queueSize)
+                return;
+
+            block = m_queue[m_queueHead];
+        }
+
+        // the block stays in the queue while we write it, so waitForIdle() waits for us
+        bool ok = m_failed || writeBlock(block);
+
+        QMutexLocker lock(&m_mutex);
+        m_queueHead = (m_queueHead + 1) % BLOCK_COUNT;
+        --m_queueSize;
+        m_free[m_freeCount++] = block;
+
+        if (!ok && !m_failed)
+        {
+            m_failed = true;
+            m_error = m_file.errorString();
+        }
+
+        m_written.wakeAll();
+    }
+}
+
+bool BufferedFileWriter::writeBlock(const Block *block)
+{
+    preallocate(block->offset + block->used);
+
+    return m_file.seek(block->offset)
+        && m_file.write(block->data, block->used) == block->used;
+}
+
+void BufferedFileWriter::preallocate(qint64 end)
+{
+    if (!m_canPreallocate || end <= m_allocated)
+        return;
+
+    qint64 target = end + PREALLOCATE_STEP;
+
+    // Only reserve the space, the file size must keep telling the truth
+    // in case we crash. File systems that can't do that (FAT) just don't.
+#if defined(Q_OS_LINUX)
+    m_canPreallocate = fallocate(m_file.handle(), FALLOC_FL_KEEP_SIZE, m_allocated, target - m_allocated) == 0;
+#elif defined(Q_OS_WIN)
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = target;
+    m_canPreallocate = SetFileInformationByHandle(HANDLE(_get_osfhandle(m_file.handle())),
+                                                  FileAllocationInfo, &info, sizeof(info));
+#else
+    m_canPreallocate = false;
+#endif
+
+    if (m_canPreallocate)
+        m_allocated = target;
+}
+
+} // namespace Recording
@@ -0,0 +1,103 @@
+#ifndef RECORDING_BUFFEREDFILEWRITER_H
+#define RECORDING_BUFFEREDFILEWRITER_H
+
+#include <QIODevice>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+namespace Recording {
+
+/*
+ * A write-only file that collects everything written to it in large
+ * blocks and leaves the actual writing to a thread of its own, so that
+ * a disk that stalls for a moment (SD cards, USB sticks) only delays
+ * that thread and not the encoder.
+ *
+ * Seeking and overwriting works, e.g. for headers that are fixed up at
+ * the end; writes reach the file in the order they were made. Where the
+ * file system supports it, disk space is reserved ahead of the data.
+ *
+ * write() only blocks if all blocks are waiting for the disk.
+ */
+class BufferedFileWriter : public QIODevice
+{
+    Q_OBJECT
+public:
+    explicit BufferedFileWriter(const QString &fileName, QObject *parent = nullptr);
+    ~BufferedFileWriter();
+
+    QString fileName() const { return m_file.fileName(); }
+
+    bool open(OpenMode mode) override;
+    void close() override;
+
+    bool isSequential() const override { return false; }
+    qint64 size() const override { return m_size; }
+
+    // Waits until everything written so far is on the disk, not just with the OS
+    bool syncToDisk();
+
+    static bool syncFile(QFileDevice *file);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+    qint64 writeData(const char *data, qint64 size) override;
+
+private:
+    struct Block
+    {
+        char  *data;
+        qint64 offset;
+        qint64 used;
+    };
+
+    class WriterThread : public QThread
+    {
+    public:
+        explicit WriterThread(BufferedFileWriter *writer) : m_writer(writer) {}
+    protected:
+        void run() override { m_writer->writeLoop(); }
+    private:
+        BufferedFileWriter *m_writer;
+    };
+
+    static const int BLOCK_COUNT = 8;
+
+    void submit();
+    bool waitForIdle();
+    void writeLoop();
+    bool writeBlock(const Block *block);
+    void preallocate(qint64 end);
+
+    QFile m_file;
+    WriterThread m_thread;
+
+    QMutex m_mutex;
+    QWaitCondition m_queued;
+    QWaitCondition m_written;
+
+    // everything below m_mutex is protected by it, except m_current
+    Block  m_blocks[BLOCK_COUNT] {};
+    Block *m_queue[BLOCK_COUNT] {};
+    int    m_queueHead { 0 };
+    int    m_queueSize { 0 };
+    Block *m_free[BLOCK_COUNT] {};
+    int    m_freeCount { 0 };
+    bool   m_stopping { false };
+    bool   m_failed { false };
+    QString m_error;
+
+    // only touched by the thread calling write()
+    Block *m_current { nullptr };
+    qint64 m_size { 0 };
+
+    // only touched by the writer thread
+    qint64 m_allocated { 0 };
+    bool   m_canPreallocate { true };
+};
+
+} // namespace Recording
+
+#endif // RECORDING_BUFFEREDFILEWRITER_H
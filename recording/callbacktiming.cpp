@@ -0,0 +1,125 @@
+#include "callbacktiming.h"
+
+#include <QtAlgorithms>
+
+namespace Recording {
+
+namespace {
+    // Only the callback writes, so a load and a store do instead of a locked read-modify-write
+    inline void increment(std::atomic<qint64> &counter, qint64 by = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+}
+
+int CallbackTiming::bucket(qint64 nanos)
+{
+    if (nanos < 4)
+        return int(qMax<qint64>(nanos, 0));
+
+    // octave from the highest bit, quarter from the two below it
+    const int msb = 63 - int(qCountLeadingZeroBits(quint64(nanos)));
+    const int quarter = int(nanos >> (msb - 2)) & 3;
+    return qMin((msb - 1) * 4 + quarter, BUCKETS - 1);
+}
+
+qint64 CallbackTiming::bucketLimit(int bucket)
+{
+    if (bucket < 4)
+        return bucket + 1;
+
+    const int msb = bucket / 4 + 1;
+    const int quarter = bucket % 4;
+    return qint64(5 + quarter) << (msb - 2);
+}
+
+void CallbackTiming::record(qint64 nanos, qint64 budgetNanos)
+{
+    std::atomic<qint64> &b = m_buckets[bucket(nanos)];
+    increment(b);
+    increment(m_callbacks);
+    increment(m_busyNanos, nanos);
+    increment(m_availableNanos, budgetNanos);
+    m_budgetNanos.store(budgetNanos, std::memory_order_relaxed);
+
+    if (nanos > budgetNanos)
+        increment(m_overBudget);
+
+    if (nanos > m_maxNanos.load(std::memory_order_relaxed))
+        m_maxNanos.store(nanos, std::memory_order_relaxed);
+
+    // the snapshot side resets this one, so it needs a proper compare and swap
+    qint64 recent = m_recentMaxNanos.load(std::memory_order_relaxed);
+    while (nanos > recent && !m_recentMaxNanos.compare_exchange_weak(recent, nanos, std::memory_order_relaxed))
+        ;
+}
+
+void CallbackTiming::reset()
+{
+    for (std::atomic<qint64> &b : m_buckets)
+        b.store(0, std::memory_order_relaxed);
+
+    m_callbacks.store(0, std::memory_order_relaxed);
+    m_overBudget.store(0, std::memory_order_relaxed);
+    m_maxNanos.store(0, std::memory_order_relaxed);
+    m_recentMaxNanos.store(0, std::memory_order_relaxed);
+    m_budgetNanos.store(0, std::memory_order_relaxed);
+    m_busyNanos.store(0, std::memory_order_relaxed);
+    m_availableNanos.store(0, std::memory_order_relaxed);
+
+    m_lastBusyNanos = 0;
+    m_lastAvailableNanos = 0;
+}
+
+qint64 CallbackTiming::percentile(const qint64 *counts, qint64 total, double p) const
+{
+    const qint64 rank = qint64(p * double(total));
+    qint64 seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        seen += counts[i];
+        if (seen > rank)
+            return bucketLimit(i);
+    }
+
+    return bucketLimit(BUCKETS - 1);
+}
+
+CallbackTimingSnapshot CallbackTiming::snapshot()
+{
+    CallbackTimingSnapshot s;
+
+    // Read while the callback keeps going, so the numbers may be off by the
+    // callback running right now. Good enough for a display.
+    qint64 counts[BUCKETS];
+    qint64 total = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    s.callbacks = m_callbacks.load(std::memory_order_relaxed);
+    s.overBudget = m_overBudget.load(std::memory_order_relaxed);
+    s.maxNanos = m_maxNanos.load(std::memory_order_relaxed);
+    s.recentMaxNanos = m_recentMaxNanos.exchange(0, std::memory_order_relaxed);
+    s.budgetNanos = m_budgetNanos.load(std::memory_order_relaxed);
+
+    if (total)
+    {
+        s.p50Nanos = percentile(counts, total, 0.5);
+        s.p99Nanos = percentile(counts, total, 0.99);
+        s.p999Nanos = percentile(counts, total, 0.999);
+    }
+
+    const qint64 busy = m_busyNanos.load(std::memory_order_relaxed);
+    const qint64 available = m_availableNanos.load(std::memory_order_relaxed);
+    if (available > m_lastAvailableNanos)
+        s.load = double(busy - m_lastBusyNanos) / double(available - m_lastAvailableNanos);
+    m_lastBusyNanos = busy;
+    m_lastAvailableNanos = available;
+
+    return s;
+}
+
+} // namespace Recording
@@ -0,0 +1,98 @@
+#ifndef RECORDING_CALLBACKTIMING_H
+#define RECORDING_CALLBACKTIMING_H
+
+#include <QMetaType>
+
+#include <atomic>
+#include <chrono>
+
+// Build with CONFIG+=no_callback_timing to leave the measurement out of
+// the audio callback altogether
+#ifndef RECORDING_NO_CALLBACK_TIMING
+#  define RECORDING_CALLBACK_TIMING 1
+#endif
+
+namespace Recording {
+
+// What CallbackTiming saw, times in nanoseconds. Percentiles are upper
+// bounds of histogram buckets, so up to 25% high.
+struct CallbackTimingSnapshot
+{
+    qint64 callbacks = 0;        // since the stream was started
+    qint64 overBudget = 0;       // took longer than their buffer lasts
+    qint64 maxNanos = 0;         // longest since the stream was started
+    qint64 recentMaxNanos = 0;   // longest since the previous snapshot
+    qint64 budgetNanos = 0;      // what the latest buffer lasts
+    qint64 p50Nanos = 0;
+    qint64 p99Nanos = 0;
+    qint64 p999Nanos = 0;
+    double load = 0;             // time taken per time available since the previous snapshot
+};
+
+/*
+ * Measures how long the audio callback takes compared to the buffer it
+ * handles, which is the one thing that has to stay below 100% for
+ * glitch-free audio.
+ *
+ * The callback records into a histogram with four buckets per octave,
+ * plain atomics written by that thread only: no locks, no allocations,
+ * two clock reads per callback. Any other single thread can take
+ * snapshots of it.
+ */
+class CallbackTiming
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Measures its own lifetime, put it first thing into the callback
+    class Scope
+    {
+    public:
+        Scope(CallbackTiming &timing, qint64 budgetNanos)
+            : m_timing(timing), m_budget(budgetNanos), m_start(Clock::now()) {}
+        ~Scope()
+        {
+            m_timing.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count(), m_budget);
+        }
+
+    private:
+        CallbackTiming &m_timing;
+        qint64 m_budget;
+        Clock::time_point m_start;
+    };
+
+    // Callback thread only, realtime-safe
+    void record(qint64 nanos, qint64 budgetNanos);
+
+    // Only while no callback runs, e.g. before a stream is started
+    void reset();
+
+    CallbackTimingSnapshot snapshot();
+
+private:
+    // four per octave up to 2^35 ns, about half a minute
+    static constexpr int BUCKETS = 140;
+
+    static int bucket(qint64 nanos);
+    static qint64 bucketLimit(int bucket);
+    qint64 percentile(const qint64 *counts, qint64 total, double p) const;
+
+    std::atomic<qint64> m_buckets[BUCKETS] {};
+    std::atomic<qint64> m_callbacks { 0 };
+    std::atomic<qint64> m_overBudget { 0 };
+    std::atomic<qint64> m_maxNanos { 0 };
+    std::atomic<qint64> m_recentMaxNanos { 0 };
+    std::atomic<qint64> m_budgetNanos { 0 };
+    std::atomic<qint64> m_busyNanos { 0 };
+    std::atomic<qint64> m_availableNanos { 0 };
+
+    // snapshot side
+    qint64 m_lastBusyNanos { 0 };
+    qint64 m_lastAvailableNanos { 0 };
+};
+
+} // namespace Recording
+
+Q_DECLARE_METATYPE(Recording::CallbackTimingSnapshot)
+
+#endif // RECORDING_CALLBACKTIMING_H
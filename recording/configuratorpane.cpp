@@ -4,9 +4,19 @@
 #include <QSettings>
 #include <QStandardPaths>
 #include <QFileDialog>
+#include <QListWidget>
+#include <QTableWidget>
 #include <portaudio.h>
 
 #include "coordinator.h"
+#include "encoderregistry.h"
+#include "util/misc.h"
+
+#include <cmath>
+
+namespace {
+    const int BUFFER_SIZES[] = { 32, 64, 128, 256, 512, 1024, 2048 };
+}
 
 namespace Recording {
 
@@ -29,6 +39,11 @@ ConfiguratorPane::ConfiguratorPane(QWidget *parent) :
         if (Coordinator::isSupportedInput(i, info))
         {
             ui->cbRecordDev->addItem(QString::fromLocal8Bit(info->name), QVariant::fromValue(i));
+
+            QListWidgetItem *item = new QListWidgetItem(QString::fromLocal8Bit(info->name), ui->lwAuxDevices);
+            item->setData(Qt::UserRole, QVariant::fromValue(i));
+            item->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
+            item->setCheckState(Qt::Unchecked);
         }
 
         if (Coordinator::isSupportedOutput(i, info))
@@ -57,7 +72,36 @@ ConfiguratorPane::ConfiguratorPane(QWidget *parent) :
         ui->cbMonitorDev->setCurrentIndex(ui->cbMonitorDev->findData(QVariant::fromValue(Pa_GetDefaultOutputDevice())));
     }
 
+    // by name, the indices change when devices come and go
+    QStringList auxDevices = settings.value("Auxiliary Devices", QVariant::fromValue(QStringList())).toStringList();
+    for (int j = 0; j < ui->lwAuxDevices->count(); ++j)
+    {
+        QListWidgetItem *item = ui->lwAuxDevices->item(j);
+        item->setCheckState(auxDevices.contains(item->text()) ? Qt::Checked : Qt::Unchecked);
+    }
+    ui->cbAuxMode->setCurrentIndex(qBound(int(Coordinator::MixAuxiliary),
+                                          settings.value("Auxiliary Mode", QVariant::fromValue(int(Coordinator::MixAuxiliary))).toInt(),
+                                          int(Coordinator::SeparateAuxiliary)));
+
+    ui->sbInputChannels->setValue(settings.value("Input Channels", QVariant::fromValue(2)).toInt());
+    for (const QVariant &route : settings.value("Mixdown Routing").toList())
+        m_mixdownRouting << route.toInt();
+    handleStreamFormat(StreamFormat());
+
     ui->slVolume->setValue(settings.value("Volume", QVariant::fromValue(100000000)).toInt());
+    ui->sbRecordingGain->setValue(settings.value("Recording Gain", QVariant::fromValue(0.0)).toDouble());
+
+    ui->cbLatency->setCurrentIndex(qBound(int(Coordinator::LowLatency),
+                                          settings.value("Latency Profile", QVariant::fromValue(int(Coordinator::SafeLatency))).toInt(),
+                                          int(Coordinator::SafeLatency)));
+
+    ui->cbBufferSize->addItem(tr("Automatic"), QVariant::fromValue(0));
+    for (int frames : BUFFER_SIZES)
+        ui->cbBufferSize->addItem(tr("%1 frames").arg(frames), QVariant::fromValue(frames));
+    i = ui->cbBufferSize->findData(settings.value("Frames Per Buffer", QVariant::fromValue(0)));
+    ui->cbBufferSize->setCurrentIndex(qMax(i, 0));
+
+    handleStreamLatency(0, 0);
 
     ui->eDirectory->setText(settings.value("Output Directory",
         QVariant::fromValue(QStandardPaths::writableLocation(QStandardPaths::MusicLocation))).toString());
@@ -71,13 +115,60 @@ ConfiguratorPane::ConfiguratorPane(QWidget *parent) :
         artist = tr("Someone");
     ui->eMp3Artist->setText(artist);
 
+    QStringList formats = settings.value("Recording Formats", QVariant::fromValue(QStringList("mp3-192"))).toStringList();
+    for (const EncoderType &type : encoderTypes())
+    {
+        QListWidgetItem *item = new QListWidgetItem(type.name, ui->lwFormats);
+        item->setData(Qt::UserRole, QVariant::fromValue(type.id));
+        item->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
+        item->setCheckState(formats.contains(type.id) ? Qt::Checked : Qt::Unchecked);
+    }
+
+    ui->sbSyncInterval->setValue(settings.value("Sync Interval", QVariant::fromValue(5)).toInt());
+    ui->sbPreRoll->setValue(settings.value("Pre-Roll Seconds", QVariant::fromValue(10)).toInt());
+
+    ui->cbSplitMode->setCurrentIndex(qBound(int(Coordinator::NoSplit),
+                                            settings.value("Split Mode", QVariant::fromValue(int(Coordinator::NoSplit))).toInt(),
+                                            int(Coordinator::SplitByMegabytes)));
+    ui->sbSplitSize->setValue(settings.value("Split Size", QVariant::fromValue(60)).toInt());
+    ui->cbSplitAtPause->setChecked(settings.value("Split At Pause", QVariant::fromValue(true)).toBool());
+    ui->sbSplitSize->setEnabled(ui->cbSplitMode->currentIndex() != Coordinator::NoSplit);
+    ui->cbSplitAtPause->setEnabled(ui->cbSplitMode->currentIndex() != Coordinator::NoSplit);
+
+    ui->sbSkipSilence->setValue(settings.value("Skip Silence Seconds", QVariant::fromValue(0)).toInt());
+    ui->cbSpeechMarkers->setChecked(settings.value("Speech Markers", QVariant::fromValue(false)).toBool());
+    ui->cbCallbackTimingLog->setChecked(settings.value("Log Callback Timing", QVariant::fromValue(false)).toBool());
+    ui->cbRealtime->setChecked(settings.value("Realtime Mode", QVariant::fromValue(false)).toBool());
+    handleRealtimeStatus(RealtimeStatus());
+#ifndef RECORDING_CALLBACK_TIMING
+    ui->label_22->setVisible(false);
+    ui->cbCallbackTimingLog->setVisible(false);
+#endif
+
 
 
     QObject::connect(ui->cbMonitorDev, &QComboBox::currentTextChanged, this, &ConfiguratorPane::cbMonitorDevChanged);
     QObject::connect(ui->cbRecordDev, &QComboBox::currentTextChanged, this, &ConfiguratorPane::cbRecordDevChanged);
+    QObject::connect(ui->lwAuxDevices, &QListWidget::itemChanged, this, &ConfiguratorPane::lwAuxDevicesChanged);
+    QObject::connect(ui->cbAuxMode, SELECT_SIGNAL_OVERLOAD<int>::OF(&QComboBox::currentIndexChanged), this, &ConfiguratorPane::cbAuxModeChanged);
+    QObject::connect(ui->sbInputChannels, SELECT_SIGNAL_OVERLOAD<int>::OF(&QSpinBox::valueChanged), this, &ConfiguratorPane::sbInputChannelsChanged);
+    QObject::connect(ui->twMixdown, &QTableWidget::itemChanged, this, &ConfiguratorPane::twMixdownChanged);
     QObject::connect(ui->slVolume, &QSlider::valueChanged, this, &ConfiguratorPane::slVolumeChanged);
+    QObject::connect(ui->sbRecordingGain, SELECT_SIGNAL_OVERLOAD<double>::OF(&QDoubleSpinBox::valueChanged), this, &ConfiguratorPane::sbRecordingGainChanged);
+    QObject::connect(ui->cbLatency, SELECT_SIGNAL_OVERLOAD<int>::OF(&QComboBox::currentIndexChanged), this, &ConfiguratorPane::cbLatencyChanged);
+    QObject::connect(ui->cbBufferSize, SELECT_SIGNAL_OVERLOAD<int>::OF(&QComboBox::currentIndexChanged), this, &ConfiguratorPane::cbBufferSizeChanged);
     QObject::connect(ui->bPicker, &QAbstractButton::clicked, this, &ConfiguratorPane::outputDirButtonClick);
     QObject::connect(ui->eMp3Artist, &QLineEdit::textChanged, this, &ConfiguratorPane::eMp3ArtistTextChanged);
+    QObject::connect(ui->lwFormats, &QListWidget::itemChanged, this, &ConfiguratorPane::lwFormatsChanged);
+    QObject::connect(ui->sbSyncInterval, SELECT_SIGNAL_OVERLOAD<int>::OF(&QSpinBox::valueChanged), this, &ConfiguratorPane::sbSyncIntervalChanged);
+    QObject::connect(ui->sbPreRoll, SELECT_SIGNAL_OVERLOAD<int>::OF(&QSpinBox::valueChanged), this, &ConfiguratorPane::sbPreRollChanged);
+    QObject::connect(ui->cbSplitMode, SELECT_SIGNAL_OVERLOAD<int>::OF(&QComboBox::currentIndexChanged), this, &ConfiguratorPane::splitChanged);
+    QObject::connect(ui->sbSplitSize, SELECT_SIGNAL_OVERLOAD<int>::OF(&QSpinBox::valueChanged), this, &ConfiguratorPane::splitChanged);
+    QObject::connect(ui->cbSplitAtPause, &QCheckBox::toggled, this, &ConfiguratorPane::splitChanged);
+    QObject::connect(ui->sbSkipSilence, SELECT_SIGNAL_OVERLOAD<int>::OF(&QSpinBox::valueChanged), this, &ConfiguratorPane::sbSkipSilenceChanged);
+    QObject::connect(ui->cbSpeechMarkers, &QCheckBox::toggled, this, &ConfiguratorPane::cbSpeechMarkersChanged);
+    QObject::connect(ui->cbCallbackTimingLog, &QCheckBox::toggled, this, &ConfiguratorPane::cbCallbackTimingLogChanged);
+    QObject::connect(ui->cbRealtime, &QCheckBox::toggled, this, &ConfiguratorPane::cbRealtimeChanged);
 }
 
 ConfiguratorPane::~ConfiguratorPane()
@@ -90,19 +181,134 @@ ConfiguratorPane::~ConfiguratorPane()
 void ConfiguratorPane::hookupCoordinator(Coordinator *c)
 {
     QObject::connect(this, &ConfiguratorPane::monitorDevChanged, c, &Coordinator::setMonitorDevice);
+    QObject::connect(this, &ConfiguratorPane::auxiliaryDevicesChanged, c, &Coordinator::setAuxiliaryDevices);
+    QObject::connect(this, &ConfiguratorPane::auxiliaryModeChanged, c, &Coordinator::setAuxiliaryMode);
     QObject::connect(this, &ConfiguratorPane::recordingDevChanged, c, &Coordinator::setRecordingDevice);
+    QObject::connect(this, &ConfiguratorPane::inputChannelsChanged, c, &Coordinator::setInputChannels);
+    QObject::connect(this, &ConfiguratorPane::mixdownRoutingChanged, c, &Coordinator::setMixdownRouting);
+    QObject::connect(c, &Coordinator::streamFormatChanged, this, &ConfiguratorPane::handleStreamFormat);
     QObject::connect(this, &ConfiguratorPane::volumeChanged, c, &Coordinator::setVolumeFactor);
+    QObject::connect(this, &ConfiguratorPane::recordingGainChanged, c, &Coordinator::setRecordingGain);
+    QObject::connect(this, &ConfiguratorPane::latencyProfileChanged, c, &Coordinator::setLatencyProfile);
+    QObject::connect(this, &ConfiguratorPane::framesPerBufferChanged, c, &Coordinator::setFramesPerBuffer);
+    QObject::connect(c, &Coordinator::streamLatencyChanged, this, &ConfiguratorPane::handleStreamLatency);
     QObject::connect(this, &ConfiguratorPane::outputDirChanged, c, &Coordinator::setSaveDir);
     QObject::connect(this, &ConfiguratorPane::mp3ArtistChanged, c, &Coordinator::setMp3ArtistName);
+    QObject::connect(this, &ConfiguratorPane::recordingFormatsChanged, c, &Coordinator::setRecordingFormats);
+    QObject::connect(this, &ConfiguratorPane::syncIntervalChanged, c, &Coordinator::setSyncInterval);
+    QObject::connect(this, &ConfiguratorPane::preRollSecondsChanged, c, &Coordinator::setPreRollSeconds);
+    QObject::connect(this, &ConfiguratorPane::splitModeChanged, c, &Coordinator::setSplitMode);
+    QObject::connect(this, &ConfiguratorPane::splitSizeChanged, c, &Coordinator::setSplitSize);
+    QObject::connect(this, &ConfiguratorPane::splitAtPauseChanged, c, &Coordinator::setSplitAtPause);
+    QObject::connect(this, &ConfiguratorPane::skipSilenceSecondsChanged, c, &Coordinator::setSkipSilenceSeconds);
+    QObject::connect(this, &ConfiguratorPane::speechMarkersChanged, c, &Coordinator::setSpeechMarkers);
+    QObject::connect(this, &ConfiguratorPane::callbackTimingLogChanged, c, &Coordinator::setCallbackTimingLog);
+    QObject::connect(this, &ConfiguratorPane::realtimeModeChanged, c, &Coordinator::setRealtimeMode);
+    QObject::connect(c, &Coordinator::realtimeStatusChanged, this, &ConfiguratorPane::handleRealtimeStatus);
 
-    // initial sync
+    // initial sync, latency first so that the devices are opened only once,
+    // and realtime mode before them so that the new buffers are faulted in
+    cbLatencyChanged();
+    cbBufferSizeChanged();
+    cbRealtimeChanged();
+    cbAuxModeChanged();
+    lwAuxDevicesChanged();
+    sbInputChannelsChanged();
+    twMixdownChanged();
     cbRecordDevChanged();
     cbMonitorDevChanged();
     slVolumeChanged();
+    sbRecordingGainChanged();
     eMp3ArtistTextChanged();
+    lwFormatsChanged();
+    sbSyncIntervalChanged();
+    sbPreRollChanged();
+    splitChanged();
+    sbSkipSilenceChanged();
+    cbSpeechMarkersChanged();
+    cbCallbackTimingLogChanged();
     emit outputDirChanged(ui->eDirectory->text());
 }
 
+void ConfiguratorPane::lwAuxDevicesChanged()
+{
+    QStringList names;
+    QVector<PaDeviceIndex> devices;
+    for (int i = 0; i < ui->lwAuxDevices->count(); ++i)
+    {
+        QListWidgetItem *item = ui->lwAuxDevices->item(i);
+        if (item->checkState() == Qt::Checked)
+        {
+            names << item->text();
+            devices << item->data(Qt::UserRole).value<PaDeviceIndex>();
+        }
+    }
+
+    QSettings().setValue("Auxiliary Devices", QVariant::fromValue(names));
+    emit auxiliaryDevicesChanged(devices);
+}
+
+void ConfiguratorPane::cbAuxModeChanged()
+{
+    QSettings().setValue("Auxiliary Mode", QVariant::fromValue(ui->cbAuxMode->currentIndex()));
+    emit auxiliaryModeChanged(Coordinator::AuxiliaryMode(ui->cbAuxMode->currentIndex()));
+}
+
+void ConfiguratorPane::sbInputChannelsChanged()
+{
+    QSettings().setValue("Input Channels", QVariant::fromValue(ui->sbInputChannels->value()));
+    emit inputChannelsChanged(ui->sbInputChannels->value());
+}
+
+void ConfiguratorPane::twMixdownChanged()
+{
+    const int channels = ui->twMixdown->rowCount();
+    while (m_mixdownRouting.size() < channels)
+        m_mixdownRouting << Coordinator::defaultMixdownRoute(m_mixdownRouting.size(), channels);
+
+    for (int c = 0; c < channels; ++c)
+    {
+        int route = Coordinator::MixdownOff;
+        if (ui->twMixdown->item(c, 0)->checkState() == Qt::Checked)
+            route |= Coordinator::MixdownLeft;
+        if (ui->twMixdown->item(c, 1)->checkState() == Qt::Checked)
+            route |= Coordinator::MixdownRight;
+        m_mixdownRouting[c] = route;
+    }
+
+    QVariantList routes;
+    for (int route : m_mixdownRouting)
+        routes << route;
+    QSettings().setValue("Mixdown Routing", routes);
+
+    emit mixdownRoutingChanged(m_mixdownRouting);
+}
+
+// The routing only matters with more than two channels
+void ConfiguratorPane::handleStreamFormat(const StreamFormat &format)
+{
+    const int channels = format.channels > 2 ? format.channels : 0;
+    ui->label_21->setVisible(channels > 0);
+    ui->twMixdown->setVisible(channels > 0);
+
+    QSignalBlocker blocker(ui->twMixdown);
+    ui->twMixdown->setRowCount(channels);
+
+    for (int c = 0; c < channels; ++c)
+    {
+        int route = c < m_mixdownRouting.size() ? m_mixdownRouting[c] : Coordinator::defaultMixdownRoute(c, channels);
+
+        ui->twMixdown->setVerticalHeaderItem(c, new QTableWidgetItem(tr("Channel %1").arg(c + 1)));
+        for (int side = 0; side < 2; ++side)
+        {
+            QTableWidgetItem *item = new QTableWidgetItem();
+            item->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
+            item->setCheckState(route & (side ? Coordinator::MixdownRight : Coordinator::MixdownLeft) ? Qt::Checked : Qt::Unchecked);
+            ui->twMixdown->setItem(c, side, item);
+        }
+    }
+}
+
 void ConfiguratorPane::cbRecordDevChanged()
 {
     QSettings().setValue("Recording Device", QVariant::fromValue(ui->cbRecordDev->currentText()));
@@ -122,6 +328,55 @@ void ConfiguratorPane::slVolumeChanged()
     emit volumeChanged(val);
 }
 
+void ConfiguratorPane::sbRecordingGainChanged()
+{
+    QSettings().setValue("Recording Gain", QVariant::fromValue(ui->sbRecordingGain->value()));
+    emit recordingGainChanged(float(std::pow(10.0, ui->sbRecordingGain->value() / 20.0)));
+}
+
+void ConfiguratorPane::cbLatencyChanged()
+{
+    QSettings().setValue("Latency Profile", QVariant::fromValue(ui->cbLatency->currentIndex()));
+    emit latencyProfileChanged(Coordinator::LatencyProfile(ui->cbLatency->currentIndex()));
+}
+
+void ConfiguratorPane::cbBufferSizeChanged()
+{
+    QSettings().setValue("Frames Per Buffer", ui->cbBufferSize->currentData());
+    emit framesPerBufferChanged(ui->cbBufferSize->currentData().toInt());
+}
+
+void ConfiguratorPane::handleStreamLatency(double inputLatency, double outputLatency)
+{
+    if (inputLatency <= 0 && outputLatency <= 0)
+    {
+        ui->lLatency->setText(tr("No audio stream"));
+        return;
+    }
+
+    QStringList parts;
+    if (inputLatency > 0)
+        parts << tr("Input %1 ms").arg(inputLatency * 1000, 0, 'f', 1);
+    if (outputLatency > 0)
+        parts << tr("Output %1 ms").arg(outputLatency * 1000, 0, 'f', 1);
+    if (inputLatency > 0 && outputLatency > 0)
+        parts << tr("Round trip %1 ms").arg((inputLatency + outputLatency) * 1000, 0, 'f', 1);
+
+    ui->lLatency->setText(parts.join(QStringLiteral(", ")));
+}
+
+void ConfiguratorPane::handleRealtimeStatus(const RealtimeStatus &status)
+{
+    if (!status.enabled)
+        ui->lRealtime->setText(QString());
+    else if (status.problem.isEmpty())
+        ui->lRealtime->setText(tr("Active"));
+    else if (status.priority || status.memoryLocked)
+        ui->lRealtime->setText(tr("Partly active: %1").arg(status.problem));
+    else
+        ui->lRealtime->setText(tr("Not active: %1").arg(status.problem));
+}
+
 void ConfiguratorPane::outputDirButtonClick()
 {
     QString dir = QFileDialog::getExistingDirectory(this, tr("Select Directory"), ui->eDirectory->text());
@@ -141,4 +396,70 @@ void ConfiguratorPane::eMp3ArtistTextChanged()
     emit mp3ArtistChanged(ui->eMp3Artist->text());
 }
 
+void ConfiguratorPane::lwFormatsChanged()
+{
+    QStringList ids;
+    for (int i = 0; i < ui->lwFormats->count(); ++i)
+    {
+        QListWidgetItem *item = ui->lwFormats->item(i);
+        if (item->checkState() == Qt::Checked)
+            ids << item->data(Qt::UserRole).toString();
+    }
+
+    QSettings().setValue("Recording Formats", QVariant::fromValue(ids));
+    emit recordingFormatsChanged(ids);
+}
+
+void ConfiguratorPane::sbSyncIntervalChanged()
+{
+    QSettings().setValue("Sync Interval", QVariant::fromValue(ui->sbSyncInterval->value()));
+    emit syncIntervalChanged(ui->sbSyncInterval->value() * 1000);
+}
+
+void ConfiguratorPane::sbPreRollChanged()
+{
+    QSettings().setValue("Pre-Roll Seconds", QVariant::fromValue(ui->sbPreRoll->value()));
+    emit preRollSecondsChanged(ui->sbPreRoll->value());
+}
+
+void ConfiguratorPane::splitChanged()
+{
+    auto mode = Coordinator::SplitMode(ui->cbSplitMode->currentIndex());
+    ui->sbSplitSize->setEnabled(mode != Coordinator::NoSplit);
+    ui->cbSplitAtPause->setEnabled(mode != Coordinator::NoSplit);
+
+    QSettings settings;
+    settings.setValue("Split Mode", QVariant::fromValue(int(mode)));
+    settings.setValue("Split Size", QVariant::fromValue(ui->sbSplitSize->value()));
+    settings.setValue("Split At Pause", QVariant::fromValue(ui->cbSplitAtPause->isChecked()));
+
+    emit splitModeChanged(mode);
+    emit splitSizeChanged(ui->sbSplitSize->value());
+    emit splitAtPauseChanged(ui->cbSplitAtPause->isChecked());
+}
+
+void ConfiguratorPane::sbSkipSilenceChanged()
+{
+    QSettings().setValue("Skip Silence Seconds", QVariant::fromValue(ui->sbSkipSilence->value()));
+    emit skipSilenceSecondsChanged(ui->sbSkipSilence->value());
+}
+
+void ConfiguratorPane::cbSpeechMarkersChanged()
+{
+    QSettings().setValue("Speech Markers", QVariant::fromValue(ui->cbSpeechMarkers->isChecked()));
+    emit speechMarkersChanged(ui->cbSpeechMarkers->isChecked());
+}
+
+void ConfiguratorPane::cbCallbackTimingLogChanged()
+{
+    QSettings().setValue("Log Callback Timing", QVariant::fromValue(ui->cbCallbackTimingLog->isChecked()));
+    emit callbackTimingLogChanged(ui->cbCallbackTimingLog->isChecked());
+}
+
+void ConfiguratorPane::cbRealtimeChanged()
+{
+    QSettings().setValue("Realtime Mode", QVariant::fromValue(ui->cbRealtime->isChecked()));
+    emit realtimeModeChanged(ui->cbRealtime->isChecked());
+}
+
 } // namespace Recording
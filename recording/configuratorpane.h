@@ -5,12 +5,12 @@
 
 #include <portaudio.h>
 
+#include "coordinator.h"
+
 class QSettings;
 
 namespace Recording {
 
-class Coordinator;
-
 namespace Ui {
 class RecordingConfiguratorPane;
 }
@@ -29,19 +29,59 @@ public:
 signals:
     void recordingDevChanged(PaDeviceIndex i);
     void monitorDevChanged(PaDeviceIndex i);
+    void auxiliaryDevicesChanged(const QVector<PaDeviceIndex> &devices);
+    void auxiliaryModeChanged(Recording::Coordinator::AuxiliaryMode mode);
+    void inputChannelsChanged(int channels);
+    void mixdownRoutingChanged(const QVector<int> &routes);
     void volumeChanged(float factor);
+    void recordingGainChanged(float factor);
+    void latencyProfileChanged(Recording::Coordinator::LatencyProfile profile);
+    void framesPerBufferChanged(int frames);
     void outputDirChanged(const QString &fdir);
     void mp3ArtistChanged(const QString &name);
+    void recordingFormatsChanged(const QStringList &ids);
+    void syncIntervalChanged(int msecs);
+    void preRollSecondsChanged(int seconds);
+    void splitModeChanged(Recording::Coordinator::SplitMode mode);
+    void splitSizeChanged(int size);
+    void splitAtPauseChanged(bool atPause);
+    void skipSilenceSecondsChanged(int seconds);
+    void speechMarkersChanged(bool enabled);
+    void callbackTimingLogChanged(bool enabled);
+    void realtimeModeChanged(bool enabled);
+
+public slots:
+    void handleStreamLatency(double inputLatency, double outputLatency);
+    void handleStreamFormat(const Recording::StreamFormat &format);
+    void handleRealtimeStatus(const Recording::RealtimeStatus &status);
 
 private slots:
     void cbRecordDevChanged();
     void cbMonitorDevChanged();
+    void lwAuxDevicesChanged();
+    void cbAuxModeChanged();
+    void sbInputChannelsChanged();
+    void twMixdownChanged();
     void slVolumeChanged();
+    void sbRecordingGainChanged();
+    void cbLatencyChanged();
+    void cbBufferSizeChanged();
     void outputDirButtonClick();
     void eMp3ArtistTextChanged();
+    void lwFormatsChanged();
+    void sbSyncIntervalChanged();
+    void sbPreRollChanged();
+    void splitChanged();
+    void sbSkipSilenceChanged();
+    void cbSpeechMarkersChanged();
+    void cbCallbackTimingLogChanged();
+    void cbRealtimeChanged();
 
 private:
     Ui::RecordingConfiguratorPane *ui;
+
+    // also for channels the current device doesn't have
+    QVector<int> m_mixdownRouting;
 };
 
 } // namespace Recording
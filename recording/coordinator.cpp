@@ -1,91 +1,249 @@
 #include "coordinator.h"
 
+#include "audiobackend.h"
 #include "levelcalculator.h"
-#include "lameencoderstream.h"
+#include "encoderstream.h"
+#include "encoderregistry.h"
+#include "encoderworker.h"
+#include "markerlog.h"
+#include "recordingjournal.h"
+#include "bufferedfilewriter.h"
+#include "prerollbuffer.h"
+#include "segmentedstream.h"
+#include "silencedetector.h"
+#include "audiowakeup.h"
+#include "auxiliaryinput.h"
+#include "gainkernels.h"
+
+#include "util/trace.h"
 
-#include <QTimer>
 #include <QDebug>
 #include <QDateTime>
+#include <QTextStream>
 #include <QFile>
 #include <QDir>
+#include <QFileInfo>
+#include <QThread>
 #include <QtMath>
+#include <QVector>
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
 namespace
 {
-    const int SAMPLE_RATE = 48000;
-    const int SAMPLE_SIZE = 2 * sizeof(float); // 2*4 bytes
+    const int RING_BUFFER_SECONDS = 5;
+
+    // how much the audio callback collects before it wakes up the drain loop
+    const int WAKEUP_MSECS = 10;
+    const int ENCODER_QUEUE_SECONDS = 10;
+
+    // how often a stopping recording looks whether the encoders have room for the rest
+    const unsigned long BACKLOG_DRAIN_MSECS = 10;
+    const int MAX_PRE_ROLL_SECONDS = 60;
+
+    // how long a due split may wait for a pause
+    const int SPLIT_PAUSE_GRACE_SECONDS = 120;
+
+    // Skipped silence is held for this long before it is given up. The pre-roll buffer
+    // has some room on top, for the drained spans that overshoot.
+    const int MAX_SKIP_SILENCE_SECONDS = 30;
+    const int SILENCE_HOLD_SLACK_SECONDS = 2;
+
+    // Kept before speech that follows skipped silence, covers the detector's onset delay
+    const double SPEECH_LEAD_IN_SECONDS = 0.5;
+
+    // Pause before speech that deserves a marker
+    const int SPEECH_MARKER_SILENCE_SECONDS = 2;
+
+    // Tried in this order if the device's own default rate doesn't work out
+    const double PREFERRED_SAMPLE_RATES[] = { 48000, 44100, 96000 };
+
+    // The stereo mixdown is computed in pieces of this size
+    const qint64 MIXDOWN_CHUNK_FRAMES = 4096;
+
+    const int CALLBACK_TIMING_INTERVAL_MSECS = 1000;
+
+    // Low on the realtime scale: the drain loop only has to keep up with the
+    // ring buffer, the threads serving the hardware should still come first
+    const int DRAIN_LOOP_PRIORITY = 10;
+
+    // A backlog of more than this part of a second is worked off at normal priority
+    const int CATCH_UP_FRACTION = 4;
+
+    using Recording::Coordinator;
+
+    // Balanced sits halfway between what the host API considers low and high latency
+    double suggestedLatency(double low, double high, Coordinator::LatencyProfile profile)
+    {
+        switch (profile)
+        {
+        case Coordinator::LowLatency:      return low;
+        case Coordinator::BalancedLatency: return (low + high) / 2;
+        case Coordinator::SafeLatency:     return high;
+        }
+
+        return high;
+    }
 
-    PaStreamParameters ourInputParams(PaDeviceIndex index, const PaDeviceInfo *info)
+    // As many channels as the device has, up to maxChannels (0 for our own limit)
+    PaStreamParameters ourInputParams(PaDeviceIndex index, const PaDeviceInfo *info,
+                                      Coordinator::LatencyProfile profile = Coordinator::SafeLatency,
+                                      int maxChannels = 2)
     {
         PaStreamParameters p = {};
 
         if (index != paNoDevice)
         {
+            if (maxChannels <= 0 || maxChannels > Recording::StreamFormat::MAX_CHANNELS)
+                maxChannels = Recording::StreamFormat::MAX_CHANNELS;
+
             p.device = index;
-            p.channelCount = 2;
+            p.channelCount = qMin(info->maxInputChannels, maxChannels);
             p.sampleFormat = paFloat32;
-            p.suggestedLatency = info->defaultHighInputLatency;
+            p.suggestedLatency = suggestedLatency(info->defaultLowInputLatency, info->defaultHighInputLatency, profile);
         }
 
         return p;
     }
 
-    PaStreamParameters ourOutputParams(PaDeviceIndex index, const PaDeviceInfo *info)
+    PaStreamParameters ourOutputParams(PaDeviceIndex index, const PaDeviceInfo *info,
+                                       Coordinator::LatencyProfile profile = Coordinator::SafeLatency)
     {
         PaStreamParameters p = {};
 
         if (index != paNoDevice)
         {
             p.device = index;
-            p.channelCount = 2;
+            p.channelCount = qMin(info->maxOutputChannels, 2);
             p.sampleFormat = paFloat32;
-            p.suggestedLatency = info->defaultHighOutputLatency;
+            p.suggestedLatency = suggestedLatency(info->defaultLowOutputLatency, info->defaultHighOutputLatency, profile);
         }
 
         return p;
     }
+
+    QVector<double> candidateSampleRates(const PaDeviceInfo *info)
+    {
+        QVector<double> rates;
+        if (info)
+            rates << info->defaultSampleRate;
+
+        for (double rate : PREFERRED_SAMPLE_RATES)
+            if (!rates.contains(rate))
+                rates << rate;
+
+        return rates;
+    }
+
+    // Finds a sample rate both devices can run at, preferring the one the input
+    // device runs at natively, so that nobody has to resample behind our back.
+    // If the device claims more channels than it can deliver, stereo has to do.
+    bool negotiateFormat(const Recording::AudioBackend &backend, PaDeviceIndex inputDev, PaDeviceIndex outputDev,
+                         int maxChannels, Recording::StreamFormat *format)
+    {
+        const PaDeviceInfo *inInfo = inputDev != paNoDevice ? backend.deviceInfo(inputDev) : nullptr;
+        const PaDeviceInfo *outInfo = outputDev != paNoDevice ? backend.deviceInfo(outputDev) : nullptr;
+
+        PaStreamParameters outp = ourOutputParams(outputDev, outInfo);
+
+        for (int channels : { maxChannels, 2 })
+        {
+            PaStreamParameters inp = ourInputParams(inputDev, inInfo, Coordinator::SafeLatency, channels);
+
+            for (double rate : candidateSampleRates(inInfo ? inInfo : outInfo))
+            {
+                if (paNoError == backend.isFormatSupported(inInfo ? &inp : nullptr, outInfo ? &outp : nullptr, rate))
+                {
+                    format->sampleRate = int(rate);
+                    format->channels = inInfo ? inp.channelCount : 2;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
 }
 
 namespace Recording {
 
 Coordinator::Coordinator(QObject *parent) : QObject(parent)
 {
-    Pa_Initialize();
+    m_backend = std::make_unique<PortAudioBackend>();
+
+    qRegisterMetaType<Recording::DropoutStats>();
+    qRegisterMetaType<Recording::StreamFormat>();
+    qRegisterMetaType<Recording::Coordinator::LatencyProfile>();
+    qRegisterMetaType<Recording::Coordinator::SplitMode>();
+    qRegisterMetaType<Recording::Coordinator::AuxiliaryMode>();
+    qRegisterMetaType<QVector<PaDeviceIndex>>();
+    qRegisterMetaType<QVector<int>>();
+    qRegisterMetaType<Recording::CallbackTimingSnapshot>();
+    qRegisterMetaType<Recording::RealtimeStatus>();
 
     m_levelCalculator = new LevelCalculator(this);
 
     QObject::connect(m_levelCalculator, &LevelCalculator::levelUpdate, this, &Coordinator::handleLevelUpdate);
 
-    int BUFFER_SIZE = qNextPowerOfTwo(SAMPLE_RATE * 5);
-    m_ringbufferData = std::make_unique<float[]>(SAMPLE_SIZE * BUFFER_SIZE / sizeof(float));
-    PaUtil_InitializeRingBuffer(&m_ringbuffer, SAMPLE_SIZE, BUFFER_SIZE, m_ringbufferData.get());
+    m_preRoll = std::make_unique<PreRollBuffer>();
+    m_silence = std::make_unique<SilenceDetector>();
+    m_mixdownBuffer = std::make_unique<float[]>(size_t(2 * MIXDOWN_CHUNK_FRAMES));
+
+    setupBuffers();
+    updateMixdownWeights();
+    PaUtil_InitializeRingBuffer(&m_gapRecords, sizeof(GapRecord), sizeof(m_gapRecordData)/sizeof(GapRecord), m_gapRecordData);
 
-    QTimer *t = new QTimer(this);
-    t->setInterval(40);
-    QObject::connect(t, &QTimer::timeout, this, &Coordinator::processAudio);
-    t->start();
+    // No polling: the audio callback tells us when there is enough to do
+    m_wakeup = new AudioWakeup(this);
+    QObject::connect(m_wakeup, &AudioWakeup::woken, this, &Coordinator::handleWakeup);
 }
 
 Coordinator::~Coordinator()
 {
     stopAudio();
-
-    Pa_Terminate();
 }
 
 bool Coordinator::isSupportedInput(PaDeviceIndex index, const PaDeviceInfo *info)
 {
+    if (info->maxInputChannels < 1)
+        return false;
+
     auto p = ourInputParams(index, info);
-    return paNoError == Pa_IsFormatSupported(&p, nullptr, SAMPLE_RATE);
+    for (double rate : candidateSampleRates(info))
+        if (paNoError == Pa_IsFormatSupported(&p, nullptr, rate))
+            return true;
+
+    return false;
 }
 
 bool Coordinator::isSupportedOutput(PaDeviceIndex index, const PaDeviceInfo *info)
 {
+    if (info->maxOutputChannels < 1)
+        return false;
+
     auto p = ourOutputParams(index, info);
-    return paNoError == Pa_IsFormatSupported(nullptr, &p, SAMPLE_RATE);
+    for (double rate : candidateSampleRates(info))
+        if (paNoError == Pa_IsFormatSupported(nullptr, &p, rate))
+            return true;
+
+    return false;
+}
+
+void Coordinator::setBackend(std::unique_ptr<AudioBackend> backend)
+{
+    stopAudio();
+
+    m_backend = std::move(backend);
+
+    // the old indices mean nothing to the new backend
+    m_recordingDev = paNoDevice;
+    m_monitorDev = paNoDevice;
+    m_auxDevices.clear();
+    emit recordingDeviceChanged(m_recordingDev);
+    emit monitorDeviceChanged(m_monitorDev);
+    emit auxiliaryDevicesChanged(m_auxDevices);
 }
 
 void Coordinator::setRecordingDevice(const PaDeviceIndex &device)
@@ -114,6 +272,113 @@ void Coordinator::setMonitorDevice(const PaDeviceIndex &device)
     }
 }
 
+void Coordinator::setAuxiliaryDevices(const QVector<PaDeviceIndex> &devices)
+{
+    if (devices != m_auxDevices)
+    {
+        stopAudio();
+
+        m_auxDevices = devices;
+        emit auxiliaryDevicesChanged(m_auxDevices);
+
+        startAudio();
+    }
+}
+
+void Coordinator::setAuxiliaryMode(AuxiliaryMode mode)
+{
+    if (mode != m_auxMode)
+    {
+        m_auxMode = mode;
+
+        // only the separate tracks keep a pre-roll of their own, start all of them over
+        if (!isRecording())
+        {
+            m_preRoll->clear();
+            for (auto &aux : m_auxInputs)
+                aux->preRoll().clear();
+        }
+
+        emit auxiliaryModeChanged(mode);
+    }
+}
+
+void Coordinator::setInputChannels(int channels)
+{
+    channels = qBound(0, channels, StreamFormat::MAX_CHANNELS);
+
+    if (channels != m_inputChannels)
+    {
+        stopAudio();
+
+        m_inputChannels = channels;
+        emit inputChannelsChanged(m_inputChannels);
+
+        startAudio();
+    }
+}
+
+void Coordinator::setMixdownRouting(const QVector<int> &routes)
+{
+    if (routes != m_mixdownRouting)
+    {
+        // only the drain loop reads the weights, and it runs on our thread
+        m_mixdownRouting = routes;
+        updateMixdownWeights();
+
+        emit mixdownRoutingChanged(m_mixdownRouting);
+    }
+}
+
+Coordinator::MixdownRoute Coordinator::defaultMixdownRoute(int channel, int channels)
+{
+    if (channels == 1)
+        return MixdownCenter;
+
+    // the usual pairs of a multichannel interface
+    return channel % 2 ? MixdownRight : MixdownLeft;
+}
+
+// Uncorrelated sources add up in power, so each side is scaled back to about the
+// loudness of a single channel. A channel on both sides is 3 dB down on each.
+void Coordinator::updateMixdownWeights()
+{
+    const int channels = m_format.channels;
+
+    m_mixdownWeights.assign(size_t(2 * channels), 0.0f);
+    float power[2] = { 0.0f, 0.0f };
+
+    for (int c = 0; c < channels; ++c)
+    {
+        int route = c < m_mixdownRouting.size() ? m_mixdownRouting[c] : defaultMixdownRoute(c, channels);
+        float weight = route == MixdownCenter ? float(M_SQRT1_2) : 1.0f;
+
+        for (int side = 0; side < 2; ++side)
+        {
+            if (route & (side ? MixdownRight : MixdownLeft))
+            {
+                m_mixdownWeights[size_t(side * channels + c)] = weight;
+                power[side] += weight * weight;
+            }
+        }
+    }
+
+    for (int side = 0; side < 2; ++side)
+    {
+        if (power[side] > 1.0f)
+        {
+            float scale = 1.0f / std::sqrt(power[side]);
+            for (int c = 0; c < channels; ++c)
+                m_mixdownWeights[size_t(side * channels + c)] *= scale;
+        }
+    }
+
+    m_auxMixdownWeights.assign(size_t(2 * channels), 0.0f);
+    m_auxMixdownWeights[0] = 1.0f;
+    if (channels > 1)
+        m_auxMixdownWeights[size_t(channels + 1)] = 1.0f;
+}
+
 void Coordinator::setMonitorEnabled(bool enabled)
 {
     if (m_monitorEnabled.exchange(enabled) != enabled)
@@ -124,56 +389,274 @@ void Coordinator::setMonitorEnabled(bool enabled)
 
 void Coordinator::startRecording()
 {
+    // Setting up the queues and flushing the pre-roll take longer than a
+    // realtime thread may run without blocking
+    Realtime::NormalPriorityScope normalPriority;
+
     if (isRecording())
         stopRecording();
 
-    if (!m_audioStream || m_recordingDev == paNoDevice)
+    if ((!m_audioStream || m_recordingDev == paNoDevice) && !m_offline)
     {
         error(tr("You can't start recoding until your audio input works"));
         stopRecording();
         return;
     }
 
-    QString filename = QString(tr("Recording from %2.mp3"))
-            .arg(QDateTime::currentDateTime().toString(tr("yyyy-MM-dd hhmm t")));
+    // everything up to now goes into the pre-roll
+    processAudio();
+
+    std::vector<const EncoderType *> types;
+    for (const QString &id : m_recordingFormats)
+        if (const EncoderType *type = findEncoderType(id))
+            types.push_back(type);
 
-    m_mp3FileStream = new QFile(QDir::cleanPath(QString("%1/%2").arg(m_saveDir).arg(filename)));
-    if (!m_mp3FileStream->open(QIODevice::WriteOnly | QIODevice::Truncate))
+    if (types.empty())
     {
-        error(tr("MP3: Could not open file %1: %2").arg(filename, m_mp3FileStream->errorString()));
+        error(tr("Select at least one file format to record to"));
         stopRecording();
         return;
     }
 
-    QString track = tr("Recording from %1").arg(QDateTime::currentDateTime().toString(Qt::DefaultLocaleLongDate));
+    // MP3 is meant to get the mixdown, the others are expected to keep every channel
+    for (const EncoderType *type : types)
+        if (type->maxChannels > 2 && m_format.channels > type->maxChannels)
+            emit warning(tr("%1 can't store more than %2 channels, it gets the stereo mixdown")
+                         .arg(type->name).arg(type->maxChannels));
+
+    QString baseName = QString(tr("Recording from %1"))
+            .arg(QDateTime::currentDateTime().toString(tr("yyyy-MM-dd hhmm t")));
+
+    EncoderTags tags;
+    tags.artist = m_mp3ArtistName;
+    tags.title = tr("Recording from %1").arg(QDateTime::currentDateTime().toString(Qt::DefaultLocaleLongDate));
+
+    m_journal = std::make_unique<RecordingJournal>(QDir::cleanPath(QString("%1/%2.journal")
+            .arg(m_saveDir).arg(baseName)));
 
-    m_mp3Stream = new LameEncoderStream(this);
-    QObject::connect(m_mp3Stream, &LameEncoderStream::error, this, &Coordinator::error);
+    const bool separateTracks = m_auxMode == SeparateAuxiliary && !m_auxInputs.empty();
 
-    if (!m_mp3Stream->init(m_mp3ArtistName, track, 192, m_mp3FileStream))
+    // Only become a recording once every file is open. Until then the drain
+    // loop keeps feeding the pre-roll, and a failure leaves nothing behind.
+    std::vector<Output> outputs;
+
+    for (const EncoderType *type : types)
     {
-        stopRecording();
-        return;
+        // e.g. two MP3 bitrates need different file names
+        bool sharedExtension = std::count_if(types.begin(), types.end(), [type](const EncoderType *t) {
+            return t->extension == type->extension;
+        }) > 1;
+
+        QString name = sharedExtension ? QString("%1 (%2)").arg(baseName, type->id) : baseName;
+
+        // split files get numbered, %%1 becomes the part number
+        QString fileName = m_splitMode != NoSplit
+                ? QString("%1 - %2 %%1.%3").arg(name, tr("part"), type->extension)
+                : QString("%1.%2").arg(name, type->extension);
+
+        if (!addOutput(outputs, *type, fileName, tags))
+        {
+            discardOutputs(outputs);
+            stopRecording();
+            return;
+        }
+
+        // the same again for every additional input with a track of its own
+        for (size_t i = 0; separateTracks && i < m_auxInputs.size(); ++i)
+        {
+            QString auxName = QString("%1 (%2)").arg(name, tr("input %1").arg(i + 2));
+            QString auxFileName = m_splitMode != NoSplit
+                    ? QString("%1 - %2 %%1.%3").arg(auxName, tr("part"), type->extension)
+                    : QString("%1.%2").arg(auxName, type->extension);
+
+            if (!addOutput(outputs, *type, auxFileName, tags, m_auxInputs[i]->device()))
+            {
+                discardOutputs(outputs);
+                stopRecording();
+                return;
+            }
+        }
+    }
+
+    m_outputs = std::move(outputs);
+
+    // Every file gets its own encoder thread and queue, the drain loop only hands out copies.
+    // A slow or broken encoder can only lose its own audio. The pre-roll and held silence
+    // wait in the pre-roll buffer, and go into the queue as the encoder makes room.
+    QString lockError;
+    for (Output &out : m_outputs)
+    {
+        out.worker = std::make_unique<EncoderWorker>(out.stream.get(), out.channels * int(sizeof(float)),
+                                                     m_format.sampleRate * ENCODER_QUEUE_SECONDS);
+        out.worker->setSyncInterval(m_syncInterval);
+
+        QString errorString;
+        if (m_realtimeMode && !out.worker->lockQueue(&errorString) && lockError.isEmpty())
+            lockError = errorString;
+
+        out.worker->start();
+    }
+
+    if (!lockError.isEmpty())
+        emit warning(tr("Realtime mode: the encoder queues are not locked into memory (%1)").arg(lockError));
+
+    m_markerLog = std::make_unique<MarkerLog>(QDir::cleanPath(QString("%1/%2.txt")
+            .arg(m_saveDir).arg(baseName)), m_format.sampleRate);
+
+    resetDropoutStats();
+
+    m_segmentStart = 0;
+    m_splitDueSince = -1;
+    m_silence->configure(m_format.sampleRate, m_format.channels);
+
+    // With skipping, the recording only starts with the first speech. Separate tracks
+    // would have to skip in the same places, which isn't worth it.
+    if (separateTracks && m_skipSilenceSeconds)
+        emit warning(tr("Silence isn't skipped while additional inputs are recorded to separate files"));
+    m_skipSilenceFrames = separateTracks ? 0 : qint64(m_format.sampleRate) * m_skipSilenceSeconds;
+    m_silenceState = m_skipSilenceFrames ? SkippingSilence : PassingAudio;
+    m_heldFrames = 0;
+    m_backlog.clear();
+    m_backlog.reserve(16);
+
+    // The recording starts with what happened just before the button was pressed. It is
+    // recorded right where it is, the pre-roll buffer keeps it until the encoders took it.
+    // The pre-rolls of separate tracks were written and cleared together with the main one.
+    m_recordPos = qMax(m_preRoll->begin(), m_preRoll->end() - qint64(m_format.sampleRate) * m_preRollSeconds);
+    const bool preRolled = m_recordPos < m_preRoll->end();
+    while (m_recordPos < m_preRoll->end())
+    {
+        qint64 frames = m_preRoll->end() - m_recordPos;
+        const float *samples = m_preRoll->at(m_recordPos, &frames);
+
+        if (m_auxMode == SeparateAuxiliary)
+        {
+            for (size_t i = 0; i < m_auxInputs.size(); ++i)
+            {
+                const PreRollBuffer &auxPreRoll = m_auxInputs[i]->preRoll();
+                m_auxSpans[i] = auxPreRoll.at(auxPreRoll.end() - (m_preRoll->end() - m_recordPos), &frames);
+            }
+        }
+
+        recordSpan(samples, frames);
     }
+    if (preRolled)
+        m_markerLog->addMarker(m_samplesSaved, 0, tr("Start"));
+
+    m_levelCalculator->resetIntegratedLoudness();
 
     emit recordingChanged(isRecording());
 }
 
+bool Coordinator::addOutput(std::vector<Output> &outputs, const EncoderType &type, const QString &fileName,
+                            const EncoderTags &tags, PaDeviceIndex device)
+{
+    Output out;
+    out.name = type.name;
+    out.device = device;
+
+    // Whatever can't take all channels gets the mixdown. The additional inputs
+    // only have the first two channels filled, so they always do.
+    StreamFormat format = m_format;
+    const int maxChannels = device != paNoDevice ? 2 : type.maxChannels;
+    if (maxChannels && format.channels > maxChannels)
+    {
+        format.channels = 2;
+        out.mixdown = true;
+    }
+    out.channels = format.channels;
+
+    QString path = QDir::cleanPath(QString("%1/%2").arg(m_saveDir).arg(fileName));
+
+    if (m_splitMode != NoSplit)
+    {
+        // open() below creates the first two files on this thread, the later ones come on the encoder thread
+        out.segments = new SegmentedStream(type, path);
+        out.stream.reset(out.segments);
+        QObject::connect(out.segments, &SegmentedStream::segmentStarted, this, &Coordinator::handleSegmentStarted);
+    }
+    else
+    {
+        out.stream.reset(type.create());
+    }
+    QObject::connect(out.stream.get(), &EncoderStream::error, this, &Coordinator::error);
+    QObject::connect(out.stream.get(), &EncoderStream::warning, this, &Coordinator::warning);
+
+    if (!out.segments)
+    {
+        // the encoder threads never wait for the disk themselves
+        out.file = std::make_unique<BufferedFileWriter>(path);
+        if (!out.file->open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            error(tr("%1: Could not open file %2: %3").arg(type.name, fileName, out.file->errorString()));
+            return false;
+        }
+        m_journal->addFile(path);
+    }
+
+    if (!out.stream->open(tags, format, out.file.get()))
+    {
+        if (out.file)
+        {
+            out.file->close();
+            QFile::remove(path);
+        }
+        return false;
+    }
+
+    outputs.push_back(std::move(out));
+    return true;
+}
+
+// For outputs of a recording that never started: closes them and removes their files
+void Coordinator::discardOutputs(std::vector<Output> &outputs)
+{
+    for (Output &out : outputs)
+    {
+        if (out.segments)
+        {
+            out.segments->discard();
+            continue;
+        }
+
+        const QString path = out.file->fileName();
+        out.stream->close();
+        out.file->close();
+        QFile::remove(path);
+    }
+    outputs.clear();
+}
+
 void Coordinator::stopRecording()
 {
-    if (m_mp3Stream)
+    Realtime::NormalPriorityScope normalPriority;
+
+    if (isRecording())
     {
-        m_mp3Stream->close();
-        delete m_mp3Stream;
-        m_mp3Stream = nullptr;
+        // don't lose what's waiting below the wakeup threshold
+        processAudio();
+        drainBacklog();
     }
 
-    if (m_mp3FileStream)
+    for (Output &out : m_outputs)
     {
-        m_mp3FileStream->close();
-        delete m_mp3FileStream;
-        m_mp3FileStream = nullptr;
+        // will close the stream after encoding the rest of the queue
+        if (out.worker)
+            out.worker->finish();
+
+        out.stream->close();
+        if (out.file)
+            out.file->close();
     }
+    m_outputs.clear();
+
+    // everything is finished properly, nothing to recover
+    m_journal.reset();
+    m_markerLog.reset();
+
+    // the pre-roll starts over, in the size asked for meanwhile
+    m_backlog.clear();
+    configurePreRolls();
 
     m_samplesSaved = 0;
     emit recordingChanged(isRecording());
@@ -193,9 +676,126 @@ void Coordinator::setVolumeFactor(float factor)
     emit volumeFactorChanged(m_volumeFactor);
 }
 
-void Coordinator::handleLevelUpdate(float levelL, float levelR)
+void Coordinator::setRecordingGain(float factor)
+{
+    m_recordingGain.store(factor);
+    emit recordingGainChanged(m_recordingGain);
+}
+
+void Coordinator::setWakeupThreshold(int frames)
+{
+    // waking up only when the buffer is about to overflow would be pointless
+    frames = qBound(1, frames, int(m_ringbuffer.bufferSize / 4));
+
+    m_wakeupThreshold.store(frames);
+}
+
+void Coordinator::setLatencyProfile(LatencyProfile profile)
+{
+    if (profile != m_latencyProfile)
+    {
+        stopAudio();
+
+        m_latencyProfile = profile;
+        emit latencyProfileChanged(m_latencyProfile);
+
+        startAudio();
+    }
+}
+
+void Coordinator::setFramesPerBuffer(int frames)
+{
+    frames = qMax(0, frames);
+
+    if (frames != m_framesPerBuffer)
+    {
+        stopAudio();
+
+        m_framesPerBuffer = frames;
+        emit framesPerBufferChanged(m_framesPerBuffer);
+
+        startAudio();
+    }
+}
+
+void Coordinator::handleLevelUpdate(const Levels &levels)
+{
+    emit statusUpdate(levels, isRecording(), samplesRecorded());
+    publishCallbackTiming();
+
+    if (m_realtimeStatus.priority && Realtime::takeTimeLimitDemotion())
+    {
+        // the next stream start tries again
+        m_realtimeStatus.priority = false;
+        m_realtimeStatus.problem = tr("dropped back to normal priority after running too long without a break");
+        emit realtimeStatusChanged(m_realtimeStatus);
+        emit warning(tr("Realtime mode is not fully available: %1").arg(m_realtimeStatus.problem));
+    }
+    else if (m_realtimeStatus.priority && Realtime::takeRaiseFailure())
+    {
+        // the thread runs with normal priority, so applyRealtimeMode() may try again
+        m_realtimeStatus.priority = false;
+        m_realtimeStatus.problem = tr("could not get realtime priority back after a longer task");
+        emit realtimeStatusChanged(m_realtimeStatus);
+        emit warning(tr("Realtime mode is not fully available: %1").arg(m_realtimeStatus.problem));
+    }
+
+    DropoutStats stats;
+    stats.droppedFrames = qint64(m_droppedFrames.load(std::memory_order_relaxed)) - m_statsBaseline.droppedFrames;
+    stats.inputOverflows = qint64(m_inputOverflows.load(std::memory_order_relaxed)) - m_statsBaseline.inputOverflows;
+    stats.outputUnderflows = qint64(m_outputUnderflows.load(std::memory_order_relaxed)) - m_statsBaseline.outputUnderflows;
+    stats.encoderDroppedFrames = m_encoderDroppedFrames;
+    stats.ringBufferPeakFill = float(m_ringBufferPeakFill) / m_ringbuffer.bufferSize;
+
+    if (stats != m_lastStats)
+    {
+        m_lastStats = stats;
+        emit dropoutStatsChanged(stats);
+    }
+}
+
+void Coordinator::publishCallbackTiming()
+{
+#ifdef RECORDING_CALLBACK_TIMING
+    if (!m_audioStream || (m_timingPublished.isValid() && m_timingPublished.elapsed() < CALLBACK_TIMING_INTERVAL_MSECS))
+        return;
+
+    m_timingPublished.start();
+
+    CallbackTimingSnapshot timing = m_callbackTiming.snapshot();
+    emit callbackTimingUpdate(timing);
+
+    if (m_callbackTimingLog)
+        logCallbackTiming(timing);
+#endif
+}
+
+void Coordinator::logCallbackTiming(const CallbackTimingSnapshot &timing)
 {
-    emit statusUpdate(levelL, levelR, isRecording(), samplesRecorded());
+    if (!m_timingLogFile)
+    {
+        m_timingLogFile = std::make_unique<QFile>(QDir(m_saveDir).filePath(QStringLiteral("callback timing.csv")));
+        if (!m_timingLogFile->open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+        {
+            emit warning(tr("Can't write the callback timing log: %1").arg(m_timingLogFile->errorString()));
+            m_timingLogFile.reset();
+            m_callbackTimingLog = false;
+            emit callbackTimingLogChanged(false);
+            return;
+        }
+
+        if (m_timingLogFile->size() == 0)
+            m_timingLogFile->write("time,callbacks,over budget,budget us,p50 us,p99 us,p99.9 us,recent max us,max us,load %\n");
+    }
+
+    QTextStream(m_timingLogFile.get())
+            << QDateTime::currentDateTime().toString(Qt::ISODate) << ','
+            << timing.callbacks << ',' << timing.overBudget << ','
+            << timing.budgetNanos / 1000 << ','
+            << timing.p50Nanos / 1000 << ',' << timing.p99Nanos / 1000 << ',' << timing.p999Nanos / 1000 << ','
+            << timing.recentMaxNanos / 1000 << ',' << timing.maxNanos / 1000 << ','
+            << qRound(timing.load * 100) << '\n';
+    m_timingLogFile->flush();
 }
 
 void Coordinator::setSaveDir(const QString &dir)
@@ -203,7 +803,16 @@ void Coordinator::setSaveDir(const QString &dir)
     if (m_saveDir != dir)
     {
         m_saveDir = dir;
+        m_timingLogFile.reset();
         emit saveDirChanged(dir);
+
+        // Journals in there belong to recordings that were cut short by a crash
+        if (!isRecording())
+        {
+            QStringList recovered = RecordingJournal::recover(dir);
+            if (!recovered.isEmpty())
+                emit warning(tr("Finished %n recording(s) that had been interrupted", nullptr, recovered.size()));
+        }
     }
 }
 
@@ -219,70 +828,167 @@ void Coordinator::setMp3ArtistName(const QString &name)
 int Coordinator::audioCallback(const void *inputBuffer, void *outputBuffer,
                                         unsigned long framesPerBuffer,
                                         const PaStreamCallbackTimeInfo */*timeInfo*/,
-                                        PaStreamCallbackFlags /*statusFlags*/, void *userData)
+                                        PaStreamCallbackFlags statusFlags, void *userData)
 {
     Coordinator *self = static_cast<Coordinator*>(userData);
 
+#ifdef RECORDING_CALLBACK_TIMING
+    // the callback may take as long as its buffer lasts
+    CallbackTiming::Scope timing(self->m_callbackTiming, qint64(framesPerBuffer) * 1000000000 / self->m_format.sampleRate);
+#endif
+
+    if (statusFlags & paOutputUnderflow)
+        self->m_outputUnderflows.fetch_add(1, std::memory_order_relaxed);
+
     if (outputBuffer)
     {
         if (inputBuffer && self->m_monitorEnabled.load(std::memory_order_relaxed))
         {
             float factor = self->m_volumeFactor.load(std::memory_order_relaxed);
-            auto *in  = static_cast<const float*>(inputBuffer);
-            auto *out = static_cast<float*>(outputBuffer);
-            for (unsigned long i = 0; i < framesPerBuffer; ++i)
-            {
-                out[2*i + 0] = in[2*i + 0] * factor;
-                out[2*i + 1] = in[2*i + 1] * factor;
-            }
+            Kernels::applyGainRamp(static_cast<const float*>(inputBuffer), self->m_format.channels,
+                                   static_cast<float*>(outputBuffer), self->m_outputChannels,
+                                   qint64(framesPerBuffer), self->m_monitorGainApplied, factor);
+            self->m_monitorGainApplied = factor;
         }
         else
         {
-            std::memset(outputBuffer, 0, framesPerBuffer * SAMPLE_SIZE);
+            std::memset(outputBuffer, 0, framesPerBuffer * self->m_outputChannels * sizeof(float));
+
+            // fade in when the monitor is switched on again
+            self->m_monitorGainApplied = 0.0f;
         }
     }
 
     if (inputBuffer)
-    {
-        PaUtil_WriteRingBuffer(&self->m_ringbuffer, inputBuffer, framesPerBuffer);
-    }
+        self->captureInput(static_cast<const float*>(inputBuffer), qint64(framesPerBuffer), statusFlags);
 
     return paContinue;
 }
 
-void Coordinator::stopAudio()
+// Realtime-safe, only called from the audio callback or in its place by feedOffline()
+void Coordinator::captureInput(const float *input, qint64 frames, PaStreamCallbackFlags statusFlags)
 {
-    if (!m_audioStream)
-        return;
+    // A gap record has to be queued before any audio behind it becomes
+    // visible to the drain loop. As long as the ring buffer stays full,
+    // consecutive drops are merged into one record.
+    if (m_pendingGapFrames && PaUtil_GetRingBufferWriteAvailable(&m_ringbuffer))
+    {
+        GapRecord gap { m_pendingGapPosition, m_pendingGapFrames };
+        PaUtil_WriteRingBuffer(&m_gapRecords, &gap, 1);
+        m_pendingGapFrames = 0;
+    }
 
-    Pa_StopStream(m_audioStream);
-    Pa_CloseStream(m_audioStream);
-    m_audioStream = nullptr;
-}
+    if (statusFlags & paInputOverflow)
+    {
+        m_inputOverflows.fetch_add(1, std::memory_order_relaxed);
 
-void Coordinator::startAudio()
-{
-    if (m_audioStream)
-        stopAudio();
+        GapRecord gap { m_framesCaptured, 0 };
+        PaUtil_WriteRingBuffer(&m_gapRecords, &gap, 1);
+    }
+
+    // apply the recording gain while copying straight into the ring buffer
+    void *data1, *data2;
+    ring_buffer_size_t size1, size2;
+    ring_buffer_size_t written = PaUtil_GetRingBufferWriteRegions(&m_ringbuffer, ring_buffer_size_t(frames),
+                                                                  &data1, &size1, &data2, &size2);
+
+    float gain = m_recordingGain.load(std::memory_order_relaxed);
+    Kernels::applyGainRamp(input, static_cast<float*>(data1), size1,
+                           static_cast<float*>(data2), size2, m_format.channels,
+                           m_recordingGainApplied, gain);
+    m_recordingGainApplied = gain;
+
+    PaUtil_AdvanceRingBufferWriteIndex(&m_ringbuffer, written);
+    m_framesCaptured += written;
+
+    if (written < frames)
+    {
+        quint64 lost = quint64(frames - written);
+        m_droppedFrames.fetch_add(lost, std::memory_order_relaxed);
+
+        if (!m_pendingGapFrames)
+            m_pendingGapPosition = m_framesCaptured;
+        m_pendingGapFrames += lost;
+    }
+
+    // Only one wakeup is in flight at any time. The drain loop clears the
+    // flag before it starts reading, so nothing written after that is missed.
+    if (PaUtil_GetRingBufferReadAvailable(&m_ringbuffer) >= m_wakeupThreshold.load(std::memory_order_relaxed)
+        && !m_wakeupPending.exchange(true, std::memory_order_acq_rel))
+    {
+        m_wakeup->notify();
+    }
+}
+
+void Coordinator::stopAudio()
+{
+    m_offline = false;
+
+    if (!m_audioStream)
+        return;
+
+    m_auxInputs.clear();
+
+    m_backend->stopStream(m_audioStream);
+    m_backend->closeStream(m_audioStream);
+    m_audioStream = nullptr;
+
+    emit streamLatencyChanged(0, 0);
+}
+
+void Coordinator::startAudio()
+{
+    // opening devices and allocating buffers is no realtime work either
+    Realtime::NormalPriorityScope normalPriority;
+
+    stopAudio();
 
     if (m_recordingDev == paNoDevice && m_monitorDev == paNoDevice)
         return;
 
-    PaStreamParameters inp = ourInputParams(m_recordingDev, Pa_GetDeviceInfo(m_recordingDev));
-    PaStreamParameters outp = ourOutputParams(m_monitorDev, Pa_GetDeviceInfo(m_monitorDev));
+    // The stream is stopped, so we are the only ones touching the buffers right now.
+    // Take over what the previous stream left behind and start the gap accounting afresh.
+    processAudio();
+
+    StreamFormat format;
+    if (!negotiateFormat(*m_backend, m_recordingDev, m_monitorDev, m_inputChannels, &format))
+    {
+        emit error(tr("The selected devices can't agree on a sample rate"));
+        return;
+    }
+
+    setFormat(format);
 
-    PaError err = Pa_OpenStream(&m_audioStream,
-                                m_recordingDev != paNoDevice ? &inp : nullptr,
-                                m_monitorDev != paNoDevice ? &outp : nullptr,
-                                SAMPLE_RATE, paFramesPerBufferUnspecified, paNoFlag,
-                                &Coordinator::audioCallback, this);
+    const PaDeviceInfo *monitorInfo = m_monitorDev != paNoDevice ? m_backend->deviceInfo(m_monitorDev) : nullptr;
+    m_outputChannels = monitorInfo ? qMin(monitorInfo->maxOutputChannels, 2) : 2;
+
+    resetCapture();
+#ifdef RECORDING_CALLBACK_TIMING
+    m_callbackTiming.reset();
+    m_timingPublished.invalidate();
+#endif
+
+    PaStreamParameters inp = ourInputParams(m_recordingDev, m_backend->deviceInfo(m_recordingDev), m_latencyProfile, m_format.channels);
+    PaStreamParameters outp = ourOutputParams(m_monitorDev, monitorInfo, m_latencyProfile);
+
+    unsigned long framesPerBuffer = m_framesPerBuffer > 0 ? (unsigned long)m_framesPerBuffer : paFramesPerBufferUnspecified;
+
+    PaError err = m_backend->openStream(&m_audioStream,
+                                        m_recordingDev != paNoDevice ? &inp : nullptr,
+                                        m_monitorDev != paNoDevice ? &outp : nullptr,
+                                        m_format.sampleRate, framesPerBuffer, paNoFlag,
+                                        &Coordinator::audioCallback, this);
     if (err != paNoError)
     {
-        emit error(Pa_GetErrorText(err));
+        m_audioStream = nullptr;
+        if (m_latencyProfile != SafeLatency || m_framesPerBuffer > 0)
+            emit error(tr("%1 (try a safer latency setting)").arg(Pa_GetErrorText(err)));
+        else
+            emit error(Pa_GetErrorText(err));
         return;
     }
 
-    err = Pa_StartStream(m_audioStream);
+    err = m_backend->startStream(m_audioStream);
     if (err != paNoError)
     {
         emit error(Pa_GetErrorText(err));
@@ -291,24 +997,770 @@ void Coordinator::startAudio()
     {
         emit error(QString());
     }
+
+    // What we asked for is only a hint, so report what we actually got
+    const PaStreamInfo *info = m_backend->streamInfo(m_audioStream);
+    if (info)
+        emit streamLatencyChanged(info->inputLatency, info->outputLatency);
+
+    startAuxiliaryInputs();
+
+    // after a drop back for running too long
+    if (m_realtimeMode && !m_realtimeStatus.priority)
+        applyRealtimeMode();
+}
+
+void Coordinator::setFormat(const StreamFormat &format)
+{
+    if (format == m_format)
+        return;
+
+    if (isRecording())
+    {
+        stopRecording();
+        emit error(tr("The new device uses a different audio format, so the recording had to be stopped."));
+    }
+
+    m_format = format;
+    setupBuffers();
+    updateMixdownWeights();
+    m_levelCalculator->setFormat(m_format);
+    emit streamFormatChanged(m_format);
+}
+
+// Only while nothing is capturing
+void Coordinator::resetCapture()
+{
+    PaUtil_FlushRingBuffer(&m_ringbuffer);
+    PaUtil_FlushRingBuffer(&m_gapRecords);
+    m_framesCaptured = 0;
+    m_framesConsumed = 0;
+    m_pendingGapFrames = 0;
+    if (!isRecording())
+        resetDropoutStats();
+}
+
+void Coordinator::startOffline(const StreamFormat &format)
+{
+    stopAudio();
+    processAudio();
+
+    StreamFormat f = format;
+    f.channels = qBound(1, f.channels, int(StreamFormat::MAX_CHANNELS));
+    setFormat(f);
+    resetCapture();
+
+    m_offline = true;
+}
+
+void Coordinator::feedOffline(const float *samples, qint64 frames)
+{
+    if (!m_offline)
+        return;
+
+    captureInput(samples, frames, 0);
+
+    // the same as when the wakeup arrives, just right away
+    handleWakeup();
+}
+
+void Coordinator::startAuxiliaryInputs()
+{
+    for (PaDeviceIndex device : m_auxDevices)
+    {
+        const PaDeviceInfo *info = device != paNoDevice ? m_backend->deviceInfo(device) : nullptr;
+        if (!info || device == m_recordingDev || info->maxInputChannels < 1)
+            continue;
+
+        auto aux = std::make_unique<AuxiliaryInput>(*m_backend, device, m_format);
+        if (!aux->start(ourInputParams(device, info, m_latencyProfile)))
+        {
+            emit error(tr("%1 can't be recorded along at %2 Hz: %3")
+                       .arg(aux->name()).arg(m_format.sampleRate).arg(aux->errorString()));
+            continue;
+        }
+
+        aux->preRoll().configure(backlogFrames(), m_format.channels);
+        m_auxInputs.push_back(std::move(aux));
+    }
+
+    if (m_auxInputs.empty())
+        return;
+
+    m_auxSpans.assign(m_auxInputs.size(), nullptr);
+    m_mixBuffer = std::make_unique<float[]>(size_t(AuxiliaryInput::MAX_PULL_FRAMES * m_format.channels));
+
+    // the pre-rolls have to line up, unless the main one holds a recording
+    if (!isRecording())
+        m_preRoll->clear();
+}
+
+void Coordinator::handleWakeup()
+{
+    m_wakeupPending.store(false, std::memory_order_release);
+
+    processAudio();
 }
 
 void Coordinator::processAudio()
 {
-    float buffer[2048];
-    qint64 nsamples = 0;
-    while ((nsamples = PaUtil_ReadRingBuffer(&m_ringbuffer, buffer, sizeof(buffer)/m_ringbuffer.elementSizeBytes)))
+    TRACE_ZONE("recording", "processAudio");
+
+    // Catching up after a stall can take a while, the metering included
+    Realtime::NormalPriorityScope catchUp(m_realtimeStatus.priority
+            && PaUtil_GetRingBufferReadAvailable(&m_ringbuffer) > m_format.sampleRate / CATCH_UP_FRACTION);
+
+    for (;;)
     {
-        // do level calculation
-        m_levelCalculator->processAudio(buffer, nsamples);
+        // Look at the ring buffer before the gap records: A gap record is always
+        // queued before the audio following it, so this way we can't overtake one.
+        ring_buffer_size_t available = PaUtil_GetRingBufferReadAvailable(&m_ringbuffer);
+        m_ringBufferPeakFill = qMax(m_ringBufferPeakFill, available);
 
-        if (m_mp3Stream)
+        qint64 limit = available;
+
+        void *gapPtr, *unused;
+        ring_buffer_size_t gapCount, unusedCount;
+        if (PaUtil_GetRingBufferReadRegions(&m_gapRecords, 1, &gapPtr, &gapCount, &unused, &unusedCount))
         {
-            m_mp3Stream->writeAudio(buffer, nsamples);
+            const GapRecord *gap = static_cast<const GapRecord*>(gapPtr);
+            if (gap->position <= m_framesConsumed)
+            {
+                processGap(qint64(gap->frames));
+                PaUtil_AdvanceRingBufferReadIndex(&m_gapRecords, 1);
+                continue;
+            }
+
+            limit = qMin<qint64>(limit, qint64(gap->position - m_framesConsumed));
+        }
+
+        // Work directly on the ring buffer memory. If the readable part wraps
+        // around the end of the buffer, it comes in two contiguous regions.
+        void *data1, *data2;
+        ring_buffer_size_t size1, size2;
+        if (!PaUtil_GetRingBufferReadRegions(&m_ringbuffer, ring_buffer_size_t(limit), &data1, &size1, &data2, &size2))
+            break;
+
+        processSpan(static_cast<const float*>(data1), size1);
+        if (size2)
+            processSpan(static_cast<const float*>(data2), size2);
+
+        // only now the callback may overwrite the memory
+        PaUtil_AdvanceRingBufferReadIndex(&m_ringbuffer, size1 + size2);
+        m_framesConsumed += quint64(size1 + size2);
+    }
+}
+
+// Takes the same stretch from every auxiliary input, in pieces they can deliver at once
+void Coordinator::processSpan(const float *samples, qint64 frames)
+{
+    if (m_auxInputs.empty())
+    {
+        processFrames(samples, frames);
+        return;
+    }
+
+    const int channels = m_format.channels;
 
-            m_samplesSaved += nsamples;
+    for (qint64 i = 0; i < frames; i += AuxiliaryInput::MAX_PULL_FRAMES)
+    {
+        const qint64 n = qMin(AuxiliaryInput::MAX_PULL_FRAMES, frames - i);
+        const float *chunk = samples + i * channels;
+
+        for (size_t k = 0; k < m_auxInputs.size(); ++k)
+        {
+            m_auxSpans[k] = m_auxInputs[k]->pull(n);
+
+            if (m_auxInputs[k]->takeDiscontinuity() && isRecording())
+                m_markerLog->addMarker(m_samplesSaved, 0, tr("%1 lost audio").arg(m_auxInputs[k]->name()));
         }
+
+        if (m_auxMode == MixAuxiliary)
+        {
+            float *mix = m_mixBuffer.get();
+            std::memcpy(mix, chunk, size_t(n * channels) * sizeof(float));
+            for (const float *aux : m_auxSpans)
+                Kernels::accumulate(aux, mix, n * channels);
+            chunk = mix;
+        }
+
+        processFrames(chunk, n);
     }
 }
 
+void Coordinator::processFrames(const float *samples, qint64 frames)
+{
+    // do level calculation
+    m_levelCalculator->processAudio(samples, frames);
+
+    if (isRecording())
+        recordSpan(samples, frames);
+    else
+    {
+        m_preRoll->write(samples, frames);
+
+        if (m_auxMode == SeparateAuxiliary)
+            for (size_t k = 0; k < m_auxInputs.size(); ++k)
+                m_auxInputs[k]->preRoll().write(m_auxSpans[k], frames);
+    }
+}
+
+// Appends a stretch of the pre-roll buffer to the recording
+void Coordinator::passToOutputs(qint64 position, qint64 frames)
+{
+    if (!frames)
+        return;
+
+    if (!m_backlog.empty() && m_backlog.back().position + m_backlog.back().frames == position)
+        m_backlog.back().frames += frames;
+    else
+        m_backlog.push_back(BacklogRange { position, frames, m_samplesSaved });
+
+    m_samplesSaved += frames;
+}
+
+// Hands every output as much of the backlog as its encoder queue takes. The samples of
+// the device just recorded, if any, are the newest frames and don't have to be in the
+// pre-roll buffer.
+void Coordinator::feedOutputs(const float *samples, qint64 frames)
+{
+    bool newlyFailed = false;
+    qint64 maxLost = 0;
+
+    for (Output &out : m_outputs)
+    {
+        const float *deviceSamples = samples;
+        if (samples && out.device != paNoDevice)
+        {
+            deviceSamples = nullptr;
+            for (size_t k = 0; k < m_auxInputs.size(); ++k)
+                if (m_auxInputs[k]->device() == out.device && m_auxMode == SeparateAuxiliary)
+                    deviceSamples = m_auxSpans[k];
+        }
+
+        maxLost = qMax(maxLost, feedOutput(out, deviceSamples, deviceSamples ? frames : 0, &newlyFailed));
+    }
+    m_encoderDroppedFrames += maxLost;
+
+    // forget what every output has
+    qint64 sent = m_samplesSaved;
+    for (const Output &out : m_outputs)
+        sent = qMin(sent, out.framesSent);
+    auto done = std::find_if(m_backlog.begin(), m_backlog.end(),
+                             [sent](const BacklogRange &r) { return r.saved + r.frames > sent; });
+    m_backlog.erase(m_backlog.begin(), done);
+
+    // Nothing is being written anymore, so stop pretending. Not right here
+    // though, since we might be in the middle of stopRecording() already.
+    bool allFailed = std::all_of(m_outputs.begin(), m_outputs.end(), [](const Output &out) { return out.failed; });
+    if (allFailed && newlyFailed)
+        QMetaObject::invokeMethod(this, "stopRecording", Qt::QueuedConnection);
+}
+
+// Returns the frames the output lost, because they were overwritten before its queue had room
+qint64 Coordinator::feedOutput(Output &out, const float *samples, qint64 frames, bool *newlyFailed)
+{
+    if (!out.worker || out.failed)
+    {
+        out.framesSent = m_samplesSaved;
+        return 0;
+    }
+
+    if (out.worker->failed())
+    {
+        // the encoder has already reported why
+        out.failed = true;
+        *newlyFailed = true;
+        out.framesSent = m_samplesSaved;
+        m_markerLog->addMarker(m_samplesSaved, 0, tr("%1 recording failed").arg(out.name));
+        return 0;
+    }
+
+    const qint64 lostAt = out.framesSent;
+    qint64 lost = 0;
+
+    // the ranges before the one it's in are done
+    size_t range = 0;
+    while (out.framesSent < m_samplesSaved)
+    {
+        while (m_backlog[range].saved + m_backlog[range].frames <= out.framesSent)
+            ++range;
+
+        const BacklogRange &r = m_backlog[range];
+        const qint64 offset = out.framesSent - r.saved;
+        qint64 n = r.frames - offset;
+
+        const float *data = backlogData(out, r.position + offset, &n, samples, frames);
+        if (!data)
+        {
+            lost += n;
+            out.framesSent += n;
+            continue;
+        }
+
+        n = qMin(n, out.worker->writeAvailable());
+        if (out.mixdown)
+            n = qMin(n, MIXDOWN_CHUNK_FRAMES);
+        if (!n)
+            break;
+
+        if (out.mixdown)
+        {
+            const float *weights = out.device == paNoDevice ? m_mixdownWeights.data() : m_auxMixdownWeights.data();
+            Kernels::mixToStereo(data, m_format.channels, m_mixdownBuffer.get(), n, weights);
+            data = m_mixdownBuffer.get();
+        }
+
+        out.worker->push(data, n);
+        out.framesQueued += n;
+        out.framesSent += n;
+    }
+
+    if (lost && !out.overflowing)
+    {
+        emit warning(tr("The %1 encoder can't keep up with the recording, audio is being lost. Is the disk too slow?").arg(out.name));
+        m_markerLog->addMarker(lostAt, 0, tr("%1 encoder overload").arg(out.name));
+    }
+    if (lost)
+        out.overflowing = true;
+    else if (out.framesSent == m_samplesSaved)
+        out.overflowing = false;
+
+    return lost;
+}
+
+// Where the output finds the frame at position of the pre-roll buffer, and how many follow
+// it in one piece. Null if it's overwritten already, frames then says how many are gone.
+const float *Coordinator::backlogData(const Output &out, qint64 position, qint64 *frames,
+                                      const float *samples, qint64 samplesFrames)
+{
+    // the samples just recorded end at m_recordPos
+    const qint64 samplesStart = m_recordPos - samplesFrames;
+    if (samples && position >= samplesStart)
+        return samples + (position - samplesStart) * m_format.channels;
+
+    // Separate tracks have a pre-roll buffer each. It's written in step with
+    // the main one, but may count its positions from a different start.
+    const PreRollBuffer *buffer = out.device == paNoDevice ? m_preRoll.get() : nullptr;
+    for (const auto &aux : m_auxInputs)
+        if (aux->device() == out.device)
+            buffer = &aux->preRoll();
+
+    const qint64 shift = buffer ? buffer->end() - m_preRoll->end() : 0;
+    const qint64 begin = buffer ? buffer->begin() - shift : m_recordPos;
+
+    if (position < begin)
+    {
+        *frames = qMin(*frames, (samples ? qMin(begin, samplesStart) : begin) - position);
+        return nullptr;
+    }
+
+    return buffer->at(position + shift, frames);
+}
+
+// Before the encoders finish, they get everything that is still waiting for room in their queues
+void Coordinator::drainBacklog()
+{
+    for (;;)
+    {
+        feedOutputs();
+
+        bool waiting = false;
+        for (const Output &out : m_outputs)
+            if (out.framesSent < m_samplesSaved)
+                waiting = true;
+        if (!waiting)
+            break;
+
+        QThread::msleep(BACKLOG_DRAIN_MSECS);
+    }
+}
+
+// Everything that goes into the recording passes here, including the pre-roll
+void Coordinator::recordSpan(const float *samples, qint64 frames)
+{
+    if (!frames)
+        return;
+
+    const bool wasSpeech = m_silence->isSpeech();
+    const qint64 silenceBefore = m_silence->silentFrames();
+
+    if (m_skipSilenceFrames || m_speechMarkers || (m_splitMode != NoSplit && m_splitAtPause))
+        m_silence->process(samples, frames);
+
+    writeRecorded(samples, frames);
+
+    if (m_skipSilenceFrames)
+        updateSilenceSkipping(frames);
+
+    // the speech started somewhere in this span
+    if (m_speechMarkers && !wasSpeech && m_silence->isSpeech()
+            && silenceBefore >= qint64(SPEECH_MARKER_SILENCE_SECONDS) * m_format.sampleRate)
+        m_markerLog->addMarker(qMax(qint64(0), m_samplesSaved - frames), 0, tr("Speech"));
+
+    checkSplit();
+}
+
+// Everything recorded stays in the pre-roll buffer for a while, in case an encoder
+// has no room for it yet or it's silence that might get skipped
+void Coordinator::writeRecorded(const float *samples, qint64 frames)
+{
+    // the pre-roll itself is there already
+    if (m_recordPos == m_preRoll->end())
+    {
+        m_preRoll->write(samples, frames);
+
+        if (m_auxMode == SeparateAuxiliary)
+            for (size_t k = 0; k < m_auxInputs.size(); ++k)
+                m_auxInputs[k]->preRoll().write(m_auxSpans[k], frames);
+    }
+    m_recordPos += frames;
+
+    if (m_silenceState == PassingAudio)
+    {
+        passToOutputs(m_recordPos - frames, frames);
+        feedOutputs(samples, frames);
+    }
+    else
+    {
+        m_heldFrames += frames;
+    }
+}
+
+void Coordinator::updateSilenceSkipping(qint64 frames)
+{
+    const bool speech = m_silence->isSpeech();
+
+    switch (m_silenceState)
+    {
+    case PassingAudio:
+        // the detector's hangover already went into the files
+        if (!speech)
+        {
+            m_heldFrames = 0;
+            m_silenceState = HoldingSilence;
+        }
+        break;
+
+    case HoldingSilence:
+        if (speech)
+        {
+            // just a short pause, keep all of it
+            flushSilenceHold(m_heldFrames);
+            m_silenceState = PassingAudio;
+        }
+        else if (m_heldFrames >= m_skipSilenceFrames)
+        {
+            m_silenceState = SkippingSilence;
+        }
+        break;
+
+    case SkippingSilence:
+        if (speech)
+        {
+            qint64 leadIn = qMax(frames, qint64(SPEECH_LEAD_IN_SECONDS * m_format.sampleRate));
+            qint64 skipped = m_heldFrames - qMin(leadIn, qMin(m_heldFrames, m_recordPos - m_preRoll->begin()));
+            flushSilenceHold(leadIn);
+
+            // nothing to mark before the first speech
+            if (m_samplesSaved > leadIn)
+                m_markerLog->addMarker(m_samplesSaved - leadIn, 0,
+                                       tr("Silence skipped (%1 s)").arg(skipped / m_format.sampleRate));
+
+            m_silenceState = PassingAudio;
+        }
+        break;
+    }
+}
+
+// Passes the newest held frames on to the files and forgets the rest
+void Coordinator::flushSilenceHold(qint64 frames)
+{
+    // the oldest ones may be overwritten already
+    frames = qMin(frames, qMin(m_heldFrames, m_recordPos - m_preRoll->begin()));
+
+    passToOutputs(m_recordPos - frames, frames);
+    m_heldFrames = 0;
+
+    feedOutputs();
+}
+
+// Starts new files once the current ones are long enough, preferably in a pause.
+// All outputs split at the same point of the recording, so their parts line up.
+void Coordinator::checkSplit()
+{
+    // the mode may have changed since the recording started
+    if (m_splitMode == NoSplit || m_outputs.empty() || !m_outputs.front().segments)
+        return;
+
+    for (const Output &out : m_outputs)
+        if (out.segments && out.segments->splitPending())
+            return;
+
+    if (m_splitDueSince < 0)
+    {
+        bool due = false;
+
+        if (m_splitMode == SplitByMinutes)
+        {
+            due = m_samplesSaved - m_segmentStart >= qint64(m_splitSize) * 60 * m_format.sampleRate;
+        }
+        else
+        {
+            for (const Output &out : m_outputs)
+                if (out.segments && out.segments->segmentBytes() >= qint64(m_splitSize) * 1024 * 1024)
+                    due = true;
+        }
+
+        if (!due)
+            return;
+
+        m_splitDueSince = m_samplesSaved;
+    }
+
+    if (m_splitAtPause && !m_silence->isSilent()
+            && m_samplesSaved - m_splitDueSince < qint64(SPLIT_PAUSE_GRACE_SECONDS) * m_format.sampleRate)
+        return;
+
+    // outputs that are behind split once they got here
+    for (Output &out : m_outputs)
+        if (out.segments && !out.failed)
+            out.segments->splitAt(out.framesQueued + m_samplesSaved - out.framesSent);
+
+    m_markerLog->addMarker(m_samplesSaved, 0, tr("Next file"));
+    m_segmentStart = m_samplesSaved;
+    m_splitDueSince = -1;
+}
+
+void Coordinator::handleSegmentStarted(const QString &fileName)
+{
+    if (m_journal)
+        m_journal->addFile(fileName);
+}
+
+void Coordinator::processGap(qint64 frames)
+{
+    if (!isRecording())
+        return;
+
+    if (!frames)
+    {
+        m_markerLog->addMarker(m_samplesSaved, 0, tr("Input overflow"));
+        emit warning(tr("The audio driver reported lost input. The recording might have a gap."));
+        return;
+    }
+
+    m_markerLog->addMarker(m_samplesSaved, frames, tr("Dropout (%1 ms lost)").arg(m_format.framesToMsecs(frames)));
+    emit warning(tr("The recorder couldn't keep up, %1 ms of audio were lost.").arg(m_format.framesToMsecs(frames)));
+
+    // Fill the hole with silence so that everything after it stays in sync with real time
+    static const float silence[2048] = {};
+    const qint64 silenceFrames = sizeof(silence) / m_ringbuffer.elementSizeBytes;
+    for (qint64 i = 0; i < frames; i += silenceFrames)
+    {
+        // the auxiliary inputs didn't lose anything, keep them in step
+        if (m_auxInputs.empty())
+            writeRecorded(silence, qMin(silenceFrames, frames - i));
+        else
+            processSpan(silence, qMin(silenceFrames, frames - i));
+    }
+}
+
+void Coordinator::setupBuffers()
+{
+    m_ringbufferLock.unlock();
+
+    int BUFFER_SIZE = qNextPowerOfTwo(quint32(m_format.sampleRate * RING_BUFFER_SECONDS));
+    m_ringbufferData = std::make_unique<float[]>(size_t(m_format.channels) * BUFFER_SIZE);
+    PaUtil_InitializeRingBuffer(&m_ringbuffer, m_format.frameBytes(), BUFFER_SIZE, m_ringbufferData.get());
+    setWakeupThreshold(m_format.sampleRate * WAKEUP_MSECS / 1000);
+
+    m_preRoll->configure(backlogFrames(), m_format.channels);
+
+    // No stream uses the new buffer yet, so it can be faulted in right away
+    if (m_realtimeMode)
+    {
+        Realtime::prefault(m_ringbufferData.get(), size_t(m_format.channels) * BUFFER_SIZE * sizeof(float));
+        applyRealtimeMode();
+    }
+}
+
+// The pre-roll buffer holds the silence that might be skipped as well
+qint64 Coordinator::backlogFrames() const
+{
+    int seconds = m_preRollSeconds;
+    if (m_skipSilenceSeconds)
+        seconds += m_skipSilenceSeconds + SILENCE_HOLD_SLACK_SECONDS;
+
+    return qint64(m_format.sampleRate) * seconds;
+}
+
+void Coordinator::configurePreRolls()
+{
+    m_preRoll->configure(backlogFrames(), m_format.channels);
+    for (auto &aux : m_auxInputs)
+        aux->preRoll().configure(backlogFrames(), m_format.channels);
+}
+
+void Coordinator::setRecordingFormats(const QStringList &ids)
+{
+    if (m_recordingFormats != ids)
+    {
+        m_recordingFormats = ids;
+        emit recordingFormatsChanged(ids);
+    }
+}
+
+void Coordinator::setSyncInterval(int msecs)
+{
+    msecs = qMax(0, msecs);
+
+    if (m_syncInterval != msecs)
+    {
+        m_syncInterval = msecs;
+        emit syncIntervalChanged(msecs);
+    }
+}
+
+void Coordinator::setPreRollSeconds(int seconds)
+{
+    seconds = qBound(0, seconds, MAX_PRE_ROLL_SECONDS);
+
+    if (m_preRollSeconds != seconds)
+    {
+        m_preRollSeconds = seconds;
+
+        // a running recording needs the buffer, stopRecording() catches up
+        if (!isRecording())
+            configurePreRolls();
+        emit preRollSecondsChanged(seconds);
+    }
+}
+
+void Coordinator::setSplitMode(SplitMode mode)
+{
+    if (m_splitMode != mode)
+    {
+        m_splitMode = mode;
+        emit splitModeChanged(mode);
+    }
+}
+
+void Coordinator::setSplitSize(int size)
+{
+    size = qMax(1, size);
+
+    if (m_splitSize != size)
+    {
+        m_splitSize = size;
+        emit splitSizeChanged(size);
+    }
+}
+
+void Coordinator::setSplitAtPause(bool atPause)
+{
+    if (m_splitAtPause != atPause)
+    {
+        m_splitAtPause = atPause;
+        emit splitAtPauseChanged(atPause);
+    }
+}
+
+void Coordinator::setSkipSilenceSeconds(int seconds)
+{
+    seconds = qBound(0, seconds, MAX_SKIP_SILENCE_SECONDS);
+
+    if (m_skipSilenceSeconds != seconds)
+    {
+        m_skipSilenceSeconds = seconds;
+
+        // the pre-roll buffer holds the silence as well
+        if (!isRecording())
+            configurePreRolls();
+        emit skipSilenceSecondsChanged(seconds);
+    }
+}
+
+void Coordinator::setSpeechMarkers(bool enabled)
+{
+    if (m_speechMarkers != enabled)
+    {
+        m_speechMarkers = enabled;
+        emit speechMarkersChanged(enabled);
+    }
+}
+
+void Coordinator::setCallbackTimingLog(bool enabled)
+{
+    if (m_callbackTimingLog != enabled)
+    {
+        m_callbackTimingLog = enabled;
+        m_timingLogFile.reset();
+        emit callbackTimingLogChanged(enabled);
+    }
+}
+
+void Coordinator::setRealtimeMode(bool enabled)
+{
+    if (m_realtimeMode != enabled)
+    {
+        m_realtimeMode = enabled;
+        applyRealtimeMode();
+        emit realtimeModeChanged(enabled);
+    }
+}
+
+// Only from the Coordinator's own thread, that's the one being raised
+void Coordinator::applyRealtimeMode()
+{
+    RealtimeStatus status;
+    status.enabled = m_realtimeMode;
+    QStringList problems;
+
+    if (m_realtimeMode)
+    {
+        // locking faults the pages in, before the thread is raised
+        QString errorString;
+        const size_t ringBufferBytes = size_t(m_ringbuffer.bufferSize) * size_t(m_ringbuffer.elementSizeBytes);
+        if (m_ringbufferLock.isLocked() || m_ringbufferLock.lock(m_ringbufferData.get(), ringBufferBytes, &errorString))
+            status.memoryLocked = true;
+        else
+            problems << tr("buffers not locked into memory (%1)").arg(errorString);
+
+        // The status, not the thread: inside a NormalPriorityScope the thread is lowered for a moment.
+        // Unless a scope could not raise it again, then the status is out of date.
+        if ((m_realtimeStatus.priority && !Realtime::takeRaiseFailure())
+            || Realtime::raiseCurrentThread(DRAIN_LOOP_PRIORITY, &errorString))
+            status.priority = true;
+        else
+            problems.prepend(tr("no realtime priority (%1)").arg(errorString));
+    }
+    else
+    {
+        if (m_realtimeStatus.priority)
+            Realtime::lowerCurrentThread();
+        m_ringbufferLock.unlock();
+    }
+
+    status.problem = problems.join(QStringLiteral(", "));
+
+    // warn once, not on every format change
+    const bool newProblem = !status.problem.isEmpty() && status.problem != m_realtimeStatus.problem;
+
+    m_realtimeStatus = status;
+    emit realtimeStatusChanged(status);
+
+    if (newProblem)
+        emit warning(tr("Realtime mode is not fully available: %1").arg(status.problem));
+}
+
+void Coordinator::resetDropoutStats()
+{
+    m_statsBaseline.droppedFrames = qint64(m_droppedFrames.load());
+    m_statsBaseline.inputOverflows = qint64(m_inputOverflows.load());
+    m_statsBaseline.outputUnderflows = qint64(m_outputUnderflows.load());
+    m_encoderDroppedFrames = 0;
+    m_ringBufferPeakFill = 0;
+}
+
 } // namespace Recording
@@ -1,60 +1,212 @@
 #ifndef RECORDINGCOORDINATOR_H
 #define RECORDINGCOORDINATOR_H
 
+#include <QElapsedTimer>
 #include <QObject>
+#include <QStringList>
+#include <QVector>
 
 #include <portaudio.h>
 
 #include <atomic>
 #include <memory>
+#include <vector>
 
+#include "callbacktiming.h"
 #include "external/pa_ringbuffer.h"
+#include "realtime.h"
+#include "streamformat.h"
 
 class QIODevice;
-class QTimer;
 class QFile;
 
 namespace Recording {
 
-class LameEncoderStream;
+class AudioBackend;
+class EncoderStream;
+class BufferedFileWriter;
+struct EncoderType;
+struct EncoderTags;
 class LevelCalculator;
+struct Levels;
+class EncoderWorker;
+class MarkerLog;
+class AudioWakeup;
+class AuxiliaryInput;
+class RecordingJournal;
+class PreRollBuffer;
+class SegmentedStream;
+class SilenceDetector;
+
+// Everything we know about lost audio, counted since the recording
+// (or, if not recording, the audio stream) was started
+struct DropoutStats
+{
+    qint64 droppedFrames = 0;        // capture ring buffer was full
+    qint64 encoderDroppedFrames = 0; // encoder queue was full
+    qint64 inputOverflows = 0;       // reported by the driver, unknown length
+    qint64 outputUnderflows = 0;     // monitor output only, not recorded
+    float  ringBufferPeakFill = 0;   // 0..1, highest fill level seen by the drain loop
+
+    bool operator==(const DropoutStats &o) const {
+        return droppedFrames == o.droppedFrames && encoderDroppedFrames == o.encoderDroppedFrames
+            && inputOverflows == o.inputOverflows && outputUnderflows == o.outputUnderflows
+            && ringBufferPeakFill == o.ringBufferPeakFill;
+    }
+    bool operator!=(const DropoutStats &o) const { return !(*this == o); }
+};
 
 class Coordinator : public QObject
 {
     Q_OBJECT
 public:
+    // How much buffering we ask the devices for. Low makes monitoring feel
+    // immediate, Safe survives a busy machine without dropouts.
+    enum LatencyProfile
+    {
+        LowLatency,
+        BalancedLatency,
+        SafeLatency
+    };
+    Q_ENUM(LatencyProfile)
+
+    // When a recording continues in a new file
+    enum SplitMode
+    {
+        NoSplit,
+        SplitByMinutes,
+        SplitByMegabytes
+    };
+    Q_ENUM(SplitMode)
+
+    // What happens to the audio of additional input devices
+    enum AuxiliaryMode
+    {
+        MixAuxiliary,       // into the main input's audio
+        SeparateAuxiliary   // into files of their own
+    };
+    Q_ENUM(AuxiliaryMode)
+
+    // Where an input channel goes in the stereo mixdown, a combination of flags
+    enum MixdownRoute
+    {
+        MixdownOff = 0,
+        MixdownLeft = 1,
+        MixdownRight = 2,
+        MixdownCenter = MixdownLeft | MixdownRight
+    };
+    Q_ENUM(MixdownRoute)
+
     explicit Coordinator(QObject *parent = 0);
     ~Coordinator();
 
     PaDeviceIndex recordingDevice() const { return m_recordingDev; }
     PaDeviceIndex monitorDevice() const { return m_monitorDev; }
+    QVector<PaDeviceIndex> auxiliaryDevices() const { return m_auxDevices; }
+    AuxiliaryMode auxiliaryMode() const { return m_auxMode; }
     bool monitorEnabled() const { return m_monitorEnabled; }
 
+    // Format of the running stream, also used for the recordings
+    StreamFormat streamFormat() const { return m_format; }
+
+    // 0 takes every channel the recording device has
+    int inputChannels() const { return m_inputChannels; }
+
+    // One MixdownRoute per input channel, channels without an entry get the default
+    QVector<int> mixdownRouting() const { return m_mixdownRouting; }
+    static MixdownRoute defaultMixdownRoute(int channel, int channels);
+
+    // For the PortAudio devices listed in the settings
     static bool isSupportedInput(PaDeviceIndex index, const PaDeviceInfo *info);
     static bool isSupportedOutput(PaDeviceIndex index, const PaDeviceInfo *info);
 
-    bool isRecording() const { return m_mp3Stream != nullptr; }
+    bool isRecording() const { return !m_outputs.empty(); }
+
+    // PortAudio unless replaced, e.g. by a VirtualAudioBackend for load tests.
+    // Replacing it closes all devices, they have to be set again with indices
+    // of the new backend.
+    AudioBackend &backend() const { return *m_backend; }
+    void setBackend(std::unique_ptr<AudioBackend> backend);
+
+    // Runs the pipeline without any devices, e.g. for benchmarks on a machine
+    // without a sound card. Closes the devices, until one of them is set again
+    // feedOffline() takes the place of the audio callback.
+    void startOffline(const StreamFormat &format);
+    bool isOffline() const { return m_offline; }
+
+    // One buffer of input in the offline format, drained right away. Must fit
+    // into the ring buffer (5 s), anything beyond is lost like in a dropout.
+    void feedOffline(const float *samples, qint64 frames);
     qint64 samplesRecorded() const { return m_samplesSaved; }
 
     float volumeFactor() const { return m_volumeFactor; }
+    float recordingGain() const { return m_recordingGain; }
+
+    int wakeupThreshold() const { return m_wakeupThreshold; }
+
+    LatencyProfile latencyProfile() const { return m_latencyProfile; }
+    int framesPerBuffer() const { return m_framesPerBuffer; }
 
     QString saveDir() const { return m_saveDir; }
     QString fileName() const { return m_filename; }
     QString mp3ArtistName() const { return m_mp3ArtistName; }
 
+    // Ids from the encoder registry
+    QStringList recordingFormats() const { return m_recordingFormats; }
+
+    int syncInterval() const { return m_syncInterval; }
+    int preRollSeconds() const { return m_preRollSeconds; }
+
+    SplitMode splitMode() const { return m_splitMode; }
+    int splitSize() const { return m_splitSize; }
+    bool splitAtPause() const { return m_splitAtPause; }
+
+    int skipSilenceSeconds() const { return m_skipSilenceSeconds; }
+    bool speechMarkers() const { return m_speechMarkers; }
+    bool callbackTimingLog() const { return m_callbackTimingLog; }
+    bool realtimeMode() const { return m_realtimeMode; }
+    RealtimeStatus realtimeStatus() const { return m_realtimeStatus; }
+
 signals:
     void error(const QString &message);
+    void warning(const QString &message);
 
     void recordingDeviceChanged(const PaDeviceIndex &device);
     void monitorDeviceChanged(const PaDeviceIndex &device);
+    void auxiliaryDevicesChanged(const QVector<PaDeviceIndex> &devices);
+    void auxiliaryModeChanged(Recording::Coordinator::AuxiliaryMode mode);
     void monitorEnabledChanged(bool);
+    void streamFormatChanged(const Recording::StreamFormat &format);
+    void inputChannelsChanged(int channels);
+    void mixdownRoutingChanged(const QVector<int> &routes);
+    void latencyProfileChanged(Recording::Coordinator::LatencyProfile profile);
+    void framesPerBufferChanged(int frames);
+
+    // As reported by the running stream, in seconds. Both are 0 if there is no stream.
+    void streamLatencyChanged(double inputLatency, double outputLatency);
 
     void volumeFactorChanged(float);
+    void recordingGainChanged(float);
 
     void saveDirChanged(const QString &dir);
     void mp3ArtistNameChanged(const QString &name);
-
-    void statusUpdate(float levelL, float levelR, bool isRecording, qint64 recordedSamples);
+    void recordingFormatsChanged(const QStringList &ids);
+    void syncIntervalChanged(int msecs);
+    void preRollSecondsChanged(int seconds);
+    void splitModeChanged(Recording::Coordinator::SplitMode mode);
+    void splitSizeChanged(int size);
+    void splitAtPauseChanged(bool);
+    void skipSilenceSecondsChanged(int seconds);
+    void speechMarkersChanged(bool);
+
+    void statusUpdate(const Recording::Levels &levels, bool isRecording, qint64 recordedSamples);
+    void dropoutStatsChanged(const Recording::DropoutStats &stats);
+    // About once a second while the stream runs, unless built without the timing
+    void callbackTimingUpdate(const Recording::CallbackTimingSnapshot &timing);
+    void callbackTimingLogChanged(bool);
+    void realtimeModeChanged(bool);
+    // Whenever the realtime mode is applied, problems also come as a warning
+    void realtimeStatusChanged(const Recording::RealtimeStatus &status);
     void recordingChanged(bool isRecording);
 
 public slots:
@@ -66,13 +218,68 @@ public slots:
     void stopRecording();
     void setRecording(bool record);
 
+    // Gain of the monitor output
     void setVolumeFactor(float factor);
+    // Gain applied to everything that is metered and recorded
+    void setRecordingGain(float factor);
+
+    // Number of buffered frames at which the audio callback wakes up the drain loop.
+    // Every change of the stream format sets it back to 10 ms.
+    void setWakeupThreshold(int frames);
 
-    void handleLevelUpdate(float levelL, float levelR);
+    void setLatencyProfile(Recording::Coordinator::LatencyProfile profile);
+    // 0 lets the host API choose
+    void setFramesPerBuffer(int frames);
+
+    void handleLevelUpdate(const Recording::Levels &levels);
 
     void setSaveDir(const QString &dir);
     void setMp3ArtistName(const QString &name);
 
+    // Which files the next recording writes, one per format
+    void setRecordingFormats(const QStringList &ids);
+
+    // How often the recorded files are pushed to the disk, in milliseconds.
+    // 0 leaves it to the OS. Takes effect with the next recording.
+    void setSyncInterval(int msecs);
+
+    // How much of the audio before the start of a recording goes into it
+    void setPreRollSeconds(int seconds);
+
+    // Take effect with the next recording. The size is in minutes or megabytes,
+    // depending on the mode. At a pause, the split waits a bit for a quiet moment.
+    void setSplitMode(Recording::Coordinator::SplitMode mode);
+    void setSplitSize(int size);
+    void setSplitAtPause(bool atPause);
+
+    // Pauses longer than this are cut out of the recording, and so is silence at its
+    // start and end. 0 keeps everything. Takes effect with the next recording.
+    void setSkipSilenceSeconds(int seconds);
+
+    // Adds a marker wherever speech starts after a pause
+    void setSpeechMarkers(bool enabled);
+
+    // Appends the callback timing snapshots to "callback timing.csv" in the save dir
+    void setCallbackTimingLog(bool enabled);
+
+    // Realtime priority for the thread the Coordinator lives in, which runs
+    // the drain loop, and the capture ring buffer locked into RAM. The encoder
+    // queues are locked with the next recording.
+    void setRealtimeMode(bool enabled);
+
+    // Further input devices recorded along with the recording device, kept in
+    // step with it. They have to support the same sample rate.
+    void setAuxiliaryDevices(const QVector<PaDeviceIndex> &devices);
+    void setAuxiliaryMode(Recording::Coordinator::AuxiliaryMode mode);
+
+    // How many channels of the recording device are recorded, up to
+    // StreamFormat::MAX_CHANNELS. 0 means all of them.
+    void setInputChannels(int channels);
+
+    // Formats that can't store all channels (MP3, FLAC beyond 8 channels) get a
+    // stereo mixdown instead. This says which channel goes to which side.
+    void setMixdownRouting(const QVector<int> &routes);
+
 private:
     static int audioCallback(const void *inputBuffer, void *outputBuffer,
                              unsigned long framesPerBuffer,
@@ -80,21 +287,116 @@ private:
                              PaStreamCallbackFlags statusFlags,
                              void *userData);
 
+    struct Output;
+
+    void captureInput(const float *input, qint64 frames, PaStreamCallbackFlags statusFlags);
     void stopAudio();
     void startAudio();
+    void setFormat(const StreamFormat &format);
+    void resetCapture();
+    void setupBuffers();
+    void startAuxiliaryInputs();
 
+    void handleWakeup();
     void processAudio();
+    void processSpan(const float *samples, qint64 frames);
+    void processFrames(const float *samples, qint64 frames);
+    void processGap(qint64 frames);
+    void resetDropoutStats();
+    bool addOutput(std::vector<Output> &outputs, const EncoderType &type, const QString &fileName,
+                   const EncoderTags &tags, PaDeviceIndex device = paNoDevice);
+    void discardOutputs(std::vector<Output> &outputs);
+    qint64 backlogFrames() const;
+    void configurePreRolls();
+    void passToOutputs(qint64 position, qint64 frames);
+    void feedOutputs(const float *samples = nullptr, qint64 frames = 0);
+    qint64 feedOutput(Output &out, const float *samples, qint64 frames, bool *newlyFailed);
+    const float *backlogData(const Output &out, qint64 position, qint64 *frames, const float *samples, qint64 samplesFrames);
+    void drainBacklog();
+    void updateMixdownWeights();
+    void recordSpan(const float *samples, qint64 frames);
+    void writeRecorded(const float *samples, qint64 frames);
+    void updateSilenceSkipping(qint64 frames);
+    void flushSilenceHold(qint64 frames);
+    void checkSplit();
+    void handleSegmentStarted(const QString &fileName);
+    void publishCallbackTiming();
+    void logCallbackTiming(const CallbackTimingSnapshot &timing);
+    void applyRealtimeMode();
+
+    // Position of lost audio relative to the frames that went through the ring buffer.
+    // A length of 0 means the driver reported an overflow without saying how much it lost.
+    struct GapRecord
+    {
+        quint64 position;
+        quint64 frames;
+    };
 
 private:
-    Recording::LevelCalculator *m_levelCalculator;
+    // declared first, so that it outlives every stream it opened
+    std::unique_ptr<Recording::AudioBackend> m_backend;
 
-    QIODevice *m_mp3FileStream { nullptr };
-    Recording::LameEncoderStream *m_mp3Stream { nullptr };
+    Recording::LevelCalculator *m_levelCalculator;
+    Recording::AudioWakeup *m_wakeup;
+
+    // One file being recorded, with the encoder writing it and the thread running the encoder.
+    // The members are destroyed bottom up, so the worker is gone before its stream.
+    struct Output
+    {
+        QString name;
+        std::unique_ptr<BufferedFileWriter> file;
+        std::unique_ptr<EncoderStream> stream;
+        std::unique_ptr<EncoderWorker> worker;
+        SegmentedStream *segments = nullptr;  // same as stream, if split into several files
+        PaDeviceIndex device = paNoDevice;    // auxiliary input recorded, paNoDevice for the main one
+        int channels = 2;                     // as opened
+        bool mixdown = false;                 // gets the stereo mixdown instead of all channels
+        qint64 framesQueued = 0;
+        qint64 framesSent = 0;                // in m_samplesSaved, queued or lost
+        bool overflowing = false;
+        bool failed = false;
+    };
+    std::vector<Output> m_outputs;
+    std::unique_ptr<Recording::MarkerLog> m_markerLog;
+    std::unique_ptr<Recording::RecordingJournal> m_journal;
+    std::unique_ptr<Recording::PreRollBuffer> m_preRoll;
+    std::unique_ptr<Recording::SilenceDetector> m_silence;
+
+    // What the outputs get of the pre-roll buffer, in order. Every output takes it
+    // as fast as its encoder queue allows, so they only pile up behind a slow one.
+    struct BacklogRange
+    {
+        qint64 position;    // in the pre-roll buffer
+        qint64 frames;
+        qint64 saved;       // m_samplesSaved at its start
+    };
+    std::vector<BacklogRange> m_backlog;
+    qint64 m_recordPos { 0 };   // in the pre-roll buffer, of the next recorded frame
 
     PaDeviceIndex m_recordingDev { paNoDevice };
     PaDeviceIndex m_monitorDev { paNoDevice };
 
+    QVector<PaDeviceIndex> m_auxDevices;
+    AuxiliaryMode m_auxMode { MixAuxiliary };
+    std::vector<std::unique_ptr<Recording::AuxiliaryInput>> m_auxInputs;
+    std::vector<const float *> m_auxSpans;   // their audio for the frames being processed
+    std::unique_ptr<float[]> m_mixBuffer;
+
+    // Left weights, then right weights, one per input channel. The additional
+    // inputs only ever fill the first two channels, so theirs are fixed.
+    int m_inputChannels { 2 };
+    QVector<int> m_mixdownRouting;
+    std::vector<float> m_mixdownWeights;
+    std::vector<float> m_auxMixdownWeights;
+    std::unique_ptr<float[]> m_mixdownBuffer;
+
+    // Gains are set from any thread and picked up by the next audio callback,
+    // which ramps from the gain it applied last time to avoid zipper noise
     std::atomic<float> m_volumeFactor { 1.0f };
+    std::atomic<float> m_recordingGain { 1.0f };
+
+    std::atomic<int> m_wakeupThreshold { 480 };    // set up for the rate by setupBuffers()
+    std::atomic_bool m_wakeupPending { false };
 
     std::atomic_bool m_monitorEnabled { false };
 
@@ -103,13 +405,79 @@ private:
     QString m_saveDir;
     QString m_filename;
     QString m_mp3ArtistName { "Someone" };
+    QStringList m_recordingFormats { QStringLiteral("mp3-192") };
+    int m_syncInterval { 5000 };
+    int m_preRollSeconds { 0 };
+
+    SplitMode m_splitMode { NoSplit };
+    int m_splitSize { 60 };
+    bool m_splitAtPause { true };
+    qint64 m_segmentStart { 0 };    // in m_samplesSaved
+    qint64 m_splitDueSince { -1 };  // in m_samplesSaved, -1 if no split is due
+
+    // While silent, audio stays in the pre-roll buffer instead of going to the files. If speech comes
+    // back soon enough, all of it follows, otherwise only the last moment before the speech.
+    enum SilenceState
+    {
+        PassingAudio,
+        HoldingSilence,
+        SkippingSilence
+    };
+    int m_skipSilenceSeconds { 0 };
+    bool m_speechMarkers { false };
+    qint64 m_skipSilenceFrames { 0 };  // of the current recording
+    SilenceState m_silenceState { PassingAudio };
+    qint64 m_heldFrames { 0 };     // since the silence started, including overwritten ones
 
     PaStream *m_audioStream { nullptr };
+    bool m_offline { false };
+    LatencyProfile m_latencyProfile { SafeLatency };
+    int m_framesPerBuffer { 0 };
+
+    // only changed while the stream is stopped
+    StreamFormat m_format;
+    int m_outputChannels { 2 };
 
     std::unique_ptr<float[]> m_ringbufferData;
     PaUtilRingBuffer m_ringbuffer {};
+    Realtime::MemoryLock m_ringbufferLock;  // after the data, so that it goes first
+
+    // Lost audio is accounted for with lock-free counters and a small
+    // queue of gap records, so the callback never has to wait for anyone
+    std::atomic<quint64> m_droppedFrames { 0 };
+    std::atomic<quint64> m_inputOverflows { 0 };
+    std::atomic<quint64> m_outputUnderflows { 0 };
+
+    GapRecord m_gapRecordData[64];
+    PaUtilRingBuffer m_gapRecords {};
+
+    // only touched by the audio callback
+    float m_monitorGainApplied { 0.0f };
+    float m_recordingGainApplied { 1.0f };
+    quint64 m_framesCaptured { 0 };
+    quint64 m_pendingGapPosition { 0 };
+    quint64 m_pendingGapFrames { 0 };
+
+    // only touched by the drain loop
+    quint64 m_framesConsumed { 0 };
+    qint64 m_encoderDroppedFrames { 0 };
+    ring_buffer_size_t m_ringBufferPeakFill { 0 };
+    DropoutStats m_statsBaseline;
+    DropoutStats m_lastStats;
+
+#ifdef RECORDING_CALLBACK_TIMING
+    CallbackTiming m_callbackTiming;
+#endif
+    QElapsedTimer m_timingPublished;
+    bool m_callbackTimingLog { false };
+    std::unique_ptr<QFile> m_timingLogFile;
+
+    bool m_realtimeMode { false };
+    RealtimeStatus m_realtimeStatus;
 };
 
 } // namespace Recording
 
+Q_DECLARE_METATYPE(Recording::DropoutStats)
+
 #endif // RECORDINGCOORDINATOR_H
@@ -0,0 +1,97 @@
+#include "encoderregistry.h"
+
+#include "lameencoderstream.h"
+#include "flacencoderstream.h"
+#include "wavencoderstream.h"
+
+#include <QCoreApplication>
+
+namespace Recording {
+
+namespace {
+    EncoderType mp3Type(const QString &id, const QString &name, const Mp3Profile &profile)
+    {
+        return EncoderType {
+            id,
+            name,
+            QStringLiteral("mp3"),
+            2,
+            [profile]() {
+                LameEncoderStream *s = new LameEncoderStream();
+                s->setProfile(profile);
+                return static_cast<EncoderStream*>(s);
+            }
+        };
+    }
+
+    Mp3Profile cbr(int bitrate)
+    {
+        Mp3Profile p;
+        p.mode = Mp3Profile::Cbr;
+        p.bitrate = bitrate;
+        return p;
+    }
+
+    std::vector<EncoderType> createTypes()
+    {
+        std::vector<EncoderType> types;
+
+        for (int bitrate : { 128, 192, 320 })
+            types.push_back(mp3Type(QStringLiteral("mp3-%1").arg(bitrate),
+                                    QCoreApplication::translate("Recording::EncoderRegistry", "MP3, %1 kbit/s").arg(bitrate), cbr(bitrate)));
+
+        Mp3Profile abr;
+        abr.mode = Mp3Profile::Abr;
+        abr.bitrate = 160;
+        types.push_back(mp3Type(QStringLiteral("mp3-abr-160"), QCoreApplication::translate("Recording::EncoderRegistry", "MP3, about 160 kbit/s (ABR)"), abr));
+
+        Mp3Profile vbr;
+        vbr.mode = Mp3Profile::Vbr;
+        vbr.vbrQuality = 2;
+        types.push_back(mp3Type(QStringLiteral("mp3-v2"), QCoreApplication::translate("Recording::EncoderRegistry", "MP3, variable bitrate (V2)"), vbr));
+        vbr.vbrQuality = 0;
+        types.push_back(mp3Type(QStringLiteral("mp3-v0"), QCoreApplication::translate("Recording::EncoderRegistry", "MP3, variable bitrate, best (V0)"), vbr));
+
+        // Good enough for talks, at a fraction of the size
+        Mp3Profile speech = cbr(48);
+        speech.mono = true;
+        speech.outSampleRate = 24000;
+        speech.quality = 7;
+        types.push_back(mp3Type(QStringLiteral("mp3-speech"), QCoreApplication::translate("Recording::EncoderRegistry", "MP3, speech (mono, 48 kbit/s)"), speech));
+
+        types.push_back(EncoderType {
+            QStringLiteral("flac"),
+            QCoreApplication::translate("Recording::EncoderRegistry", "FLAC (lossless)"),
+            QStringLiteral("flac"),
+            8,
+            []() { return static_cast<EncoderStream*>(new FlacEncoderStream()); }
+        });
+
+        types.push_back(EncoderType {
+            QStringLiteral("wav"),
+            QCoreApplication::translate("Recording::EncoderRegistry", "WAV/RF64 (uncompressed)"),
+            QStringLiteral("wav"),
+            0,
+            []() { return static_cast<EncoderStream*>(new WavEncoderStream()); }
+        });
+
+        return types;
+    }
+}
+
+const std::vector<EncoderType> &encoderTypes()
+{
+    static const std::vector<EncoderType> types = createTypes();
+    return types;
+}
+
+const EncoderType *findEncoderType(const QString &id)
+{
+    for (const EncoderType &type : encoderTypes())
+        if (type.id == id)
+            return &type;
+
+    return nullptr;
+}
+
+} // namespace Recording
@@ -0,0 +1,39 @@
+#ifndef RECORDING_ENCODERREGISTRY_H
+#define RECORDING_ENCODERREGISTRY_H
+
+#include <QString>
+
+#include <functional>
+#include <vector>
+
+namespace Recording {
+
+class EncoderStream;
+
+/*
+ * All the file formats we can record to. The coordinator only knows
+ * this list, so adding a format means writing an EncoderStream and
+ * adding an entry in encoderregistry.cpp.
+ */
+struct EncoderType
+{
+    QString id;        // stored in the settings, never translated
+    QString name;      // shown to the user
+    QString extension; // without the dot
+
+    // Most channels the format can take, 0 if there is no limit.
+    // Recordings with more get the stereo mixdown.
+    int maxChannels;
+
+    // A stream with the options of this entry, ready for open()
+    std::function<EncoderStream *()> create;
+};
+
+const std::vector<EncoderType> &encoderTypes();
+
+// nullptr for unknown ids, e.g. from the settings of another version
+const EncoderType *findEncoderType(const QString &id);
+
+} // namespace Recording
+
+#endif // RECORDING_ENCODERREGISTRY_H
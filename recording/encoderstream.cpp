@@ -0,0 +1,18 @@
+#include "encoderstream.h"
+
+#include "bufferedfilewriter.h"
+
+namespace Recording {
+
+bool EncoderStream::flushToDisk(QIODevice *device)
+{
+    if (BufferedFileWriter *writer = qobject_cast<BufferedFileWriter*>(device))
+        return writer->syncToDisk();
+
+    if (QFileDevice *file = qobject_cast<QFileDevice*>(device))
+        return BufferedFileWriter::syncFile(file);
+
+    return true;
+}
+
+} // namespace Recording
@@ -0,0 +1,54 @@
+#ifndef RECORDING_ENCODERSTREAM_H
+#define RECORDING_ENCODERSTREAM_H
+
+#include <QObject>
+
+#include "streamformat.h"
+
+class QIODevice;
+
+namespace Recording {
+
+// Metadata every encoder gets, as far as its file format can store it
+struct EncoderTags
+{
+    QString artist;
+    QString title;
+};
+
+/*
+ * Common interface of the encoder streams, so that an EncoderWorker can
+ * run any of them and the coordinator doesn't need to know which ones
+ * exist. The encoder specific options are set before open().
+ *
+ * writeAudio() takes interleaved float frames in the format the stream
+ * was opened with and returns a negative value on failure, after which
+ * the stream is closed. close() may be called more than once.
+ *
+ * sync() is called periodically from the same thread as writeAudio() and
+ * should leave a file behind that is usable if we crash right after.
+ */
+class EncoderStream : public QObject
+{
+    Q_OBJECT
+public:
+    explicit EncoderStream(QObject *parent = nullptr) : QObject(parent) {}
+
+    virtual bool open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output) = 0;
+    virtual qint64 writeAudio(float *samples, qint64 count) = 0;
+    virtual void close() = 0;
+    virtual bool sync() { return true; }
+
+signals:
+    void error(const QString &message);
+    // Something the user should know, but the recording goes on
+    void warning(const QString &message);
+
+protected:
+    // Pushes everything written so far to the disk, not just to the OS
+    static bool flushToDisk(QIODevice *device);
+};
+
+} // namespace Recording
+
+#endif // RECORDING_ENCODERSTREAM_H
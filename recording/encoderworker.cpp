@@ -0,0 +1,112 @@
+#include "encoderworker.h"
+
+#include "encoderstream.h"
+
+#include "util/trace.h"
+
+#include <QElapsedTimer>
+#include <QtMath>
+
+namespace Recording {
+
+EncoderWorker::EncoderWorker(EncoderStream *stream, int frameSize, int queueFrames, QObject *parent)
+    : QThread(parent), m_stream(stream)
+{
+    setObjectName(QStringLiteral("Encoder"));
+
+    int BUFFER_SIZE = qNextPowerOfTwo(quint32(queueFrames));
+    m_queueBytes = size_t(frameSize) * BUFFER_SIZE;
+    // not zeroed, untouched pages cost nothing until the audio gets there
+    m_queueData.reset(new char[m_queueBytes]);
+    PaUtil_InitializeRingBuffer(&m_queue, frameSize, BUFFER_SIZE, m_queueData.get());
+}
+
+EncoderWorker::~EncoderWorker()
+{
+    finish();
+}
+
+qint64 EncoderWorker::push(const float *samples, qint64 frames)
+{
+    qint64 written = PaUtil_WriteRingBuffer(&m_queue, samples, ring_buffer_size_t(frames));
+
+    m_wakeup.release();
+
+    return frames - written;
+}
+
+bool EncoderWorker::lockQueue(QString *errorString)
+{
+    Realtime::prefault(m_queueData.get(), m_queueBytes);
+    return m_queueLock.lock(m_queueData.get(), m_queueBytes, errorString);
+}
+
+void EncoderWorker::finish()
+{
+    if (!isRunning())
+        return;
+
+    m_finishing.store(true);
+    m_wakeup.release();
+    wait();
+}
+
+void EncoderWorker::run()
+{
+    QElapsedTimer sinceSync;
+    sinceSync.start();
+
+    while (!m_finishing.load())
+    {
+        // one wakeup is enough to get everything that has been queued so far
+        if (m_syncInterval > 0)
+            m_wakeup.tryAcquire(qMax(1, m_wakeup.available()), qMax(0, m_syncInterval - int(sinceSync.elapsed())));
+        else
+            m_wakeup.acquire(qMax(1, m_wakeup.available()));
+
+        encodeQueued();
+
+        if (m_syncInterval > 0 && sinceSync.elapsed() >= m_syncInterval)
+        {
+            TRACE_ZONE("encoder", "sync");
+
+            if (!m_failed.load() && !m_stream->sync())
+                emit m_stream->error(tr("Could not write the recording to the disk. Is it full?"));
+
+            sinceSync.restart();
+        }
+    }
+
+    // catch whatever was pushed between the last wakeup and finish()
+    encodeQueued();
+
+    if (!m_failed.load())
+        m_stream->close();
+}
+
+void EncoderWorker::encodeQueued()
+{
+    TRACE_ZONE("encoder", "encodeQueued");
+
+    void *data1, *data2;
+    ring_buffer_size_t size1, size2;
+
+    while (PaUtil_GetRingBufferReadRegions(&m_queue, PaUtil_GetRingBufferReadAvailable(&m_queue),
+                                           &data1, &size1, &data2, &size2))
+    {
+        // After a failure, keep consuming so that the drain loop doesn't see
+        // a full queue, but don't feed the stream anymore
+        if (!m_failed.load(std::memory_order_relaxed))
+        {
+            if (m_stream->writeAudio(static_cast<float*>(data1), size1) < 0
+                || (size2 && m_stream->writeAudio(static_cast<float*>(data2), size2) < 0))
+            {
+                m_failed.store(true);
+            }
+        }
+
+        PaUtil_AdvanceRingBufferReadIndex(&m_queue, size1 + size2);
+    }
+}
+
+} // namespace Recording
@@ -0,0 +1,78 @@
+#ifndef RECORDING_ENCODERWORKER_H
+#define RECORDING_ENCODERWORKER_H
+
+#include <QThread>
+#include <QSemaphore>
+
+#include <atomic>
+#include <memory>
+
+#include "external/pa_ringbuffer.h"
+#include "realtime.h"
+
+namespace Recording {
+
+class EncoderStream;
+
+/*
+ * Runs an encoder stream (and thereby all file I/O) on its own thread.
+ *
+ * The drain loop hands audio over through a bounded lock-free queue and
+ * never waits for the encoder or the disk. If the encoder falls behind
+ * for longer than the queue can hold, push() drops the excess and
+ * reports it, instead of stalling the capture ring buffer.
+ *
+ * The worker does not own the stream. Don't touch the stream between
+ * start() and finish().
+ *
+ * With a sync interval set, the stream is asked to make its file
+ * consistent and push it to the disk at least that often.
+ */
+class EncoderWorker : public QThread
+{
+    Q_OBJECT
+public:
+    explicit EncoderWorker(EncoderStream *stream, int frameSize, int queueFrames, QObject *parent = nullptr);
+    ~EncoderWorker();
+
+    // Called from the drain thread. Returns the number of frames that
+    // didn't fit into the queue and were dropped.
+    qint64 push(const float *samples, qint64 frames);
+
+    // How many frames push() would take right now, from the drain thread
+    qint64 writeAvailable() const { return PaUtil_GetRingBufferWriteAvailable(&m_queue); }
+
+    // Encodes everything still queued, then closes the stream and joins the thread
+    void finish();
+
+    bool failed() const { return m_failed.load(std::memory_order_relaxed); }
+
+    // In milliseconds, 0 disables syncing. Set before start().
+    void setSyncInterval(int msecs) { m_syncInterval = msecs; }
+
+    // Keeps the queue in RAM and faults it in now, for the realtime mode. Before start().
+    bool lockQueue(QString *errorString = nullptr);
+
+protected:
+    void run() override;
+
+private:
+    void encodeQueued();
+
+    EncoderStream *m_stream;
+
+    std::unique_ptr<char[]> m_queueData;
+    PaUtilRingBuffer m_queue {};
+    size_t m_queueBytes { 0 };
+    Realtime::MemoryLock m_queueLock;   // after the data, so that it goes first
+    QSemaphore m_wakeup;
+
+    std::atomic_bool m_finishing { false };
+    std::atomic_bool m_failed { false };
+
+    int m_syncInterval { 0 };
+};
+
+} // namespace Recording
+
+#endif // RECORDING_ENCODERWORKER_H
@@ -18,6 +18,16 @@ void FancyProgressBar::setValue(float value)
 }
 
 
+void FancyProgressBar::setPeakHold(float value)
+{
+    if (m_peakHold != value)
+    {
+        m_peakHold = value;
+
+        update();
+    }
+}
+
 QSize FancyProgressBar::sizeHint() const
 {
     return QSize(50, fontMetrics().height() + 2);
@@ -40,6 +50,15 @@ void FancyProgressBar::paintEvent(QPaintEvent *)
         painter.fillRect(0, 0, width(), height(), palette().brush(palette().currentColorGroup(), QPalette::Background));
         painter.fillRect(0, 0, boxWidth, height(), palette().brush(palette().currentColorGroup(), QPalette::Foreground));
     }
+
+    // peak hold marker, red once it went over the top
+    if (m_peakHold > 0.0f) {
+        int holdPos = qMin(width() - 2, (int)(width() * std::pow(m_peakHold, 1.0f/3.0f)));
+        if (m_peakHold >= 1.0f)
+            painter.fillRect(holdPos, 0, 2, height(), QColor(Qt::red));
+        else
+            painter.fillRect(holdPos, 0, 2, height(), palette().brush(palette().currentColorGroup(), QPalette::Foreground));
+    }
 }
 
 } // namespace Recording
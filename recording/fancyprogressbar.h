@@ -15,6 +15,7 @@ signals:
 
 public slots:
     void setValue(float value);
+    void setPeakHold(float value);
 
 
     // QWidget interface
@@ -27,6 +28,7 @@ protected:
 
 private:
     float m_value = 0.0f;
+    float m_peakHold = 0.0f;
 };
 
 } // namespace Recording
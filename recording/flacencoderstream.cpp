@@ -0,0 +1,181 @@
+#include "flacencoderstream.h"
+
+#include <FLAC/metadata.h>
+
+#include <QIODevice>
+#include <QThread>
+
+#include <cmath>
+
+namespace Recording {
+
+namespace {
+    const qint64 CONVERT_CHUNK_FRAMES = 4096;
+
+    const float FULL_SCALE_24 = 8388607.0f;
+
+    // The multithreaded encoder arrived with libFLAC 1.5
+    const unsigned MAX_ENCODER_THREADS = 4;
+
+    void addTag(FLAC__StreamMetadata *tags, const char *name, const QString &value)
+    {
+        if (!value.length())
+            return;
+
+        FLAC__StreamMetadata_VorbisComment_Entry entry;
+        if (FLAC__metadata_object_vorbiscomment_entry_from_name_value_pair(&entry, name, value.toUtf8().constData()))
+            FLAC__metadata_object_vorbiscomment_append_comment(tags, entry, false);
+    }
+}
+
+FlacEncoderStream::FlacEncoderStream(QObject *parent)
+: EncoderStream(parent), m_encoder(FLAC__stream_encoder_new())
+{}
+
+FlacEncoderStream::~FlacEncoderStream()
+{
+    close();
+    FLAC__stream_encoder_delete(m_encoder);
+
+    if (m_tags)
+        FLAC__metadata_object_delete(m_tags);
+}
+
+bool
+FlacEncoderStream::init(const QString &artist, const QString &trackName,
+                        int compressionLevel, const StreamFormat &format, QIODevice *output)
+{
+    m_format = format;
+
+    if (!m_encoder) {
+        error(tr("FLAC Error: Couldn't create the encoder"));
+        return false;
+    }
+
+    FLAC__stream_encoder_set_channels(m_encoder, unsigned(format.channels));
+    FLAC__stream_encoder_set_bits_per_sample(m_encoder, 24);
+    FLAC__stream_encoder_set_sample_rate(m_encoder, unsigned(format.sampleRate));
+    FLAC__stream_encoder_set_compression_level(m_encoder, unsigned(qBound(0, compressionLevel, 8)));
+
+#if defined(FLAC_API_VERSION_CURRENT) && FLAC_API_VERSION_CURRENT >= 14
+    // Not fatal if it doesn't work, we're just slower then
+    FLAC__stream_encoder_set_num_threads(m_encoder, qBound(1u, unsigned(QThread::idealThreadCount()), MAX_ENCODER_THREADS));
+#endif
+
+    m_tags = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
+    if (m_tags) {
+        addTag(m_tags, "ARTIST", artist);
+        addTag(m_tags, "TITLE", trackName);
+        FLAC__stream_encoder_set_metadata(m_encoder, &m_tags, 1);
+    }
+
+    m_convertBuffer = std::make_unique<FLAC__int32[]>(size_t(CONVERT_CHUNK_FRAMES * format.channels));
+
+    // set before init, the callbacks already write the header
+    m_device = output;
+
+    FLAC__StreamEncoderInitStatus status = FLAC__stream_encoder_init_stream(m_encoder,
+            &FlacEncoderStream::writeCallback, &FlacEncoderStream::seekCallback,
+            &FlacEncoderStream::tellCallback, nullptr, this);
+
+    if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        m_device = nullptr;
+        error(tr("FLAC Error: Couldn't initialize the encoder: %1").arg(FLAC__StreamEncoderInitStatusString[status]));
+        return false;
+    }
+
+    return true;
+}
+
+bool FlacEncoderStream::open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output)
+{
+    return init(tags.artist, tags.title, m_compressionLevel, format, output);
+}
+
+void FlacEncoderStream::close()
+{
+    if (!m_device)
+        return;
+
+    if (!FLAC__stream_encoder_finish(m_encoder)) {
+        error(tr("FLAC Error: %1").arg(FLAC__stream_encoder_get_resolved_state_string(m_encoder)));
+    }
+
+    m_device = nullptr;
+}
+
+bool FlacEncoderStream::sync()
+{
+    // Until close(), the stream info says the length is unknown, which
+    // decoders accept, so everything up to the last frame stays playable
+    return !m_device || flushToDisk(m_device);
+}
+
+qint64 FlacEncoderStream::writeAudio(float *buffer, qint64 numSamples)
+{
+    if (!m_device)
+        return -1;
+
+    const int channels = m_format.channels;
+
+    for (qint64 done = 0; done < numSamples; done += CONVERT_CHUNK_FRAMES)
+    {
+        qint64 frames = qMin(CONVERT_CHUNK_FRAMES, numSamples - done);
+        const float *in = buffer + done * channels;
+
+        for (qint64 i = 0; i < frames * channels; ++i)
+        {
+            float s = qBound(-1.0f, in[i], 1.0f);
+            m_convertBuffer[size_t(i)] = FLAC__int32(std::lrint(s * FULL_SCALE_24));
+        }
+
+        if (!FLAC__stream_encoder_process_interleaved(m_encoder, m_convertBuffer.get(), unsigned(frames))) {
+            error(tr("FLAC Error: %1").arg(FLAC__stream_encoder_get_resolved_state_string(m_encoder)));
+
+            close();
+            return -1;
+        }
+    }
+
+    return numSamples;
+}
+
+FLAC__StreamEncoderWriteStatus
+FlacEncoderStream::writeCallback(const FLAC__StreamEncoder *, const FLAC__byte buffer[],
+                                 size_t bytes, unsigned, unsigned, void *clientData)
+{
+    FlacEncoderStream *self = static_cast<FlacEncoderStream*>(clientData);
+
+    if (self->m_device->write((const char*)buffer, qint64(bytes)) != qint64(bytes)) {
+        self->error(tr("FLAC Error: Could not write to file: %1").arg(self->m_device->errorString()));
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+FLAC__StreamEncoderSeekStatus
+FlacEncoderStream::seekCallback(const FLAC__StreamEncoder *, FLAC__uint64 offset, void *clientData)
+{
+    FlacEncoderStream *self = static_cast<FlacEncoderStream*>(clientData);
+
+    if (self->m_device->isSequential())
+        return FLAC__STREAM_ENCODER_SEEK_STATUS_UNSUPPORTED;
+
+    return self->m_device->seek(qint64(offset)) ? FLAC__STREAM_ENCODER_SEEK_STATUS_OK
+                                                : FLAC__STREAM_ENCODER_SEEK_STATUS_ERROR;
+}
+
+FLAC__StreamEncoderTellStatus
+FlacEncoderStream::tellCallback(const FLAC__StreamEncoder *, FLAC__uint64 *offset, void *clientData)
+{
+    FlacEncoderStream *self = static_cast<FlacEncoderStream*>(clientData);
+
+    if (self->m_device->isSequential())
+        return FLAC__STREAM_ENCODER_TELL_STATUS_UNSUPPORTED;
+
+    *offset = FLAC__uint64(self->m_device->pos());
+    return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
+}
+
+} // namespace Recording
@@ -0,0 +1,60 @@
+#ifndef RECORDING_FLACENCODERSTREAM_H
+#define RECORDING_FLACENCODERSTREAM_H
+
+#include <FLAC/stream_encoder.h>
+
+#include <memory>
+
+#include "encoderstream.h"
+#include "streamformat.h"
+
+class QIODevice;
+
+namespace Recording {
+
+/*
+ * Lossless counterpart to LameEncoderStream. The float input is stored
+ * as 24 bit, which is more than any sound card really delivers.
+ *
+ * If the output device can seek, the stream info header is fixed up
+ * with the final length and checksum when the stream is closed.
+ */
+class FlacEncoderStream: public EncoderStream
+{
+    Q_OBJECT
+public:
+    explicit FlacEncoderStream(QObject *parent = nullptr);
+    ~FlacEncoderStream();
+
+    bool open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output) override;
+    void close() override;
+    bool sync() override;
+
+    // used by open()
+    void setCompressionLevel(int level) { m_compressionLevel = level; }
+
+public slots:
+    // compressionLevel goes from 0 (fastest) to 8 (smallest)
+    bool init(const QString &artist, const QString &track, int compressionLevel, const Recording::StreamFormat &format, QIODevice *output);
+
+    qint64 writeAudio(float *samples, qint64 count) override;
+
+private:
+    static FLAC__StreamEncoderWriteStatus writeCallback(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[],
+                                                        size_t bytes, unsigned samples, unsigned currentFrame, void *clientData);
+    static FLAC__StreamEncoderSeekStatus seekCallback(const FLAC__StreamEncoder *encoder, FLAC__uint64 offset, void *clientData);
+    static FLAC__StreamEncoderTellStatus tellCallback(const FLAC__StreamEncoder *encoder, FLAC__uint64 *offset, void *clientData);
+
+    FLAC__StreamEncoder   *m_encoder;
+    FLAC__StreamMetadata  *m_tags { nullptr };
+    QIODevice             *m_device { nullptr };
+    StreamFormat           m_format;
+    int                    m_compressionLevel { 5 };
+
+    // allocated in init(), so that writeAudio() doesn't have to
+    std::unique_ptr<FLAC__int32[]> m_convertBuffer;
+};
+
+} // namespace Recording
+
+#endif // RECORDING_FLACENCODERSTREAM_H
@@ -0,0 +1,213 @@
+#include "gainkernels.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define GAINKERNELS_SSE2 1
+#  include <emmintrin.h>
+#endif
+
+namespace Recording {
+namespace Kernels {
+
+namespace {
+
+void applyGain(const float *in, float *out, int64_t samples, float gain)
+{
+    int64_t i = 0;
+
+#ifdef GAINKERNELS_SSE2
+    const __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= samples; i += 4)
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+#endif
+
+    for (; i < samples; ++i)
+        out[i] = in[i] * gain;
+}
+
+// Channels == 0 means a runtime channel count, the others let the
+// compiler unroll the inner loop for the layouts we see all the time
+template <int Channels>
+void applyRampScalar(const float *in, float *out, int64_t frames, int channels, float from, float step)
+{
+    const int ch = Channels ? Channels : channels;
+
+    for (int64_t f = 0; f < frames; ++f)
+    {
+        float g = from + step * float(f + 1);
+        for (int c = 0; c < ch; ++c)
+            out[f * ch + c] = in[f * ch + c] * g;
+    }
+}
+
+#ifdef GAINKERNELS_SSE2
+// two stereo frames per register, each gain value is used for both channels of a frame
+void applyRampStereoSse2(const float *in, float *out, int64_t frames, float from, float step)
+{
+    __m128 g = _mm_setr_ps(from + step, from + step, from + 2*step, from + 2*step);
+    const __m128 inc = _mm_set1_ps(2 * step);
+
+    int64_t f = 0;
+    for (; f + 2 <= frames; f += 2)
+    {
+        _mm_storeu_ps(out + 2*f, _mm_mul_ps(_mm_loadu_ps(in + 2*f), g));
+        g = _mm_add_ps(g, inc);
+    }
+
+    // the accumulated gain drifts a tiny bit, which doesn't matter for the last frame
+    applyRampScalar<2>(in + 2*f, out + 2*f, frames - f, 2, from + step * float(f), step);
+}
+
+// four mono frames per register
+void applyRampMonoSse2(const float *in, float *out, int64_t frames, float from, float step)
+{
+    __m128 g = _mm_setr_ps(from + step, from + 2*step, from + 3*step, from + 4*step);
+    const __m128 inc = _mm_set1_ps(4 * step);
+
+    int64_t f = 0;
+    for (; f + 4 <= frames; f += 4)
+    {
+        _mm_storeu_ps(out + f, _mm_mul_ps(_mm_loadu_ps(in + f), g));
+        g = _mm_add_ps(g, inc);
+    }
+
+    applyRampScalar<1>(in + f, out + f, frames - f, 1, from + step * float(f), step);
+}
+#endif
+
+// one frame, channels from `first` on
+inline void mixFrameScalar(const float *in, int inChannels, int first, const float *weights, float &left, float &right)
+{
+    for (int c = first; c < inChannels; ++c)
+    {
+        left += in[c] * weights[c];
+        right += in[c] * weights[inChannels + c];
+    }
+}
+
+} // anonymous namespace
+
+void applyGainRamp(const float *in, float *out, int64_t frames, int channels, float from, float to)
+{
+    if (frames <= 0)
+        return;
+
+    if (from == to)
+    {
+        if (to == 1.0f)
+        {
+            if (in != out)
+                std::memcpy(out, in, size_t(frames * channels) * sizeof(float));
+        }
+        else
+        {
+            applyGain(in, out, frames * channels, to);
+        }
+        return;
+    }
+
+    float step = (to - from) / float(frames);
+
+    switch (channels)
+    {
+#ifdef GAINKERNELS_SSE2
+    case 1:
+        applyRampMonoSse2(in, out, frames, from, step);
+        break;
+    case 2:
+        applyRampStereoSse2(in, out, frames, from, step);
+        break;
+#else
+    case 1:
+        applyRampScalar<1>(in, out, frames, 1, from, step);
+        break;
+    case 2:
+        applyRampScalar<2>(in, out, frames, 2, from, step);
+        break;
+#endif
+    default:
+        applyRampScalar<0>(in, out, frames, channels, from, step);
+        break;
+    }
+}
+
+void applyGainRamp(const float *in, int inChannels, float *out, int outChannels,
+                   int64_t frames, float from, float to)
+{
+    if (inChannels == outChannels)
+    {
+        applyGainRamp(in, out, frames, inChannels, from, to);
+        return;
+    }
+
+    // Up- or downmixing for the monitor only, a plain loop is good enough here.
+    // Surplus output channels repeat the last input channel.
+    float step = frames ? (to - from) / float(frames) : 0.0f;
+    for (int64_t f = 0; f < frames; ++f)
+    {
+        float g = from + step * float(f + 1);
+        for (int c = 0; c < outChannels; ++c)
+            out[f * outChannels + c] = in[f * inChannels + std::min(c, inChannels - 1)] * g;
+    }
+}
+
+void mixToStereo(const float *in, int inChannels, float *out, int64_t frames, const float *weights)
+{
+#ifdef GAINKERNELS_SSE2
+    // Four channels per register, both sides at once. Each frame ends with
+    // the four lanes of both sums added up, which is cheap next to the
+    // multiplications once there are more than a handful of channels.
+    const int vectorChannels = inChannels & ~3;
+
+    for (int64_t f = 0; f < frames; ++f)
+    {
+        const float *frame = in + f * inChannels;
+        __m128 accL = _mm_setzero_ps();
+        __m128 accR = _mm_setzero_ps();
+
+        for (int c = 0; c < vectorChannels; c += 4)
+        {
+            __m128 v = _mm_loadu_ps(frame + c);
+            accL = _mm_add_ps(accL, _mm_mul_ps(v, _mm_loadu_ps(weights + c)));
+            accR = _mm_add_ps(accR, _mm_mul_ps(v, _mm_loadu_ps(weights + inChannels + c)));
+        }
+
+        // (L0+L2 R0+R2 L1+L3 R1+R3), then the upper half onto the lower one
+        __m128 t = _mm_add_ps(_mm_unpacklo_ps(accL, accR), _mm_unpackhi_ps(accL, accR));
+        t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+
+        alignas(16) float sums[4];
+        _mm_store_ps(sums, t);
+
+        mixFrameScalar(frame, inChannels, vectorChannels, weights, sums[0], sums[1]);
+        out[2*f + 0] = sums[0];
+        out[2*f + 1] = sums[1];
+    }
+#else
+    for (int64_t f = 0; f < frames; ++f)
+    {
+        float left = 0, right = 0;
+        mixFrameScalar(in + f * inChannels, inChannels, 0, weights, left, right);
+        out[2*f + 0] = left;
+        out[2*f + 1] = right;
+    }
+#endif
+}
+
+void accumulate(const float *in, float *out, int64_t samples)
+{
+    int64_t i = 0;
+
+#ifdef GAINKERNELS_SSE2
+    for (; i + 4 <= samples; i += 4)
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_loadu_ps(in + i)));
+#endif
+
+    for (; i < samples; ++i)
+        out[i] += in[i];
+}
+
+} // namespace Kernels
+} // namespace Recording
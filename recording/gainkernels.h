@@ -0,0 +1,49 @@
+#ifndef RECORDING_GAINKERNELS_H
+#define RECORDING_GAINKERNELS_H
+
+#include <cstdint>
+
+namespace Recording {
+namespace Kernels {
+
+/*
+ * Copies interleaved audio from in to out and applies a gain that moves
+ * linearly from `from` (exclusive) to `to` (reached at the last frame).
+ * in and out may be the same buffer.
+ *
+ * Realtime-safe: no allocations, no locks, time linear in frames.
+ */
+void applyGainRamp(const float *in, float *out, int64_t frames, int channels, float from, float to);
+
+// Same, but with a different channel layout on the output side
+void applyGainRamp(const float *in, int inChannels, float *out, int outChannels,
+                   int64_t frames, float from, float to);
+
+// Splits one ramp across two output regions, as handed out by a ring buffer
+inline void applyGainRamp(const float *in, float *out1, int64_t frames1, float *out2, int64_t frames2,
+                          int channels, float from, float to)
+{
+    int64_t frames = frames1 + frames2;
+    float mid = frames ? from + (to - from) * float(frames1) / float(frames) : to;
+
+    applyGainRamp(in, out1, frames1, channels, from, mid);
+    applyGainRamp(in + frames1 * channels, out2, frames2, channels, mid, to);
+}
+
+/*
+ * Mixes interleaved audio with any number of channels down to stereo:
+ * out[2f + s] is the sum of in[f * inChannels + c] * weights[s * inChannels + c]
+ * over all channels c, so the weights hold all left ones, then all right ones.
+ *
+ * Realtime-safe as above. in and out must not overlap.
+ */
+void mixToStereo(const float *in, int inChannels, float *out, int64_t frames, const float *weights);
+
+// out[i] += in[i] for all samples, to sum up streams of the same layout.
+// Realtime-safe as above. in and out must not overlap.
+void accumulate(const float *in, float *out, int64_t samples);
+
+} // namespace Kernels
+} // namespace Recording
+
+#endif // RECORDING_GAINKERNELS_H
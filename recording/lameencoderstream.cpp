@@ -3,25 +3,88 @@
 #include <lame/lame.h>
 
 #include <QDebug>
+#include <QIODevice>
+
+#include <algorithm>
 #include <memory>
 
+#if defined(Q_OS_WIN)
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
 namespace Recording {
 
+namespace {
+    // Seconds of audio per speed measurement
+    const int MEASURE_SECONDS = 10;
+
+    // The encoder shares the CPU with the other outputs and the GUI, so it
+    // has to be clearly faster than realtime to be safe
+    const double MIN_SPEED_FACTOR = 3.0;
+
+    const int FASTEST_QUALITY = 9;
+    const int QUALITY_STEP = 2;
+
+    // Slowest quality this computer keeps up with, found by a stream that
+    // was too slow. The encoders that come later start with it.
+    std::atomic_int qualityFloor { 0 };
+
+    // Everything MPEG-1, 2 and 2.5 layer III can store
+    bool isMp3SampleRate(int rate)
+    {
+        switch (rate) {
+        case 8000: case 11025: case 12000:
+        case 16000: case 22050: case 24000:
+        case 32000: case 44100: case 48000:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // CPU time of the calling thread, so waiting for the disk or for
+    // other threads doesn't count as encoding time
+    qint64 threadCpuNsecs()
+    {
+#if defined(Q_OS_WIN)
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+            return 0;
+        ULARGE_INTEGER k, u;
+        k.LowPart = kernel.dwLowDateTime;
+        k.HighPart = kernel.dwHighDateTime;
+        u.LowPart = user.dwLowDateTime;
+        u.HighPart = user.dwHighDateTime;
+        return qint64(k.QuadPart + u.QuadPart) * 100;
+#else
+        timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+            return 0;
+        return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+    }
+}
+
 LameEncoderStream::LameEncoderStream(QObject *parent)
-: QObject(parent), m_lame_gbf(lame_init()), m_device(nullptr)
+: EncoderStream(parent), m_lame_gbf(lame_init()), m_device(nullptr),
+  m_outBuffer(std::make_unique<unsigned char[]>(OUT_BUFFER_SIZE))
 {}
 
 bool
 LameEncoderStream::init(const QString &artist, const QString &trackName,
-                        int brate, QIODevice *output)
+                        const Mp3Profile &profile, const StreamFormat &format, QIODevice *output)
 {
     m_device = output;
+    m_format = format;
+    m_profile = profile;
+    m_quality = qBound(0, qMax(profile.quality, qualityFloor.load()), FASTEST_QUALITY);
 
-    lame_set_quality(m_lame_gbf, 5);
-    lame_set_mode(m_lame_gbf, JOINT_STEREO);
-    lame_set_brate(m_lame_gbf, brate);
-    lame_set_in_samplerate(m_lame_gbf, 48000);
-    lame_set_out_samplerate(m_lame_gbf, 48000);
+    if (format.channels > 2) {
+        error(tr("MP3/LAME Error: MP3 can't store more than two channels"));
+        return false;
+    }
 
     // ID3 tags are barely documented, but luckily we can read the lame(1) source code...
     id3tag_init(m_lame_gbf);
@@ -36,10 +99,8 @@ LameEncoderStream::init(const QString &artist, const QString &trackName,
         id3tag_set_title(m_lame_gbf, trackName_u8.constData());
     }
 
-    if (lame_init_params(m_lame_gbf) < 0) {
-        error(tr("MP3/LAME Error: Programmer mistake: Couldn't initialize lame encoder"));
+    if (!setupEncoder(m_quality))
         return false;
-    }
 
     // Write out the ID3v2 tag
     unsigned char dummybuf[1];
@@ -53,50 +114,139 @@ LameEncoderStream::init(const QString &artist, const QString &trackName,
         return false;
     }
 
+    // LAME puts a placeholder for the info frame first, which we fill in on close()
+    m_infoFrameOffset = (!output->isSequential() && lame_get_bWriteVbrTag(m_lame_gbf)) ? output->pos() : -1;
+
+    m_measuredFrames = 0;
+    m_measuredNsecs = 0;
+    m_speedFactor.store(0.0);
+
     return true;
 }
 
+bool LameEncoderStream::setupEncoder(int quality)
+{
+    const bool mono = m_format.channels == 1 || m_profile.mono;
+
+    lame_set_quality(m_lame_gbf, quality);
+    lame_set_num_channels(m_lame_gbf, m_format.channels);
+    lame_set_mode(m_lame_gbf, mono ? MONO : JOINT_STEREO);
+    lame_set_in_samplerate(m_lame_gbf, m_format.sampleRate);
+    // Interfaces running at 88.2 kHz and up need resampling, 0 lets LAME pick the rate
+    int outSampleRate = m_profile.outSampleRate > 0 ? m_profile.outSampleRate : m_format.sampleRate;
+    lame_set_out_samplerate(m_lame_gbf, isMp3SampleRate(outSampleRate) ? outSampleRate : 0);
+
+    switch (m_profile.mode) {
+    case Mp3Profile::Cbr:
+        lame_set_VBR(m_lame_gbf, vbr_off);
+        lame_set_brate(m_lame_gbf, m_profile.bitrate);
+        break;
+    case Mp3Profile::Abr:
+        lame_set_VBR(m_lame_gbf, vbr_abr);
+        lame_set_VBR_mean_bitrate_kbps(m_lame_gbf, m_profile.bitrate);
+        break;
+    case Mp3Profile::Vbr:
+        lame_set_VBR(m_lame_gbf, vbr_default);
+        lame_set_VBR_quality(m_lame_gbf, float(qBound(0, m_profile.vbrQuality, 9)));
+        break;
+    }
+
+    if (lame_init_params(m_lame_gbf) < 0) {
+        error(tr("MP3/LAME Error: Programmer mistake: Couldn't initialize lame encoder"));
+        return false;
+    }
+
+    return true;
+}
+
+bool LameEncoderStream::open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output)
+{
+    return init(tags.artist, tags.title, m_profile, format, output);
+}
+
 LameEncoderStream::~LameEncoderStream()
 {
     close();
     lame_close(m_lame_gbf);
 }
 
+// Encodes what LAME still holds back, without ending the stream
+bool LameEncoderStream::flushEncoder()
+{
+    int bytesEncoded = lame_encode_flush_nogap(m_lame_gbf, m_outBuffer.get(), OUT_BUFFER_SIZE);
+
+    if (bytesEncoded < 0) {
+        error(tr("MP3/LAME Error: Probably a programmer mistake. Hint: %1").arg(bytesEncoded));
+        return false;
+    }
+
+    auto bytesWritten = m_device->write((const char*)m_outBuffer.get(), bytesEncoded);
+    if (bytesWritten != bytesEncoded) {
+        error(tr("MP3 Error: The device didn't feel like writing all of our data. Sorry."));
+        return false;
+    }
+
+    return true;
+}
+
 void LameEncoderStream::close()
 {
     if (!m_device)
         return;
 
-    unsigned char lastBits[7200];
-
-    int bytesEncoded = lame_encode_flush_nogap(m_lame_gbf, lastBits, sizeof(lastBits));
+    if (flushEncoder() && m_infoFrameOffset >= 0) {
+        // Tells players the real length of VBR/ABR files and how to play them gaplessly
+        size_t size = lame_get_lametag_frame(m_lame_gbf, m_outBuffer.get(), OUT_BUFFER_SIZE);
+        qint64 end = m_device->pos();
 
-    if (bytesEncoded < 0) {
-        error(tr("MP3/LAME Error: Probably a programmer mistake. Hint: %1").arg(bytesEncoded));
-    } else {
-        auto bytesWritten = m_device->write((const char*)lastBits, bytesEncoded);
-        if (bytesWritten != bytesEncoded) {
-            error(tr("MP3 Error: The device didn't feel like writing all of our data. Sorry."));
+        if (size > 0 && size <= size_t(OUT_BUFFER_SIZE)
+                && (!m_device->seek(m_infoFrameOffset)
+                    || m_device->write((const char*)m_outBuffer.get(), qint64(size)) != qint64(size)
+                    || !m_device->seek(end))) {
+            error(tr("MP3 Error: Could not write the info frame: %1").arg(m_device->errorString()));
         }
     }
 
     m_device = nullptr;
 }
 
+bool LameEncoderStream::sync()
+{
+    // MP3 frames stand on their own, a truncated file just ends early
+    return !m_device || flushToDisk(m_device);
+}
+
 qint64 LameEncoderStream::writeAudio(float *buffer, qint64 numSamples)
 {
-    unsigned char outBuffer[(numSamples/48000 + 1)*lame_get_brate(m_lame_gbf) + 7200];
+    if (!m_device)
+        return -1;
 
-    int bytesEncoded = lame_encode_buffer_interleaved_ieee_float(m_lame_gbf, buffer,
-        (int)numSamples, outBuffer, sizeof(outBuffer));
+    qint64 totalWritten = 0;
+    qint64 encodeNsecs = 0;
 
-    if (bytesEncoded < 0) {
-        error(tr("MP3/LAME Error: Probably a programmer mistake. Hint: %1").arg(bytesEncoded));
+    // m_outBuffer is only big enough for ENCODE_CHUNK_FRAMES at a time
+    for (qint64 done = 0; done < numSamples; done += ENCODE_CHUNK_FRAMES)
+    {
+        int frames = int(qMin(qint64(ENCODE_CHUNK_FRAMES), numSamples - done));
+        float *in = buffer + done * m_format.channels;
 
-        close();
-        return -1;
-    } else {
-        auto bytesWritten = m_device->write((const char*)outBuffer, bytesEncoded);
+        // The interleaved variant always assumes two channels
+        const qint64 started = threadCpuNsecs();
+        int bytesEncoded = m_format.channels == 1
+            ? lame_encode_buffer_ieee_float(m_lame_gbf, in, in,
+                frames, m_outBuffer.get(), OUT_BUFFER_SIZE)
+            : lame_encode_buffer_interleaved_ieee_float(m_lame_gbf, in,
+                frames, m_outBuffer.get(), OUT_BUFFER_SIZE);
+        encodeNsecs += threadCpuNsecs() - started;
+
+        if (bytesEncoded < 0) {
+            error(tr("MP3/LAME Error: Probably a programmer mistake. Hint: %1").arg(bytesEncoded));
+
+            close();
+            return -1;
+        }
+
+        auto bytesWritten = m_device->write((const char*)m_outBuffer.get(), bytesEncoded);
         if (bytesWritten != bytesEncoded) {
             error(tr("MP3 Error: The device didn't feel like writing all of our data. Aborting."));
 
@@ -104,7 +254,48 @@ qint64 LameEncoderStream::writeAudio(float *buffer, qint64 numSamples)
             return -1;
         }
 
-        return bytesWritten;
+        totalWritten += bytesWritten;
+    }
+
+    measureSpeed(numSamples, encodeNsecs);
+
+    return totalWritten;
+}
+
+void LameEncoderStream::measureSpeed(qint64 frames, qint64 nsecs)
+{
+    m_measuredFrames += frames;
+    m_measuredNsecs += nsecs;
+
+    if (m_measuredFrames < qint64(m_format.sampleRate) * MEASURE_SECONDS)
+        return;
+
+    double audioSeconds = double(m_measuredFrames) / m_format.sampleRate;
+    double speed = audioSeconds / qMax(1e-9, m_measuredNsecs * 1e-9);
+    m_speedFactor.store(speed, std::memory_order_relaxed);
+
+    m_measuredFrames = 0;
+    m_measuredNsecs = 0;
+
+    if (speed < MIN_SPEED_FACTOR && m_quality < FASTEST_QUALITY)
+        stepDownQuality();
+}
+
+// The quality can't be changed on a running encoder, and a second encoder
+// would start with a delay of its own in the middle of the file. So the
+// faster quality is only used from the next file on.
+void LameEncoderStream::stepDownQuality()
+{
+    int quality = qMin(m_quality + QUALITY_STEP, FASTEST_QUALITY);
+
+    // Already lowered for this quality, by us or another stream
+    int floor = qualityFloor.load();
+    while (floor < quality) {
+        if (qualityFloor.compare_exchange_weak(floor, quality)) {
+            warning(tr("MP3: The computer is too slow for encoding quality %1, the next files use %2")
+                    .arg(m_quality).arg(quality));
+            return;
+        }
     }
 }
 
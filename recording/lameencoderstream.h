@@ -1,36 +1,85 @@
 #ifndef LAMEENCODERSTREAM_H
 #define LAMEENCODERSTREAM_H
 
-#include <QObject>
-
 #include <lame/lame.h>
 
+#include <atomic>
+#include <memory>
+
+#include "encoderstream.h"
+#include "streamformat.h"
+
 class QIODevice;
 
 namespace Recording {
 
-class LameEncoderStream: public QObject
+// How LAME should encode, see lame(1) for the details
+struct Mp3Profile
+{
+    enum Mode { Cbr, Abr, Vbr };
+
+    Mode mode = Cbr;
+    int  bitrate = 192;        // kbit/s, for CBR and ABR
+    int  vbrQuality = 2;       // 0 (best) .. 9, for VBR
+    int  quality = 5;          // algorithm quality, 0 (best, slowest) .. 9 (fastest)
+    bool mono = false;         // downmix stereo input
+    int  outSampleRate = 0;    // 0 keeps the input rate
+};
+
+class LameEncoderStream: public EncoderStream
 {
     Q_OBJECT
 public:
     explicit LameEncoderStream(QObject *parent = nullptr);
     ~LameEncoderStream();
 
-    void close();
+    bool open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output) override;
+    void close() override;
+    bool sync() override;
 
-signals:
-    void error(const QString &message);
+    // used by open()
+    void setProfile(const Mp3Profile &profile) { m_profile = profile; }
+
+    // Seconds of audio encoded per second of CPU time in LAME, measured over
+    // the last few seconds of audio. 0 until there is a measurement.
+    double speedFactor() const { return m_speedFactor.load(std::memory_order_relaxed); }
 
 public slots:
-    bool init(const QString& artist, const QString &track, int brate, QIODevice *output);
+    bool init(const QString& artist, const QString &track, const Recording::Mp3Profile &profile, const Recording::StreamFormat &format, QIODevice *output);
 
-    qint64 writeAudio(float *samples, qint64 count);
+    qint64 writeAudio(float *samples, qint64 count) override;
 
 private:
+    // Bigger blocks are encoded in pieces, so the output buffer has a fixed size.
+    // The worst case from lame.h is 1.25 * samples + 7200 bytes, which also
+    // covers what lame_encode_flush_nogap() produces.
+    static const int ENCODE_CHUNK_FRAMES = 4096;
+    static const int OUT_BUFFER_SIZE = ENCODE_CHUNK_FRAMES * 5 / 4 + 7200;
+
+    bool setupEncoder(int quality);
+    bool flushEncoder();
+    void measureSpeed(qint64 frames, qint64 nsecs);
+    void stepDownQuality();
+
     lame_global_flags *m_lame_gbf;
     QIODevice         *m_device;
+    StreamFormat       m_format;
+    Mp3Profile         m_profile;
+    int                m_quality { 5 };
+
+    // where the Xing/LAME info frame goes, -1 if it can't be written
+    qint64             m_infoFrameOffset { -1 };
+
+    std::unique_ptr<unsigned char[]> m_outBuffer;
+
+    // realtime budget, only touched by the encoding thread
+    qint64             m_measuredFrames { 0 };
+    qint64             m_measuredNsecs { 0 };
+    std::atomic<double> m_speedFactor { 0.0 };
 };
 
 } // namespace Recording
 
+Q_DECLARE_METATYPE(Recording::Mp3Profile)
+
 #endif // LAMEENCODERSTREAM_H
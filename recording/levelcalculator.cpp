@@ -1,41 +1,132 @@
 #include "levelcalculator.h"
 
+#include <cmath>
+#include <limits>
+
 namespace Recording {
 
+namespace {
+    const qint64 UPDATE_FRAMES = 2000;
+    const qint64 CONVERT_CHUNK_FRAMES = 1024;
+
+    const double PEAK_HOLD_SECONDS = 1.5;
+    const double PEAK_DECAY_DB_PER_SECOND = 20.0;
+
+    static_assert(Recording::StreamFormat::MAX_CHANNELS <= Recording::Kernels::LevelStats::MAX_CHANNELS,
+                  "the level kernels have to take every channel we record");
+}
+
 LevelCalculator::LevelCalculator(QObject *parent) : QObject(parent)
 {
+    qRegisterMetaType<Recording::Levels>();
 
+    setFormat(StreamFormat());
 }
 
-void LevelCalculator::processAudio(const float *samples, qint64 count)
+void LevelCalculator::setFormat(const StreamFormat &format)
 {
-    for (qint64 i = 0; i < count; ++i) {
-        m_tempLevelL = qMax(m_tempLevelL, qAbs(samples[2*i + 0]));
-        m_tempLevelR = qMax(m_tempLevelR, qAbs(samples[2*i + 1]));
+    m_format = format;
+
+    m_loudness.configure(format.sampleRate, format.channels);
+    m_truePeak.configure(format.sampleRate, format.channels);
+    m_convertBuffer.resize(size_t(format.channels * CONVERT_CHUNK_FRAMES));
+
+    m_stats = Kernels::LevelStats();
+    for (int c = 0; c < Levels::MAX_CHANNELS; ++c)
+    {
+        m_truePeakAccum[c] = 0;
+        m_peakHold[c] = 0;
+        m_peakHoldAge[c] = 0;
     }
+}
+
+void LevelCalculator::processAudio(const float *samples, qint64 count)
+{
+    Kernels::analyzeLevels(samples, count, m_format.channels, m_stats);
+    m_loudness.process(samples, count);
+    m_truePeak.process(samples, count, m_truePeakAccum);
 
-    m_tempLevelSampleCount += count;
+    maybeEmitLevel();
+}
 
-    if (m_tempLevelSampleCount >= 2000) {
-        m_levelL = m_tempLevelL;
-        m_levelR = m_tempLevelR;
-        m_tempLevelSampleCount = 0;
-        m_tempLevelL = 0;
-        m_tempLevelR = 0;
+void LevelCalculator::processAudio(const qint16 *samples, qint64 count)
+{
+    // The loudness and true peak filters want floats. Convert in
+    // pieces, so the buffer stays small no matter what we are fed.
+    for (qint64 done = 0; done < count; done += CONVERT_CHUNK_FRAMES)
+    {
+        const int channels = m_format.channels;
+        qint64 n = qMin(CONVERT_CHUNK_FRAMES, count - done);
+        for (qint64 i = 0; i < channels*n; ++i)
+            m_convertBuffer[size_t(i)] = float(samples[channels*done + i]) / std::numeric_limits<qint16>::max();
 
-        emit levelUpdate(m_levelL, m_levelR);
+        m_loudness.process(m_convertBuffer.data(), n);
+        m_truePeak.process(m_convertBuffer.data(), n, m_truePeakAccum);
     }
+
+    Kernels::analyzeLevels(samples, count, m_format.channels, m_stats);
+
+    maybeEmitLevel();
 }
 
-void LevelCalculator::processAudio(const qint16 *sampleI, qint64 count)
+void LevelCalculator::resetIntegratedLoudness()
 {
-    float sampleF[count*2];
+    m_loudness.resetIntegrated();
+}
+
+void LevelCalculator::maybeEmitLevel()
+{
+    if (m_stats.frames < UPDATE_FRAMES)
+        return;
+
+    Levels levels;
+    levels.channels = qMax(m_format.channels, 2);
 
-    for (qint64 i = 0; i < count*2; ++i) {
-        sampleF[i] = float(sampleI[i]) / std::numeric_limits<qint16>::max();
+    const int sampleRate = m_format.sampleRate;
+    for (int c = 0; c < m_format.channels; ++c)
+    {
+        levels.peak[c] = m_stats.peak[c];
+        levels.rms[c] = float(std::sqrt(m_stats.sumSquares[c] / m_stats.frames));
+        levels.truePeak[c] = qMax(m_truePeakAccum[c], m_stats.peak[c]);
+        levels.clipped[c] = m_stats.clipped[c];
+
+        // hold the highest peak for a while, then let it fall slowly
+        if (levels.truePeak[c] >= m_peakHold[c])
+        {
+            m_peakHold[c] = levels.truePeak[c];
+            m_peakHoldAge[c] = 0;
+        }
+        else
+        {
+            m_peakHoldAge[c] += m_stats.frames;
+            if (m_peakHoldAge[c] > qint64(PEAK_HOLD_SECONDS * sampleRate))
+            {
+                double seconds = double(m_stats.frames) / sampleRate;
+                m_peakHold[c] = qMax(levels.truePeak[c],
+                    m_peakHold[c] * float(std::pow(10.0, -PEAK_DECAY_DB_PER_SECOND * seconds / 20.0)));
+            }
+        }
+        levels.peakHold[c] = m_peakHold[c];
+
+        m_truePeakAccum[c] = 0;
+    }
+
+    if (m_format.channels == 1)
+    {
+        levels.peak[1] = levels.peak[0];
+        levels.rms[1] = levels.rms[0];
+        levels.truePeak[1] = levels.truePeak[0];
+        levels.peakHold[1] = levels.peakHold[0];
+        levels.clipped[1] = levels.clipped[0];
     }
 
-    processAudio(sampleF, count);
+    levels.momentaryLoudness = m_loudness.momentaryLoudness();
+    levels.shortTermLoudness = m_loudness.shortTermLoudness();
+    levels.integratedLoudness = m_loudness.integratedLoudness();
+
+    m_stats = Kernels::LevelStats();
+
+    emit levelUpdate(levels);
 }
 
 } // namespace Recording
@@ -3,8 +3,35 @@
 
 #include <QObject>
 
+#include <cmath>
+#include <vector>
+
+#include "streamformat.h"
+#include "levelkernels.h"
+#include "loudnessmeter.h"
+#include "truepeakmeter.h"
+
 namespace Recording {
 
+// One meter reading. Levels are linear (1.0 = full scale),
+// loudness is in LUFS and -inf while there is nothing to report.
+// Mono input is reported on both channels.
+struct Levels
+{
+    static constexpr int MAX_CHANNELS = StreamFormat::MAX_CHANNELS;
+
+    int    channels = 2;                  // valid entries below, at least two
+    float  peak[MAX_CHANNELS]     = {};   // sample peak since the last reading
+    float  rms[MAX_CHANNELS]      = {};   // since the last reading
+    float  truePeak[MAX_CHANNELS] = {};   // oversampled peak since the last reading
+    float  peakHold[MAX_CHANNELS] = {};   // highest true peak, held and then decaying
+    qint64 clipped[MAX_CHANNELS]  = {};   // clipped samples since the last reading
+
+    double momentaryLoudness  = -HUGE_VAL;
+    double shortTermLoudness  = -HUGE_VAL;
+    double integratedLoudness = -HUGE_VAL;
+};
+
 class LevelCalculator : public QObject
 {
     Q_OBJECT
@@ -12,20 +39,37 @@ public:
     explicit LevelCalculator(QObject *parent = 0);
 
 signals:
-    void levelUpdate(float l, float r);
+    void levelUpdate(const Recording::Levels &levels);
 
 public slots:
+    // Reconfigures for a new stream, which resets all measurements
+    void setFormat(const Recording::StreamFormat &format);
+
     void processAudio(const float *samples, qint64 count);
     void processAudio(const qint16 *samples, qint64 count);
 
+    // Start measuring the integrated loudness anew, e.g. for a new recording
+    void resetIntegratedLoudness();
+
 private:
-    float m_tempLevelL = 0.0f;
-    float m_tempLevelR = 0.0f;
-    float m_levelL = 0.0f;
-    float m_levelR = 0.0f;
-    qint64 m_tempLevelSampleCount = 0;
+    void maybeEmitLevel();
+
+    StreamFormat m_format;
+
+    Kernels::LevelStats m_stats;
+    LoudnessMeter m_loudness;
+    TruePeakMeter m_truePeak;
+    float m_truePeakAccum[Levels::MAX_CHANNELS] = {};
+
+    float  m_peakHold[Levels::MAX_CHANNELS] = {};
+    qint64 m_peakHoldAge[Levels::MAX_CHANNELS] = {};
+
+    // for feeding int16 input to the loudness and true peak meters
+    std::vector<float> m_convertBuffer;
 };
 
 } // namespace Recording
 
+Q_DECLARE_METATYPE(Recording::Levels)
+
 #endif // LEVELCALCULATOR_H
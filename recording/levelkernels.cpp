@@ -0,0 +1,569 @@
+#include "levelkernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  define LEVELKERNELS_X86 1
+#  include <immintrin.h>
+#  if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#  endif
+#endif
+
+// GCC and clang only emit AVX2 code in functions that ask for it
+#if defined(__GNUC__) || defined(__clang__)
+#  define TARGET_SSE2 __attribute__((target("sse2")))
+#  define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#  define TARGET_SSE2
+#  define TARGET_AVX2
+#endif
+
+namespace Recording {
+namespace Kernels {
+
+namespace {
+
+const float INT16_SCALE = 1.0f / 32767.0f;
+
+// The SIMD kernels sum squares in single precision lanes. To keep the
+// rounding error in check over long blocks, they move their partial sums
+// into the double precision totals after at most this many frames.
+const int64_t CHUNK_FRAMES = 1024;
+
+// The multichannel kernels walk a chunk once per group of channels,
+// so it should stay in the L1 cache even with many channels
+const int64_t MULTI_CHUNK_FRAMES = 256;
+
+inline void finishInt16(LevelStats &stats, const float peak[2], const double sumSquares[2], const int64_t clipped[2])
+{
+    for (int c = 0; c < 2; ++c)
+    {
+        stats.peak[c] = std::max(stats.peak[c], peak[c] * INT16_SCALE);
+        stats.sumSquares[c] += sumSquares[c] * double(INT16_SCALE) * double(INT16_SCALE);
+        stats.clipped[c] += clipped[c];
+    }
+}
+
+// === scalar ===
+
+void analyzeFloatScalar(const float *samples, int64_t frames, LevelStats &stats)
+{
+    float peakL = stats.peak[0], peakR = stats.peak[1];
+    double sumL = 0, sumR = 0;
+    int64_t clipL = 0, clipR = 0;
+
+    for (int64_t i = 0; i < frames; ++i)
+    {
+        float l = std::fabs(samples[2*i + 0]);
+        float r = std::fabs(samples[2*i + 1]);
+
+        peakL = std::max(peakL, l);
+        peakR = std::max(peakR, r);
+        sumL += double(l) * l;
+        sumR += double(r) * r;
+        clipL += l >= 1.0f;
+        clipR += r >= 1.0f;
+    }
+
+    stats.peak[0] = peakL;
+    stats.peak[1] = peakR;
+    stats.sumSquares[0] += sumL;
+    stats.sumSquares[1] += sumR;
+    stats.clipped[0] += clipL;
+    stats.clipped[1] += clipR;
+    stats.frames += frames;
+}
+
+// works on the raw integer magnitudes, scaling happens once at the end
+void analyzeInt16Tail(const int16_t *samples, int64_t frames, float peak[2], double sumSquares[2], int64_t clipped[2])
+{
+    for (int64_t i = 0; i < 2*frames; ++i)
+    {
+        float v = std::fabs(float(samples[i]));
+
+        peak[i & 1] = std::max(peak[i & 1], v);
+        sumSquares[i & 1] += double(v) * v;
+        clipped[i & 1] += v >= 32767.0f;
+    }
+}
+
+void analyzeInt16Scalar(const int16_t *samples, int64_t frames, LevelStats &stats)
+{
+    float peak[2] = { 0, 0 };
+    double sumSquares[2] = { 0, 0 };
+    int64_t clipped[2] = { 0, 0 };
+
+    analyzeInt16Tail(samples, frames, peak, sumSquares, clipped);
+
+    finishInt16(stats, peak, sumSquares, clipped);
+    stats.frames += frames;
+}
+
+// Channels from `first` on, one after the other. Doesn't count the frames.
+void analyzeChannelsScalar(const float *samples, int64_t frames, int channels, int first, LevelStats &stats)
+{
+    for (int c = first; c < channels; ++c)
+    {
+        float peak = stats.peak[c];
+        double sum = 0;
+        int64_t clip = 0;
+
+        for (int64_t i = 0; i < frames; ++i)
+        {
+            float v = std::fabs(samples[i * channels + c]);
+
+            peak = std::max(peak, v);
+            sum += double(v) * v;
+            clip += v >= 1.0f;
+        }
+
+        stats.peak[c] = peak;
+        stats.sumSquares[c] += sum;
+        stats.clipped[c] += clip;
+    }
+}
+
+void analyzeMultiScalar(const float *samples, int64_t frames, int channels, LevelStats &stats)
+{
+    for (int64_t done = 0; done < frames; done += MULTI_CHUNK_FRAMES)
+        analyzeChannelsScalar(samples + done * channels, std::min(MULTI_CHUNK_FRAMES, frames - done), channels, 0, stats);
+
+    stats.frames += frames;
+}
+
+// Any number of channels, too rare to bother with SIMD
+void analyzeInt16Multi(const int16_t *samples, int64_t frames, int channels, LevelStats &stats)
+{
+    for (int c = 0; c < channels; ++c)
+    {
+        float peak = 0;
+        double sum = 0;
+        int64_t clip = 0;
+
+        for (int64_t i = 0; i < frames; ++i)
+        {
+            float v = std::fabs(float(samples[i * channels + c]));
+
+            peak = std::max(peak, v);
+            sum += double(v) * v;
+            clip += v >= 32767.0f;
+        }
+
+        stats.peak[c] = std::max(stats.peak[c], peak * INT16_SCALE);
+        stats.sumSquares[c] += sum * double(INT16_SCALE) * double(INT16_SCALE);
+        stats.clipped[c] += clip;
+    }
+
+    stats.frames += frames;
+}
+
+#ifdef LEVELKERNELS_X86
+
+// === SSE2 ===
+// One register holds two stereo frames (L R L R), so even lanes belong
+// to the left channel and odd lanes to the right one.
+
+TARGET_SSE2 inline void horizontalSse2(__m128 peak, __m128 sum, __m128i clip,
+                                       float outPeak[2], double outSum[2], int64_t outClip[2])
+{
+    alignas(16) float p[4], s[4];
+    alignas(16) int32_t c[4];
+    _mm_store_ps(p, peak);
+    _mm_store_ps(s, sum);
+    _mm_store_si128(reinterpret_cast<__m128i*>(c), clip);
+
+    outPeak[0] = std::max(outPeak[0], std::max(p[0], p[2]));
+    outPeak[1] = std::max(outPeak[1], std::max(p[1], p[3]));
+    outSum[0] += double(s[0]) + double(s[2]);
+    outSum[1] += double(s[1]) + double(s[3]);
+    outClip[0] += c[0] + c[2];
+    outClip[1] += c[1] + c[3];
+}
+
+// Accumulates |x|, x² and |x| >= threshold over 4 lanes
+#define SSE2_ACCUMULATE(v, threshold) \
+    do { \
+        __m128 a = _mm_andnot_ps(signMask, (v)); \
+        peak = _mm_max_ps(peak, a); \
+        sum = _mm_add_ps(sum, _mm_mul_ps(a, a)); \
+        clip = _mm_sub_epi32(clip, _mm_castps_si128(_mm_cmpge_ps(a, (threshold)))); \
+    } while (0)
+
+TARGET_SSE2 void analyzeFloatSse2(const float *samples, int64_t frames, LevelStats &stats)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    int64_t done = 0;
+    while (frames - done >= 2)
+    {
+        int64_t chunkEnd = done + std::min(CHUNK_FRAMES, (frames - done) & ~int64_t(1));
+
+        __m128 peak = _mm_setzero_ps();
+        __m128 sum = _mm_setzero_ps();
+        __m128i clip = _mm_setzero_si128();
+
+        for (; done < chunkEnd; done += 2)
+        {
+            __m128 v = _mm_loadu_ps(samples + 2*done);
+            SSE2_ACCUMULATE(v, one);
+        }
+
+        horizontalSse2(peak, sum, clip, stats.peak, stats.sumSquares, stats.clipped);
+    }
+
+    stats.frames += done;
+    analyzeFloatScalar(samples + 2*done, frames - done, stats);
+}
+
+TARGET_SSE2 void analyzeInt16Sse2(const int16_t *samples, int64_t frames, LevelStats &stats)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 fullScale = _mm_set1_ps(32767.0f);
+
+    float peakOut[2] = { 0, 0 };
+    double sumOut[2] = { 0, 0 };
+    int64_t clipOut[2] = { 0, 0 };
+
+    int64_t done = 0;
+    while (frames - done >= 4)
+    {
+        int64_t chunkEnd = done + std::min(CHUNK_FRAMES, (frames - done) & ~int64_t(3));
+
+        __m128 peak = _mm_setzero_ps();
+        __m128 sum = _mm_setzero_ps();
+        __m128i clip = _mm_setzero_si128();
+
+        for (; done < chunkEnd; done += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + 2*done));
+
+            // sign-extend to 32 bit by moving each value to the upper half and shifting back
+            __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+            __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+
+            SSE2_ACCUMULATE(lo, fullScale);
+            SSE2_ACCUMULATE(hi, fullScale);
+        }
+
+        horizontalSse2(peak, sum, clip, peakOut, sumOut, clipOut);
+    }
+
+    analyzeInt16Tail(samples + 2*done, frames - done, peakOut, sumOut, clipOut);
+
+    finishInt16(stats, peakOut, sumOut, clipOut);
+    stats.frames += frames;
+}
+
+// Four channels per register, lane i belongs to channel c + i. What doesn't
+// fill a whole register at the end is left to the scalar code.
+TARGET_SSE2 void analyzeChannelsSse2(const float *samples, int64_t frames, int channels, int first, LevelStats &stats)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    int c = first;
+    for (; c + 4 <= channels; c += 4)
+    {
+        __m128 peak = _mm_setzero_ps();
+        __m128 sum = _mm_setzero_ps();
+        __m128i clip = _mm_setzero_si128();
+
+        for (int64_t i = 0; i < frames; ++i)
+        {
+            __m128 v = _mm_loadu_ps(samples + i * channels + c);
+            SSE2_ACCUMULATE(v, one);
+        }
+
+        alignas(16) float p[4], s[4];
+        alignas(16) int32_t k[4];
+        _mm_store_ps(p, peak);
+        _mm_store_ps(s, sum);
+        _mm_store_si128(reinterpret_cast<__m128i*>(k), clip);
+
+        for (int j = 0; j < 4; ++j)
+        {
+            stats.peak[c + j] = std::max(stats.peak[c + j], p[j]);
+            stats.sumSquares[c + j] += double(s[j]);
+            stats.clipped[c + j] += k[j];
+        }
+    }
+
+    analyzeChannelsScalar(samples, frames, channels, c, stats);
+}
+
+TARGET_SSE2 void analyzeMultiSse2(const float *samples, int64_t frames, int channels, LevelStats &stats)
+{
+    for (int64_t done = 0; done < frames; done += MULTI_CHUNK_FRAMES)
+        analyzeChannelsSse2(samples + done * channels, std::min(MULTI_CHUNK_FRAMES, frames - done), channels, 0, stats);
+
+    stats.frames += frames;
+}
+
+#undef SSE2_ACCUMULATE
+
+// === AVX2 ===
+// Same as above with four stereo frames per register
+
+TARGET_AVX2 inline void horizontalAvx2(__m256 peak, __m256 sum, __m256i clip,
+                                       float outPeak[2], double outSum[2], int64_t outClip[2])
+{
+    alignas(32) float p[8], s[8];
+    alignas(32) int32_t c[8];
+    _mm256_store_ps(p, peak);
+    _mm256_store_ps(s, sum);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(c), clip);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        outPeak[i & 1] = std::max(outPeak[i & 1], p[i]);
+        outSum[i & 1] += double(s[i]);
+        outClip[i & 1] += c[i];
+    }
+}
+
+#define AVX2_ACCUMULATE(v, threshold) \
+    do { \
+        __m256 a = _mm256_andnot_ps(signMask, (v)); \
+        peak = _mm256_max_ps(peak, a); \
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a, a)); \
+        clip = _mm256_sub_epi32(clip, _mm256_castps_si256(_mm256_cmp_ps(a, (threshold), _CMP_GE_OQ))); \
+    } while (0)
+
+TARGET_AVX2 void analyzeFloatAvx2(const float *samples, int64_t frames, LevelStats &stats)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    int64_t done = 0;
+    while (frames - done >= 4)
+    {
+        int64_t chunkEnd = done + std::min(CHUNK_FRAMES, (frames - done) & ~int64_t(3));
+
+        __m256 peak = _mm256_setzero_ps();
+        __m256 sum = _mm256_setzero_ps();
+        __m256i clip = _mm256_setzero_si256();
+
+        for (; done < chunkEnd; done += 4)
+        {
+            __m256 v = _mm256_loadu_ps(samples + 2*done);
+            AVX2_ACCUMULATE(v, one);
+        }
+
+        horizontalAvx2(peak, sum, clip, stats.peak, stats.sumSquares, stats.clipped);
+    }
+
+    stats.frames += done;
+    analyzeFloatScalar(samples + 2*done, frames - done, stats);
+}
+
+TARGET_AVX2 void analyzeInt16Avx2(const int16_t *samples, int64_t frames, LevelStats &stats)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 fullScale = _mm256_set1_ps(32767.0f);
+
+    float peakOut[2] = { 0, 0 };
+    double sumOut[2] = { 0, 0 };
+    int64_t clipOut[2] = { 0, 0 };
+
+    int64_t done = 0;
+    while (frames - done >= 4)
+    {
+        int64_t chunkEnd = done + std::min(CHUNK_FRAMES, (frames - done) & ~int64_t(3));
+
+        __m256 peak = _mm256_setzero_ps();
+        __m256 sum = _mm256_setzero_ps();
+        __m256i clip = _mm256_setzero_si256();
+
+        for (; done < chunkEnd; done += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + 2*done));
+            __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v));
+
+            AVX2_ACCUMULATE(f, fullScale);
+        }
+
+        horizontalAvx2(peak, sum, clip, peakOut, sumOut, clipOut);
+    }
+
+    analyzeInt16Tail(samples + 2*done, frames - done, peakOut, sumOut, clipOut);
+
+    finishInt16(stats, peakOut, sumOut, clipOut);
+    stats.frames += frames;
+}
+
+// Eight channels per register, the rest goes to the SSE2 and scalar code
+TARGET_AVX2 void analyzeMultiAvx2(const float *samples, int64_t frames, int channels, LevelStats &stats)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    for (int64_t done = 0; done < frames; done += MULTI_CHUNK_FRAMES)
+    {
+        const float *chunk = samples + done * channels;
+        const int64_t n = std::min(MULTI_CHUNK_FRAMES, frames - done);
+
+        int c = 0;
+        for (; c + 8 <= channels; c += 8)
+        {
+            __m256 peak = _mm256_setzero_ps();
+            __m256 sum = _mm256_setzero_ps();
+            __m256i clip = _mm256_setzero_si256();
+
+            for (int64_t i = 0; i < n; ++i)
+            {
+                __m256 v = _mm256_loadu_ps(chunk + i * channels + c);
+                AVX2_ACCUMULATE(v, one);
+            }
+
+            alignas(32) float p[8], s[8];
+            alignas(32) int32_t k[8];
+            _mm256_store_ps(p, peak);
+            _mm256_store_ps(s, sum);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(k), clip);
+
+            for (int j = 0; j < 8; ++j)
+            {
+                stats.peak[c + j] = std::max(stats.peak[c + j], p[j]);
+                stats.sumSquares[c + j] += double(s[j]);
+                stats.clipped[c + j] += k[j];
+            }
+        }
+
+        analyzeChannelsSse2(chunk, n, channels, c, stats);
+    }
+
+    stats.frames += frames;
+}
+
+#undef AVX2_ACCUMULATE
+
+bool cpuHasSse2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+    return true; // part of the x86-64 baseline
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return info[3] & (1 << 26);
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // the OS also has to save the upper halves of the registers for us
+    __cpuid(info, 1);
+    bool osxsave = info[2] & (1 << 27);
+    if (!osxsave || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // LEVELKERNELS_X86
+
+const LevelKernelSet &bestLevelKernels()
+{
+    static const LevelKernelSet &best = []() -> const LevelKernelSet & {
+        if (avx2LevelKernels().analyzeFloat)
+            return avx2LevelKernels();
+        if (sse2LevelKernels().analyzeFloat)
+            return sse2LevelKernels();
+        return scalarLevelKernels();
+    }();
+
+    return best;
+}
+
+} // anonymous namespace
+
+namespace {
+
+// A mono buffer looks just like a stereo one with half as many frames,
+// so the stereo kernels do the work and we merge the two halves after.
+template <typename Sample, typename Kernel>
+void analyzeMono(Kernel kernel, const Sample *samples, int64_t frames, LevelStats &stats)
+{
+    LevelStats pairs;
+    kernel(samples, frames / 2, pairs);
+    if (frames & 1)
+    {
+        // let the odd sample out pose as a frame with a silent right channel
+        Sample last[2] = { samples[frames - 1], 0 };
+        kernel(last, 1, pairs);
+    }
+
+    stats.peak[0] = std::max(stats.peak[0], std::max(pairs.peak[0], pairs.peak[1]));
+    stats.sumSquares[0] += pairs.sumSquares[0] + pairs.sumSquares[1];
+    stats.clipped[0] += pairs.clipped[0] + pairs.clipped[1];
+    stats.frames += frames;
+}
+
+} // anonymous namespace
+
+void analyzeLevels(const float *samples, int64_t frames, int channels, LevelStats &stats)
+{
+    if (channels == 1)
+        analyzeMono(bestLevelKernels().analyzeFloat, samples, frames, stats);
+    else if (channels == 2)
+        bestLevelKernels().analyzeFloat(samples, frames, stats);
+    else
+        bestLevelKernels().analyzeMultichannel(samples, frames, channels, stats);
+}
+
+void analyzeLevels(const int16_t *samples, int64_t frames, int channels, LevelStats &stats)
+{
+    if (channels == 1)
+        analyzeMono(bestLevelKernels().analyzeInt16, samples, frames, stats);
+    else if (channels == 2)
+        bestLevelKernels().analyzeInt16(samples, frames, stats);
+    else
+        analyzeInt16Multi(samples, frames, channels, stats);
+}
+
+const LevelKernelSet &scalarLevelKernels()
+{
+    static const LevelKernelSet set { "scalar", &analyzeFloatScalar, &analyzeInt16Scalar, &analyzeMultiScalar };
+    return set;
+}
+
+const LevelKernelSet &sse2LevelKernels()
+{
+#ifdef LEVELKERNELS_X86
+    static const LevelKernelSet set = cpuHasSse2()
+            ? LevelKernelSet { "sse2", &analyzeFloatSse2, &analyzeInt16Sse2, &analyzeMultiSse2 }
+            : LevelKernelSet { "sse2", nullptr, nullptr, nullptr };
+#else
+    static const LevelKernelSet set { "sse2", nullptr, nullptr, nullptr };
+#endif
+    return set;
+}
+
+const LevelKernelSet &avx2LevelKernels()
+{
+#ifdef LEVELKERNELS_X86
+    static const LevelKernelSet set = cpuHasAvx2()
+            ? LevelKernelSet { "avx2", &analyzeFloatAvx2, &analyzeInt16Avx2, &analyzeMultiAvx2 }
+            : LevelKernelSet { "avx2", nullptr, nullptr, nullptr };
+#else
+    static const LevelKernelSet set { "avx2", nullptr, nullptr, nullptr };
+#endif
+    return set;
+}
+
+} // namespace Kernels
+} // namespace Recording
@@ -0,0 +1,54 @@
+#ifndef RECORDING_LEVELKERNELS_H
+#define RECORDING_LEVELKERNELS_H
+
+#include <cstdint>
+
+namespace Recording {
+namespace Kernels {
+
+/*
+ * Per-channel statistics over interleaved audio, gathered in one pass.
+ * The kernels accumulate into an existing LevelStats, so a block can be
+ * fed in arbitrary pieces. Only as many channels as the input has are
+ * filled in.
+ *
+ * Values are normalized to [-1, 1], a sample counts as clipped if its
+ * magnitude reaches full scale.
+ */
+struct LevelStats
+{
+    static constexpr int MAX_CHANNELS = 32;
+
+    float   peak[MAX_CHANNELS]       = {};
+    double  sumSquares[MAX_CHANNELS] = {};
+    int64_t clipped[MAX_CHANNELS]    = {};
+    int64_t frames                   = 0;
+};
+
+using FloatLevelKernel = void (*)(const float *samples, int64_t frames, LevelStats &stats);
+using Int16LevelKernel = void (*)(const int16_t *samples, int64_t frames, LevelStats &stats);
+using MultiLevelKernel = void (*)(const float *samples, int64_t frames, int channels, LevelStats &stats);
+
+// The best implementation for the CPU we are running on, chosen at first use
+void analyzeLevels(const float *samples, int64_t frames, int channels, LevelStats &stats);
+void analyzeLevels(const int16_t *samples, int64_t frames, int channels, LevelStats &stats);
+
+// All implementations, for benchmarking and cross-checking. The first two
+// expect stereo, the multichannel one any number of channels up to MAX_CHANNELS.
+// Unsupported ones (wrong architecture or CPU) are nullptr.
+struct LevelKernelSet
+{
+    const char      *name;
+    FloatLevelKernel analyzeFloat;
+    Int16LevelKernel analyzeInt16;
+    MultiLevelKernel analyzeMultichannel;
+};
+
+const LevelKernelSet &scalarLevelKernels();
+const LevelKernelSet &sse2LevelKernels();
+const LevelKernelSet &avx2LevelKernels();
+
+} // namespace Kernels
+} // namespace Recording
+
+#endif // RECORDING_LEVELKERNELS_H
@@ -0,0 +1,226 @@
+#include "loudnessmeter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Recording {
+
+namespace {
+    const int SHORT_TERM_BLOCKS = 30;  // 3 s in 100 ms blocks
+    const int MOMENTARY_BLOCKS = 4;    // 400 ms
+
+    const double ABSOLUTE_GATE = -70.0;
+    const double RELATIVE_GATE = -10.0;
+
+    // histogram covers -70 .. +30 LUFS in 0.1 LU steps
+    const int HISTOGRAM_BINS = 1000;
+
+    double energyToLoudness(double energy)
+    {
+        if (energy <= 0)
+            return -HUGE_VAL;
+
+        return -0.691 + 10.0 * std::log10(energy);
+    }
+
+    double loudnessToEnergy(double loudness)
+    {
+        return std::pow(10.0, (loudness + 0.691) / 10.0);
+    }
+
+    int histogramBin(double loudness)
+    {
+        int bin = int((loudness - ABSOLUTE_GATE) * 10.0);
+        return std::min(std::max(bin, 0), HISTOGRAM_BINS - 1);
+    }
+}
+
+LoudnessMeter::LoudnessMeter()
+{
+    configure(48000, 2);
+}
+
+void LoudnessMeter::configure(int sampleRate, int channels)
+{
+    m_channels = channels;
+    m_blockFrames = sampleRate / 10;
+
+    // K-weighting filter coefficients for arbitrary sample rates,
+    // derived from the 48 kHz ones given in BS.1770 (same as libebur128)
+    double f0 = 1681.974450955533;
+    double G  = 3.999843853973347;
+    double Q  = 0.7071752369554196;
+
+    double K  = std::tan(M_PI * f0 / sampleRate);
+    double Vh = std::pow(10.0, G / 20.0);
+    double Vb = std::pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+
+    m_stage[0].b0 = (Vh + Vb * K / Q + K * K) / a0;
+    m_stage[0].b1 = 2.0 * (K * K - Vh) / a0;
+    m_stage[0].b2 = (Vh - Vb * K / Q + K * K) / a0;
+    m_stage[0].a1 = 2.0 * (K * K - 1.0) / a0;
+    m_stage[0].a2 = (1.0 - K / Q + K * K) / a0;
+
+    f0 = 38.13547087602444;
+    Q  = 0.5003270373238773;
+    K  = std::tan(M_PI * f0 / sampleRate);
+    a0 = 1.0 + K / Q + K * K;
+
+    m_stage[1].b0 = 1.0;
+    m_stage[1].b1 = -2.0;
+    m_stage[1].b2 = 1.0;
+    m_stage[1].a1 = 2.0 * (K * K - 1.0) / a0;
+    m_stage[1].a2 = (1.0 - K / Q + K * K) / a0;
+
+    m_state.assign(size_t(channels), FilterState());
+    m_blocks.assign(SHORT_TERM_BLOCKS, 0.0);
+    m_histogram.assign(HISTOGRAM_BINS, HistogramBin());
+
+    reset();
+}
+
+void LoudnessMeter::reset()
+{
+    std::fill(m_state.begin(), m_state.end(), FilterState());
+    std::fill(m_blocks.begin(), m_blocks.end(), 0.0);
+    m_blockAccum = 0;
+    m_blockPos = 0;
+    m_blockHead = 0;
+    m_blockCount = 0;
+
+    resetIntegrated();
+}
+
+void LoudnessMeter::resetIntegrated()
+{
+    std::fill(m_histogram.begin(), m_histogram.end(), HistogramBin());
+}
+
+void LoudnessMeter::process(const float *samples, int64_t frames)
+{
+    switch (m_channels)
+    {
+    case 1:  processFrames<1>(samples, frames); break;
+    case 2:  processFrames<2>(samples, frames); break;
+    default: processFrames<0>(samples, frames); break;
+    }
+}
+
+template <int Channels>
+void LoudnessMeter::processFrames(const float *samples, int64_t frames)
+{
+    const int channels = Channels ? Channels : m_channels;
+    const Biquad s0 = m_stage[0];
+    const Biquad s1 = m_stage[1];
+    FilterState *state = m_state.data();
+
+    for (int64_t i = 0; i < frames; ++i)
+    {
+        for (int c = 0; c < channels; ++c)
+        {
+            FilterState &st = state[c];
+            double x = samples[i * channels + c];
+
+            double y = s0.b0 * x + st.z1[0];
+            st.z1[0] = s0.b1 * x - s0.a1 * y + st.z2[0];
+            st.z2[0] = s0.b2 * x - s0.a2 * y;
+
+            double z = s1.b0 * y + st.z1[1];
+            st.z1[1] = s1.b1 * y - s1.a1 * z + st.z2[1];
+            st.z2[1] = s1.b2 * y - s1.a2 * z;
+
+            // all channel weights are 1.0 as long as we don't do surround
+            m_blockAccum += z * z;
+        }
+
+        if (++m_blockPos == m_blockFrames)
+            finishBlock();
+    }
+}
+
+void LoudnessMeter::finishBlock()
+{
+    m_blocks[size_t(m_blockHead)] = m_blockAccum / m_blockFrames;
+    m_blockHead = (m_blockHead + 1) % SHORT_TERM_BLOCKS;
+    ++m_blockCount;
+
+    m_blockAccum = 0;
+    m_blockPos = 0;
+
+    // gating blocks are 400 ms long and overlap by 75%, i.e. one per 100 ms block
+    if (m_blockCount >= MOMENTARY_BLOCKS)
+    {
+        double energy = meanEnergy(MOMENTARY_BLOCKS);
+        double loudness = energyToLoudness(energy);
+        if (loudness >= ABSOLUTE_GATE)
+        {
+            HistogramBin &bin = m_histogram[size_t(histogramBin(loudness))];
+            bin.count++;
+            bin.energy += energy;
+        }
+    }
+}
+
+double LoudnessMeter::meanEnergy(int blocks) const
+{
+    double sum = 0;
+    for (int i = 1; i <= blocks; ++i)
+        sum += m_blocks[size_t((m_blockHead - i + SHORT_TERM_BLOCKS) % SHORT_TERM_BLOCKS)];
+
+    return sum / blocks;
+}
+
+double LoudnessMeter::momentaryLoudness() const
+{
+    if (m_blockCount < MOMENTARY_BLOCKS)
+        return -HUGE_VAL;
+
+    return energyToLoudness(meanEnergy(MOMENTARY_BLOCKS));
+}
+
+double LoudnessMeter::shortTermLoudness() const
+{
+    if (m_blockCount < SHORT_TERM_BLOCKS)
+        return -HUGE_VAL;
+
+    return energyToLoudness(meanEnergy(SHORT_TERM_BLOCKS));
+}
+
+double LoudnessMeter::integratedLoudness() const
+{
+    uint64_t count = 0;
+    double energy = 0;
+    for (const HistogramBin &bin : m_histogram)
+    {
+        count += bin.count;
+        energy += bin.energy;
+    }
+
+    if (!count)
+        return -HUGE_VAL;
+
+    double relativeGate = energyToLoudness(energy / count) + RELATIVE_GATE;
+    double relativeGateEnergy = loudnessToEnergy(relativeGate);
+
+    // The bin containing the relative gate is split, so look at the
+    // mean energy of its blocks to decide whether they pass.
+    count = 0;
+    energy = 0;
+    for (int i = histogramBin(relativeGate); i < HISTOGRAM_BINS; ++i)
+    {
+        const HistogramBin &bin = m_histogram[size_t(i)];
+        if (bin.count && bin.energy / bin.count >= relativeGateEnergy)
+        {
+            count += bin.count;
+            energy += bin.energy;
+        }
+    }
+
+    if (!count)
+        return -HUGE_VAL;
+
+    return energyToLoudness(energy / count);
+}
+
+} // namespace Recording
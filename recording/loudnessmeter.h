@@ -0,0 +1,82 @@
+#ifndef RECORDING_LOUDNESSMETER_H
+#define RECORDING_LOUDNESSMETER_H
+
+#include <cstdint>
+#include <vector>
+
+namespace Recording {
+
+/*
+ * Streaming loudness measurement according to EBU R128 / ITU-R BS.1770:
+ * K-weighting, momentary (400 ms) and short-term (3 s) loudness, and
+ * gated integrated loudness.
+ *
+ * All memory is allocated in configure(). The integrated loudness is
+ * kept in a histogram of 0.1 LU bins, so it needs the same amount of
+ * memory for a minute as for a whole day.
+ *
+ * Loudness values are in LUFS, -HUGE_VAL if there is nothing to report.
+ */
+class LoudnessMeter
+{
+public:
+    LoudnessMeter();
+
+    void configure(int sampleRate, int channels);
+
+    // Forget everything, including the integrated loudness
+    void reset();
+    // Restart the integrated loudness measurement only
+    void resetIntegrated();
+
+    void process(const float *samples, int64_t frames);
+
+    double momentaryLoudness() const;
+    double shortTermLoudness() const;
+    double integratedLoudness() const;
+
+private:
+    struct Biquad
+    {
+        double b0, b1, b2, a1, a2;
+    };
+
+    struct FilterState
+    {
+        double z1[2]; // one transposed direct form II state per stage
+        double z2[2];
+    };
+
+    // Channels == 0 means m_channels, the others are unrolled at compile time
+    template <int Channels>
+    void processFrames(const float *samples, int64_t frames);
+
+    void finishBlock();
+    double meanEnergy(int blocks) const;
+
+    int m_channels = 0;
+    int m_blockFrames = 0;   // 100 ms
+
+    Biquad m_stage[2];       // shelving pre-filter, RLB high pass
+    std::vector<FilterState> m_state;
+
+    double m_blockAccum = 0;
+    int m_blockPos = 0;
+
+    // energies of the last 30 blocks (3 s) for momentary and short-term loudness
+    std::vector<double> m_blocks;
+    int m_blockHead = 0;
+    int64_t m_blockCount = 0;
+
+    // gating blocks above the absolute threshold, for the integrated loudness
+    struct HistogramBin
+    {
+        uint64_t count;
+        double   energy;
+    };
+    std::vector<HistogramBin> m_histogram;
+};
+
+} // namespace Recording
+
+#endif // RECORDING_LOUDNESSMETER_H
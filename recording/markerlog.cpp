@@ -0,0 +1,30 @@
+#include "markerlog.h"
+
+namespace Recording {
+
+MarkerLog::MarkerLog(const QString &fileName, int sampleRate)
+    : m_file(fileName), m_sampleRate(sampleRate)
+{
+}
+
+MarkerLog::~MarkerLog()
+{
+    m_file.close();
+}
+
+void MarkerLog::addMarker(qint64 startFrame, qint64 lengthFrames, const QString &label)
+{
+    if (!m_file.isOpen() && !m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return;
+
+    QString line = QString("%1\t%2\t%3\n")
+            .arg(double(startFrame) / m_sampleRate, 0, 'f', 6)
+            .arg(double(startFrame + lengthFrames) / m_sampleRate, 0, 'f', 6)
+            .arg(label);
+
+    // markers are rare, so we can afford to push every one of them out immediately
+    m_file.write(line.toUtf8());
+    m_file.flush();
+}
+
+} // namespace Recording
@@ -0,0 +1,36 @@
+#ifndef RECORDING_MARKERLOG_H
+#define RECORDING_MARKERLOG_H
+
+#include <QString>
+#include <QFile>
+
+namespace Recording {
+
+/*
+ * Writes markers for a recording into a text file next to it, in the
+ * label track format used by Audacity (start, end and label separated
+ * by tabs, times in seconds).
+ *
+ * The file is only created once the first marker arrives, so recordings
+ * without anything noteworthy don't get an empty companion file.
+ */
+class MarkerLog
+{
+public:
+    MarkerLog(const QString &fileName, int sampleRate);
+    ~MarkerLog();
+
+    void addMarker(qint64 startFrame, qint64 lengthFrames, const QString &label);
+
+    QString errorString() const { return m_file.errorString(); }
+
+private:
+    QFile m_file;
+    int   m_sampleRate;
+
+    Q_DISABLE_COPY(MarkerLog)
+};
+
+} // namespace Recording
+
+#endif // RECORDING_MARKERLOG_H
@@ -0,0 +1,54 @@
+#include "prerollbuffer.h"
+
+#include <cstring>
+
+namespace Recording {
+
+void PreRollBuffer::configure(qint64 frames, int channels)
+{
+    if (frames != m_capacity || channels != m_channels)
+    {
+        m_data.reset(frames > 0 ? new float[size_t(frames * channels)] : nullptr);
+        m_capacity = qMax(qint64(0), frames);
+        m_channels = channels;
+    }
+
+    m_head = 0;
+    m_fill = 0;
+    m_written = 0;
+}
+
+void PreRollBuffer::write(const float *samples, qint64 frames)
+{
+    m_written += frames;
+
+    if (!m_capacity)
+        return;
+
+    // only the newest frames survive anyway
+    if (frames > m_capacity)
+    {
+        samples += (frames - m_capacity) * m_channels;
+        m_head = (m_head + frames - m_capacity) % m_capacity;
+        frames = m_capacity;
+    }
+
+    qint64 first = qMin(frames, m_capacity - m_head);
+    memcpy(m_data.get() + m_head * m_channels, samples, size_t(first * m_channels) * sizeof(float));
+    memcpy(m_data.get(), samples + first * m_channels, size_t((frames - first) * m_channels) * sizeof(float));
+
+    m_head = (m_head + frames) % m_capacity;
+    m_fill = qMin(m_capacity, m_fill + frames);
+}
+
+const float *PreRollBuffer::at(qint64 position, qint64 *frames) const
+{
+    Q_ASSERT(position >= begin() && position < end());
+
+    // m_head follows m_written around the buffer
+    const qint64 index = position % m_capacity;
+    *frames = qMin(*frames, qMin(end() - position, m_capacity - index));
+    return m_data.get() + index * m_channels;
+}
+
+} // namespace Recording
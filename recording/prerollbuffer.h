@@ -0,0 +1,51 @@
+#ifndef RECORDING_PREROLLBUFFER_H
+#define RECORDING_PREROLLBUFFER_H
+
+#include <QtGlobal>
+
+#include <memory>
+
+namespace Recording {
+
+/*
+ * The most recent audio, kept while we are not recording, so that a
+ * recording can start a few seconds before the button was pressed.
+ * While recording, it holds what the encoders didn't take yet.
+ *
+ * A plain circular buffer that overwrites the oldest frames, allocated
+ * once in configure(). Frames are addressed by their position, counted
+ * from configure() on. It is only used by the drain loop, so there is no
+ * locking, and the audio callback never sees it.
+ */
+class PreRollBuffer
+{
+public:
+    // Frees the buffer if frames is 0
+    void configure(qint64 frames, int channels);
+    void clear() { m_fill = 0; }
+
+    void write(const float *samples, qint64 frames);
+
+    qint64 frames() const { return m_fill; }
+
+    // Positions of the oldest stored frame and of the next one written
+    qint64 begin() const { return m_written - m_fill; }
+    qint64 end() const { return m_written; }
+
+    // The stored frame at position, which has to lie between begin() and end().
+    // Shortens frames to what follows it in one piece.
+    const float *at(qint64 position, qint64 *frames) const;
+
+private:
+    std::unique_ptr<float[]> m_data;
+    qint64 m_capacity { 0 };
+    int    m_channels { 2 };
+
+    qint64 m_head { 0 };  // where the next frame goes
+    qint64 m_fill { 0 };
+    qint64 m_written { 0 };
+};
+
+} // namespace Recording
+
+#endif // RECORDING_PREROLLBUFFER_H
@@ -0,0 +1,296 @@
+#include "realtime.h"
+
+#include <QCoreApplication>
+#include <QThread>
+
+#include <atomic>
+
+#if defined(Q_OS_UNIX)
+#  include <cerrno>
+#  include <pthread.h>
+#  include <sched.h>
+#  include <sys/mman.h>
+#endif
+
+#if defined(Q_OS_LINUX)
+#  include <QDBusConnection>
+#  include <QDBusInterface>
+#  include <QDBusMessage>
+#  include <QDBusReply>
+#  include <QMutex>
+#  include <csignal>
+#  include <sys/resource.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#if defined(Q_OS_WIN)
+#  include <windows.h>
+#endif
+
+namespace Recording {
+namespace Realtime {
+
+namespace {
+    // The smallest page size around, larger pages just get touched more than once
+    const size_t TOUCH_STRIDE = 4096;
+
+    std::atomic_bool timeLimitDemotion { false };
+    std::atomic_bool raiseFailure { false };
+
+    inline void setError(QString *errorString, const QString &message)
+    {
+        if (errorString)
+            *errorString = message;
+    }
+
+#if defined(Q_OS_LINUX)
+    // The thread rtkit raised last, the one to drop back at the soft time limit
+    std::atomic<pid_t> rtkitThread { 0 };
+    static_assert(std::atomic<pid_t>::is_always_lock_free, "used from a signal handler");
+
+    // The soft limit is reached, the hard one would kill us. Only
+    // async-signal-safe calls in here.
+    void handleTimeLimit(int)
+    {
+        const pid_t thread = rtkitThread.exchange(0);
+        if (!thread)
+            return;
+
+        sched_param param {};
+        sched_setscheduler(thread, SCHED_OTHER, &param);
+        timeLimitDemotion.store(true);
+    }
+
+    const QString RTKIT_SERVICE = QStringLiteral("org.freedesktop.RealtimeKit1");
+    const QString RTKIT_PATH = QStringLiteral("/org/freedesktop/RealtimeKit1");
+
+    // rtkit's limits don't change while it runs, so they are read and
+    // applied on the first raise only, and the later ones just ask
+    QMutex rtkitMutex;
+    bool rtkitReady = false;
+    int rtkitMaxPriority = 0;
+
+    // with rtkitMutex held
+    bool setUpRtkit(QString *errorString)
+    {
+        QDBusInterface rtkit(RTKIT_SERVICE, RTKIT_PATH, RTKIT_SERVICE, QDBusConnection::systemBus());
+        if (!rtkit.isValid())
+        {
+            setError(errorString, QCoreApplication::translate("Recording::Realtime",
+                     "no permission for realtime scheduling, and rtkit is not running"));
+            return false;
+        }
+
+        rtkitMaxPriority = rtkit.property("MaxRealtimePriority").toInt();
+
+        // rtkit only hands out realtime scheduling to processes that limit
+        // how long such a thread may run without blocking. The soft limit
+        // at half of that leaves room to drop back before the hard one.
+        const qlonglong maxRtTime = rtkit.property("RTTimeUSecMax").toLongLong();
+        rlimit limit;
+        if (maxRtTime > 0 && getrlimit(RLIMIT_RTTIME, &limit) == 0
+            && (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > rlim_t(maxRtTime)))
+        {
+            limit.rlim_max = rlim_t(maxRtTime);
+            limit.rlim_cur = limit.rlim_max / 2;
+            setrlimit(RLIMIT_RTTIME, &limit);
+        }
+
+        struct sigaction action {};
+        action.sa_handler = &handleTimeLimit;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGXCPU, &action, nullptr);
+
+        rtkitReady = true;
+        return true;
+    }
+
+    bool raiseThroughRtkit(int priority, QString *errorString)
+    {
+        {
+            QMutexLocker locker(&rtkitMutex);
+            if (!rtkitReady && !setUpRtkit(errorString))
+                return false;
+            if (rtkitMaxPriority > 0)
+                priority = qMin(priority, rtkitMaxPriority);
+        }
+
+        // a plain call, QDBusInterface would introspect the service every time
+        const pid_t thread = pid_t(syscall(SYS_gettid));
+        QDBusMessage call = QDBusMessage::createMethodCall(RTKIT_SERVICE, RTKIT_PATH, RTKIT_SERVICE,
+                                                           QStringLiteral("MakeThreadRealtime"));
+        call << quint64(thread) << quint32(priority);
+
+        QDBusReply<void> reply = QDBusConnection::systemBus().call(call);
+        if (!reply.isValid())
+        {
+            setError(errorString, QCoreApplication::translate("Recording::Realtime", "rtkit refused: %1")
+                     .arg(reply.error().message()));
+            return false;
+        }
+
+        rtkitThread.store(thread);
+        return true;
+    }
+#endif
+}
+
+bool raiseCurrentThread(int priority, QString *errorString)
+{
+#if defined(Q_OS_UNIX)
+    sched_param param {};
+    param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), priority, sched_get_priority_max(SCHED_FIFO));
+
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err == 0)
+        return true;
+
+#  if defined(Q_OS_LINUX)
+    if (err == EPERM)
+        return raiseThroughRtkit(param.sched_priority, errorString);
+#  endif
+
+    setError(errorString, qt_error_string(err));
+    return false;
+#elif defined(Q_OS_WIN)
+    Q_UNUSED(priority)
+    Q_UNUSED(errorString)
+
+    // the highest a normal process can get without special rights
+    QThread::currentThread()->setPriority(QThread::TimeCriticalPriority);
+    return true;
+#else
+    Q_UNUSED(priority)
+    setError(errorString, QCoreApplication::translate("Recording::Realtime", "not supported on this system"));
+    return false;
+#endif
+}
+
+void lowerCurrentThread()
+{
+#if defined(Q_OS_LINUX)
+    // nothing to drop back anymore
+    pid_t self = pid_t(syscall(SYS_gettid));
+    rtkitThread.compare_exchange_strong(self, 0);
+#endif
+
+#if defined(Q_OS_UNIX)
+    sched_param param {};
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#elif defined(Q_OS_WIN)
+    QThread::currentThread()->setPriority(QThread::NormalPriority);
+#endif
+}
+
+int currentThreadPriority()
+{
+#if defined(Q_OS_UNIX)
+    int policy;
+    sched_param param {};
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0)
+        return 0;
+    return policy == SCHED_FIFO || policy == SCHED_RR ? param.sched_priority : 0;
+#elif defined(Q_OS_WIN)
+    return QThread::currentThread()->priority() == QThread::TimeCriticalPriority ? 1 : 0;
+#else
+    return 0;
+#endif
+}
+
+bool takeTimeLimitDemotion()
+{
+    return timeLimitDemotion.exchange(false);
+}
+
+bool takeRaiseFailure()
+{
+    return raiseFailure.exchange(false);
+}
+
+NormalPriorityScope::NormalPriorityScope(bool active)
+{
+    if (active)
+        m_priority = currentThreadPriority();
+    if (m_priority > 0)
+        lowerCurrentThread();
+}
+
+NormalPriorityScope::~NormalPriorityScope()
+{
+    // nobody to tell from a destructor, the owner polls takeRaiseFailure()
+    if (m_priority > 0 && !raiseCurrentThread(m_priority))
+        raiseFailure.store(true);
+}
+
+void prefault(void *data, size_t size)
+{
+    if (!data || !size)
+        return;
+
+    // a write, so that copy-on-write pages are split up now as well
+    volatile char *bytes = static_cast<volatile char *>(data);
+    for (size_t i = 0; i < size; i += TOUCH_STRIDE)
+        bytes[i] = bytes[i];
+    bytes[size - 1] = bytes[size - 1];
+}
+
+bool MemoryLock::lock(void *data, size_t size, QString *errorString)
+{
+    unlock();
+
+    if (!data || !size)
+        return true;
+
+#if defined(Q_OS_UNIX)
+    if (mlock(data, size) != 0)
+    {
+        if (errno == ENOMEM || errno == EPERM)
+            setError(errorString, QCoreApplication::translate("Recording::Realtime", "the limit for locked memory is too low (ulimit -l)"));
+        else
+            setError(errorString, qt_error_string(errno));
+        return false;
+    }
+#elif defined(Q_OS_WIN)
+    if (!VirtualLock(data, size))
+    {
+        // Only as much as the minimum working set can be locked, so grow it and try once more
+        SIZE_T minimum, maximum;
+        const HANDLE process = GetCurrentProcess();
+        if (GetLastError() != ERROR_WORKING_SET_QUOTA
+            || !GetProcessWorkingSetSize(process, &minimum, &maximum)
+            || !SetProcessWorkingSetSize(process, minimum + size, qMax(maximum, minimum + size))
+            || !VirtualLock(data, size))
+        {
+            setError(errorString, qt_error_string(int(GetLastError())));
+            return false;
+        }
+    }
+#else
+    setError(errorString, QCoreApplication::translate("Recording::Realtime", "not supported on this system"));
+    return false;
+#endif
+
+    m_data = data;
+    m_size = size;
+    return true;
+}
+
+void MemoryLock::unlock()
+{
+    if (!m_data)
+        return;
+
+#if defined(Q_OS_UNIX)
+    munlock(m_data, m_size);
+#elif defined(Q_OS_WIN)
+    VirtualUnlock(m_data, m_size);
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+} // namespace Realtime
+} // namespace Recording
@@ -0,0 +1,100 @@
+#ifndef RECORDING_REALTIME_H
+#define RECORDING_REALTIME_H
+
+#include <QMetaType>
+#include <QString>
+
+#include <cstddef>
+
+namespace Recording {
+
+// What the realtime mode got, as reported by the Coordinator
+struct RealtimeStatus
+{
+    bool enabled = false;       // asked for
+    bool priority = false;      // the drain loop runs with realtime priority
+    bool memoryLocked = false;  // the capture ring buffer is locked into RAM
+    QString problem;            // why something is missing, empty if all went well
+};
+
+/*
+ * Keeps the audio path off the disk and ahead of the rest of the machine.
+ *
+ * On Linux, an unprivileged process gets realtime scheduling through
+ * rtkit on the system bus. rtkit insists on RLIMIT_RTTIME, the time a
+ * realtime thread may run without blocking. Past the soft limit the
+ * thread raised last is dropped back to normal scheduling, the hard
+ * limit further up would kill the process. Heavy work belongs into a
+ * NormalPriorityScope therefore.
+ *
+ * Locking memory is limited by RLIMIT_MEMLOCK on Linux (ulimit -l), by
+ * the working set size on Windows.
+ *
+ * The error strings are short translated fragments, to be put into a
+ * message by the caller.
+ */
+namespace Realtime {
+
+// Gives the calling thread realtime priority, 1 being the lowest.
+// Elsewhere than Linux the priority is only a hint.
+bool raiseCurrentThread(int priority, QString *errorString = nullptr);
+
+// Back to normal scheduling
+void lowerCurrentThread();
+
+// The realtime priority of the calling thread, 0 if it has none
+int currentThreadPriority();
+
+// Whether a thread was dropped back for running into the time limit,
+// clears the flag
+bool takeTimeLimitDemotion();
+
+// Whether a NormalPriorityScope could not raise its thread again at the
+// end, clears the flag
+bool takeRaiseFailure();
+
+// Runs the calling thread with normal scheduling while it lives, if it
+// had realtime priority, and raises it again afterwards
+class NormalPriorityScope
+{
+public:
+    explicit NormalPriorityScope(bool active = true);
+    ~NormalPriorityScope();
+
+    NormalPriorityScope(const NormalPriorityScope &) = delete;
+    NormalPriorityScope &operator=(const NormalPriorityScope &) = delete;
+
+private:
+    int m_priority { 0 };   // to go back to
+};
+
+// Writes to every page, so that none of them faults on its first use.
+// Only while no other thread uses the memory.
+void prefault(void *data, size_t size);
+
+// Keeps a block of memory in RAM while it lives. The block must outlive it.
+class MemoryLock
+{
+public:
+    MemoryLock() = default;
+    ~MemoryLock() { unlock(); }
+
+    bool lock(void *data, size_t size, QString *errorString = nullptr);
+    void unlock();
+
+    bool isLocked() const { return m_data != nullptr; }
+
+    MemoryLock(const MemoryLock &) = delete;
+    MemoryLock &operator=(const MemoryLock &) = delete;
+
+private:
+    void *m_data { nullptr };
+    size_t m_size { 0 };
+};
+
+} // namespace Realtime
+} // namespace Recording
+
+Q_DECLARE_METATYPE(Recording::RealtimeStatus)
+
+#endif // RECORDING_REALTIME_H
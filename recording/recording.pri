@@ -0,0 +1,75 @@
+# The recording pipeline without its widgets, shared by the application
+# and the headless benchmark in bench/
+
+CONFIG    += link_pkgconfig
+PKGCONFIG += portaudio-2.0 flac
+
+LIBS += -lmp3lame
+
+# rtkit, for realtime scheduling without root
+linux: QT += dbus
+
+# CONFIG+=no_callback_timing leaves the timing out of the audio callback
+no_callback_timing: DEFINES += RECORDING_NO_CALLBACK_TIMING
+
+INCLUDEPATH += $$PWD/..
+
+include($$PWD/../util/util.pri)
+
+SOURCES += \
+    $$PWD/audiobackend.cpp \
+    $$PWD/audiosource.cpp \
+    $$PWD/audiowakeup.cpp \
+    $$PWD/auxiliaryinput.cpp \
+    $$PWD/bufferedfilewriter.cpp \
+    $$PWD/callbacktiming.cpp \
+    $$PWD/coordinator.cpp \
+    $$PWD/encoderregistry.cpp \
+    $$PWD/encoderstream.cpp \
+    $$PWD/encoderworker.cpp \
+    $$PWD/flacencoderstream.cpp \
+    $$PWD/gainkernels.cpp \
+    $$PWD/lameencoderstream.cpp \
+    $$PWD/loudnessmeter.cpp \
+    $$PWD/markerlog.cpp \
+    $$PWD/recordingjournal.cpp \
+    $$PWD/segmentedstream.cpp \
+    $$PWD/silencedetector.cpp \
+    $$PWD/levelcalculator.cpp \
+    $$PWD/levelkernels.cpp \
+    $$PWD/prerollbuffer.cpp \
+    $$PWD/realtime.cpp \
+    $$PWD/truepeakmeter.cpp \
+    $$PWD/virtualaudiobackend.cpp \
+    $$PWD/wavencoderstream.cpp \
+    $$PWD/external/pa_ringbuffer.c
+
+HEADERS += \
+    $$PWD/audiobackend.h \
+    $$PWD/audiosource.h \
+    $$PWD/audiowakeup.h \
+    $$PWD/auxiliaryinput.h \
+    $$PWD/bufferedfilewriter.h \
+    $$PWD/callbacktiming.h \
+    $$PWD/coordinator.h \
+    $$PWD/encoderregistry.h \
+    $$PWD/encoderstream.h \
+    $$PWD/encoderworker.h \
+    $$PWD/flacencoderstream.h \
+    $$PWD/gainkernels.h \
+    $$PWD/lameencoderstream.h \
+    $$PWD/loudnessmeter.h \
+    $$PWD/markerlog.h \
+    $$PWD/prerollbuffer.h \
+    $$PWD/realtime.h \
+    $$PWD/recordingjournal.h \
+    $$PWD/segmentedstream.h \
+    $$PWD/silencedetector.h \
+    $$PWD/streamformat.h \
+    $$PWD/truepeakmeter.h \
+    $$PWD/virtualaudiobackend.h \
+    $$PWD/wavencoderstream.h \
+    $$PWD/levelcalculator.h \
+    $$PWD/levelkernels.h \
+    $$PWD/external/pa_memorybarrier.h \
+    $$PWD/external/pa_ringbuffer.h
@@ -0,0 +1,68 @@
+#include "recordingjournal.h"
+
+#include "wavencoderstream.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+
+namespace Recording {
+
+RecordingJournal::RecordingJournal(const QString &fileName, const QStringList &files)
+    : m_fileName(fileName), m_files(files)
+{
+    write();
+}
+
+void RecordingJournal::addFile(const QString &file)
+{
+    m_files << file;
+    write();
+}
+
+void RecordingJournal::write()
+{
+    QSettings journal(m_fileName, QSettings::IniFormat);
+    journal.setValue("Files", QVariant::fromValue(m_files));
+    journal.sync();
+}
+
+RecordingJournal::~RecordingJournal()
+{
+    QFile::remove(m_fileName);
+}
+
+QStringList RecordingJournal::recover(const QString &dir)
+{
+    QStringList recovered;
+
+    QDir d(dir);
+    for (const QString &name : d.entryList(QStringList("*.journal"), QDir::Files))
+    {
+        QString journalFile = d.filePath(name);
+
+        {
+            QSettings journal(journalFile, QSettings::IniFormat);
+            for (const QString &file : journal.value("Files").toStringList())
+            {
+                if (!QFile::exists(file))
+                    continue;
+
+                // MP3 and FLAC are playable as they are, only the WAV header
+                // might still claim a length from the last sync
+                if (QFileInfo(file).suffix().compare("wav", Qt::CaseInsensitive) == 0
+                        && !WavEncoderStream::repairFile(file))
+                    continue;
+
+                recovered << file;
+            }
+        }
+
+        QFile::remove(journalFile);
+    }
+
+    return recovered;
+}
+
+} // namespace Recording
@@ -0,0 +1,37 @@
+#ifndef RECORDING_RECORDINGJOURNAL_H
+#define RECORDING_RECORDINGJOURNAL_H
+
+#include <QString>
+#include <QStringList>
+
+namespace Recording {
+
+/*
+ * A small file next to a running recording that lists the files it
+ * writes. It is removed again when the recording ends properly, so a
+ * journal found later belongs to a recording that was interrupted by a
+ * crash or power loss, and recover() can finish its files.
+ */
+class RecordingJournal
+{
+public:
+    RecordingJournal(const QString &fileName, const QStringList &files = QStringList());
+    ~RecordingJournal();
+
+    void addFile(const QString &file);
+
+    // Finishes the recordings of all journals in dir and returns their files
+    static QStringList recover(const QString &dir);
+
+private:
+    void write();
+
+    QString m_fileName;
+    QStringList m_files;
+
+    Q_DISABLE_COPY(RecordingJournal)
+};
+
+} // namespace Recording
+
+#endif // RECORDING_RECORDINGJOURNAL_H
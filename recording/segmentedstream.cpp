@@ -0,0 +1,177 @@
+#include "segmentedstream.h"
+
+#include "bufferedfilewriter.h"
+
+#include <QFile>
+
+namespace Recording {
+
+SegmentedStream::SegmentedStream(const EncoderType &type, const QString &fileNamePattern, QObject *parent)
+    : EncoderStream(parent), m_type(type), m_pattern(fileNamePattern)
+{
+}
+
+SegmentedStream::~SegmentedStream()
+{
+    close();
+}
+
+bool SegmentedStream::open(const EncoderTags &tags, const StreamFormat &format, QIODevice *)
+{
+    m_tags = tags;
+    m_format = format;
+    m_number = 1;
+    m_framesWritten = 0;
+    m_splitAt.store(-1);
+    m_segmentBytes.store(0);
+
+    if (!prepare(m_current, m_number))
+        return false;
+
+    m_open = true;
+    emit segmentStarted(m_current.file->fileName());
+
+    // Not fatal yet, switchSegment() tries again
+    prepare(m_next, m_number + 1);
+
+    return true;
+}
+
+bool SegmentedStream::prepare(Segment &segment, int number)
+{
+    QString fileName = m_pattern.arg(number, 3, 10, QChar('0'));
+
+    segment.file = std::make_unique<BufferedFileWriter>(fileName);
+    if (!segment.file->open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        error(tr("%1: Could not open file %2: %3").arg(m_type.name, fileName, segment.file->errorString()));
+        segment = Segment();
+        return false;
+    }
+
+    // The encoders live on whatever thread we are on, pass their messages on right away
+    segment.stream.reset(m_type.create());
+    QObject::connect(segment.stream.get(), &EncoderStream::error, this, &EncoderStream::error, Qt::DirectConnection);
+    QObject::connect(segment.stream.get(), &EncoderStream::warning, this, &EncoderStream::warning, Qt::DirectConnection);
+
+    EncoderTags tags = m_tags;
+    tags.title = tr("%1 (part %2)").arg(m_tags.title).arg(number);
+
+    if (!segment.stream->open(tags, m_format, segment.file.get()))
+    {
+        finish(segment, false);
+        return false;
+    }
+
+    return true;
+}
+
+void SegmentedStream::finish(Segment &segment, bool keep)
+{
+    if (!segment.file)
+        return;
+
+    QString fileName = segment.file->fileName();
+
+    segment.stream->close();
+    segment.file->close();
+    segment = Segment();
+
+    if (!keep)
+        QFile::remove(fileName);
+}
+
+bool SegmentedStream::switchSegment()
+{
+    if (!m_next.stream && !prepare(m_next, m_number + 1))
+        return false;
+
+    std::swap(m_current, m_next);
+    ++m_number;
+    m_segmentBytes.store(0, std::memory_order_relaxed);
+    emit segmentStarted(m_current.file->fileName());
+
+    // the old file may take a moment, but the queue in front of us has room
+    finish(m_next, true);
+    prepare(m_next, m_number + 1);
+
+    return true;
+}
+
+qint64 SegmentedStream::writeAudio(float *samples, qint64 count)
+{
+    if (!m_open)
+        return -1;
+
+    const qint64 total = count;
+    const qint64 split = m_splitAt.load();
+
+    if (split >= 0 && split < m_framesWritten + count)
+    {
+        qint64 before = qMax(qint64(0), split - m_framesWritten);
+        if (before && m_current.stream->writeAudio(samples, before) < 0)
+        {
+            close();
+            return -1;
+        }
+
+        m_framesWritten += before;
+        samples += before * m_format.channels;
+        count -= before;
+
+        if (!switchSegment())
+        {
+            close();
+            return -1;
+        }
+
+        // only now, so the drain loop never sees the old file's size without a pending split
+        m_splitAt.store(-1);
+    }
+
+    if (count && m_current.stream->writeAudio(samples, count) < 0)
+    {
+        close();
+        return -1;
+    }
+
+    m_framesWritten += count;
+    m_segmentBytes.store(m_current.file->size(), std::memory_order_relaxed);
+
+    return total;
+}
+
+void SegmentedStream::close()
+{
+    if (!m_open)
+        return;
+
+    finish(m_current, true);
+    finish(m_next, false);
+
+    m_open = false;
+}
+
+void SegmentedStream::discard()
+{
+    if (!m_open)
+        return;
+
+    finish(m_current, false);
+    finish(m_next, false);
+
+    m_open = false;
+}
+
+bool SegmentedStream::sync()
+{
+    return !m_open || m_current.stream->sync();
+}
+
+void SegmentedStream::splitAt(qint64 frame)
+{
+    qint64 none = -1;
+    m_splitAt.compare_exchange_strong(none, frame);
+}
+
+} // namespace Recording
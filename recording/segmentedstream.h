@@ -0,0 +1,83 @@
+#ifndef RECORDING_SEGMENTEDSTREAM_H
+#define RECORDING_SEGMENTEDSTREAM_H
+
+#include <atomic>
+#include <memory>
+
+#include "encoderstream.h"
+#include "encoderregistry.h"
+#include "streamformat.h"
+
+namespace Recording {
+
+class BufferedFileWriter;
+
+/*
+ * Writes one format into a series of files, switching to the next file
+ * at a frame chosen by the drain loop with splitAt(). Every sample ends
+ * up in exactly one file.
+ *
+ * The next file and encoder are always opened in advance, right after
+ * the previous switch, so a switch only swaps them and then closes the
+ * old ones. open() creates the first two files on the thread calling it,
+ * usually the Coordinator's. The later ones are prepared, and the old
+ * ones closed at a switch, on the thread running the stream.
+ *
+ * Opens its own files, the output device passed to open() is ignored.
+ */
+class SegmentedStream : public EncoderStream
+{
+    Q_OBJECT
+public:
+    // fileNamePattern gets the segment number as %1
+    SegmentedStream(const EncoderType &type, const QString &fileNamePattern, QObject *parent = nullptr);
+    ~SegmentedStream();
+
+    bool open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output) override;
+    qint64 writeAudio(float *samples, qint64 count) override;
+    void close() override;
+
+    // Closes and removes every file, for a recording that never started
+    void discard();
+    bool sync() override;
+
+    // Called from the drain loop: the current file ends after this many frames
+    // of the whole stream. Ignored while the previous split is still pending.
+    void splitAt(qint64 frame);
+    bool splitPending() const { return m_splitAt.load() >= 0; }
+
+    // Size of the current file so far, safe to call from any thread
+    qint64 segmentBytes() const { return m_segmentBytes.load(std::memory_order_relaxed); }
+
+signals:
+    void segmentStarted(const QString &fileName);
+
+private:
+    struct Segment
+    {
+        std::unique_ptr<BufferedFileWriter> file;
+        std::unique_ptr<EncoderStream> stream;
+    };
+
+    bool prepare(Segment &segment, int number);
+    void finish(Segment &segment, bool keep);
+    bool switchSegment();
+
+    EncoderType  m_type;
+    QString      m_pattern;
+    EncoderTags  m_tags;
+    StreamFormat m_format;
+
+    Segment m_current;
+    Segment m_next;
+    int     m_number { 0 };
+    bool    m_open { false };
+
+    qint64 m_framesWritten { 0 };
+    std::atomic<qint64> m_splitAt { -1 };
+    std::atomic<qint64> m_segmentBytes { 0 };
+};
+
+} // namespace Recording
+
+#endif // RECORDING_SEGMENTEDSTREAM_H
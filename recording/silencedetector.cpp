@@ -0,0 +1,99 @@
+#include "silencedetector.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Recording {
+
+namespace {
+    double fromDb(double db) { return std::pow(10.0, db / 10.0); }
+
+    // relative to the noise floor: speech starts above ONSET, ends below RELEASE
+    const double ONSET_RATIO = fromDb(12.0);
+    const double RELEASE_RATIO = fromDb(6.0);
+
+    // Nothing below this is speech, nothing above that is background noise
+    const double MIN_SPEECH_LEVEL = fromDb(-60.0);
+    const double MAX_NOISE_FLOOR = fromDb(-35.0);
+
+    const int ONSET_WINDOWS = 3;
+    const double HANGOVER_SECONDS = 0.3;
+}
+
+void SilenceDetector::configure(int sampleRate, int channels, double minSilenceSeconds)
+{
+    m_channels = channels;
+    m_windowFrames = qMax(1, sampleRate / 100);
+    m_minSilenceFrames = qint64(minSilenceSeconds * sampleRate);
+    m_hangoverWindows = qMax(1, int(HANGOVER_SECONDS * sampleRate / m_windowFrames));
+    m_windowsPerBlock = qMax(1, int(sampleRate / m_windowFrames));
+
+    reset();
+}
+
+void SilenceDetector::reset()
+{
+    m_windowSum = 0;
+    m_windowPos = 0;
+    std::fill(m_blockMin, m_blockMin + FLOOR_BLOCKS, HUGE_VAL);
+    m_block = 0;
+    m_blockWindows = 0;
+    m_loudWindows = 0;
+    m_quietWindows = 0;
+    m_speech = false;
+    m_silentFrames = 0;
+}
+
+void SilenceDetector::process(const float *samples, qint64 frames)
+{
+    qint64 i = 0;
+    while (i < frames)
+    {
+        qint64 n = qMin(frames - i, m_windowFrames - m_windowPos);
+        const float *s = samples + i * m_channels;
+        const qint64 count = n * m_channels;
+
+        double sum = 0;
+        for (qint64 j = 0; j < count; ++j)
+            sum += double(s[j]) * s[j];
+
+        m_windowSum += sum;
+        m_windowPos += n;
+        i += n;
+
+        if (m_windowPos == m_windowFrames)
+            finishWindow();
+    }
+}
+
+void SilenceDetector::finishWindow()
+{
+    double level = m_windowSum / double(m_windowFrames * m_channels);
+    m_windowSum = 0;
+    m_windowPos = 0;
+
+    m_blockMin[m_block] = std::min(m_blockMin[m_block], level);
+    m_noiseFloor = std::min(*std::min_element(m_blockMin, m_blockMin + FLOOR_BLOCKS), MAX_NOISE_FLOOR);
+
+    if (++m_blockWindows == m_windowsPerBlock)
+    {
+        m_block = (m_block + 1) % FLOOR_BLOCKS;
+        m_blockMin[m_block] = HUGE_VAL;
+        m_blockWindows = 0;
+    }
+
+    bool loud = level > std::max(m_noiseFloor * ONSET_RATIO, MIN_SPEECH_LEVEL);
+    bool quiet = level < std::max(m_noiseFloor * RELEASE_RATIO, MIN_SPEECH_LEVEL);
+
+    m_loudWindows = loud ? m_loudWindows + 1 : 0;
+    m_quietWindows = quiet ? m_quietWindows + 1 : 0;
+
+    if (!m_speech && m_loudWindows >= ONSET_WINDOWS)
+        m_speech = true;
+    else if (m_speech && m_quietWindows >= m_hangoverWindows)
+        m_speech = false;
+
+    m_silentFrames = m_speech ? 0 : m_silentFrames + m_windowFrames;
+}
+
+} // namespace Recording
@@ -0,0 +1,64 @@
+#ifndef RECORDING_SILENCEDETECTOR_H
+#define RECORDING_SILENCEDETECTOR_H
+
+#include <QtGlobal>
+
+namespace Recording {
+
+/*
+ * Tells speech (or anything else worth keeping) from silence, incrementally
+ * on 10 ms windows of the drained audio.
+ *
+ * The threshold follows the background noise: the noise floor is the
+ * quietest window of the last few seconds (minimum statistics over one
+ * second blocks), so a fan or a noisy room doesn't count as speech for
+ * long, while the short gaps between words keep it down. Speech starts when a
+ * few windows in a row are clearly above the floor and only ends after
+ * the level has stayed near the floor for the hangover time, so short
+ * pauses between words don't count as silence.
+ *
+ * Constant memory, one multiply-add per sample plus a little work per window.
+ */
+class SilenceDetector
+{
+public:
+    void configure(int sampleRate, int channels, double minSilenceSeconds = 0.5);
+    void reset();
+
+    void process(const float *samples, qint64 frames);
+
+    bool isSpeech() const { return m_speech; }
+
+    // Frames since the last speech ended, 0 during speech
+    qint64 silentFrames() const { return m_silentFrames; }
+
+    // quiet for at least the minimum silence duration
+    bool isSilent() const { return !m_speech && m_silentFrames >= m_minSilenceFrames; }
+
+private:
+    void finishWindow();
+
+    int    m_channels { 2 };
+    qint64 m_windowFrames { 480 };
+    qint64 m_minSilenceFrames { 24000 };
+    int    m_hangoverWindows { 30 };
+
+    double m_windowSum { 0 };
+    qint64 m_windowPos { 0 };
+
+    // minimum window levels (mean square) of the last few one second blocks
+    static const int FLOOR_BLOCKS = 5;
+    double m_blockMin[FLOOR_BLOCKS];
+    int    m_block { 0 };
+    int    m_blockWindows { 0 };
+    int    m_windowsPerBlock { 100 };
+    double m_noiseFloor { 0 };
+    int    m_loudWindows { 0 };    // in a row, above the onset threshold
+    int    m_quietWindows { 0 };   // in a row, below the release threshold
+    bool   m_speech { false };
+    qint64 m_silentFrames { 0 };
+};
+
+} // namespace Recording
+
+#endif // RECORDING_SILENCEDETECTOR_H
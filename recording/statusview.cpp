@@ -1,8 +1,16 @@
 #include "statusview.h"
 #include "ui_recordingstatusview.h"
 
+#include "coordinator.h"
+#include "levelcalculator.h"
+#include "util/misc.h"
+
+#include <QLabel>
 #include <QTimer>
 
+#include <climits>
+#include <cmath>
+
 namespace Recording {
 
 StatusView::StatusView(QWidget *parent) :
@@ -10,12 +18,14 @@ StatusView::StatusView(QWidget *parent) :
     ui(new Ui::RecordingStatusView)
 {
     ui->setupUi(this);
+    ui->wChannelMeters->setVisible(false);
 
     m_blinkTimer = new QTimer(this);
     m_blinkTimer->setInterval(1000);
     QObject::connect(m_blinkTimer, &QTimer::timeout, this, &StatusView::blink);
 
-    handleStatusUpdate(0, 0, false, 0);
+    handleStatusUpdate(Levels(), false, 0);
+    handleDropoutStats(DropoutStats());
 }
 
 StatusView::~StatusView()
@@ -23,10 +33,71 @@ StatusView::~StatusView()
     delete ui;
 }
 
-void StatusView::handleStatusUpdate(float levelL, float levelR, bool isRecording, qint64 sampleCount)
+namespace {
+    // further channels are shown this many to a row
+    const int METERS_PER_ROW = 4;
+
+    QString formatLoudness(double lufs)
+    {
+        if (std::isinf(lufs))
+            return QStringLiteral("-\u221e");
+
+        return QString::number(lufs, 'f', 1);
+    }
+
+    QString formatDb(float linear)
+    {
+        if (linear <= 0.0f)
+            return QStringLiteral("-\u221e");
+
+        return QString::number(20.0 * std::log10(linear), 'f', 1);
+    }
+}
+
+void StatusView::handleStatusUpdate(const Levels &levels, bool isRecording, qint64 sampleCount)
 {
-    ui->meterL->setValue(levelL);
-    ui->meterR->setValue(levelR);
+    ui->meterL->setValue(levels.peak[0]);
+    ui->meterR->setValue(levels.peak[1]);
+    ui->meterL->setPeakHold(levels.peakHold[0]);
+    ui->meterR->setPeakHold(levels.peakHold[1]);
+
+    for (int i = 0; i < m_channelMeters.size() && i + 2 < levels.channels; ++i)
+    {
+        m_channelMeters[i]->setValue(levels.peak[i + 2]);
+        m_channelMeters[i]->setPeakHold(levels.peakHold[i + 2]);
+    }
+
+    ui->lLoudness->setText(tr("M %1  S %2  I %3 LUFS")
+                               .arg(formatLoudness(levels.momentaryLoudness))
+                               .arg(formatLoudness(levels.shortTermLoudness))
+                               .arg(formatLoudness(levels.integratedLoudness)));
+    if (levels.channels > 2)
+    {
+        QStringList lines;
+        for (int c = 0; c < levels.channels; ++c)
+            lines << tr("Channel %1: true peak %2 dBTP, held %3 dBTP, RMS %4 dBFS, %5 clipped")
+                         .arg(c + 1)
+                         .arg(formatDb(levels.truePeak[c]))
+                         .arg(formatDb(levels.peakHold[c]))
+                         .arg(formatDb(levels.rms[c]))
+                         .arg(levels.clipped[c]);
+        ui->lLoudness->setToolTip(lines.join(QLatin1Char('\n')));
+    }
+    else
+    {
+        ui->lLoudness->setToolTip(tr("True peak: L %1 dBTP, R %2 dBTP\n"
+                                     "Peak hold: L %3 dBTP, R %4 dBTP\n"
+                                     "RMS: L %5 dBFS, R %6 dBFS\n"
+                                     "Clipped samples: L %7, R %8")
+                                      .arg(formatDb(levels.truePeak[0]))
+                                      .arg(formatDb(levels.truePeak[1]))
+                                      .arg(formatDb(levels.peakHold[0]))
+                                      .arg(formatDb(levels.peakHold[1]))
+                                      .arg(formatDb(levels.rms[0]))
+                                      .arg(formatDb(levels.rms[1]))
+                                      .arg(levels.clipped[0])
+                                      .arg(levels.clipped[1]));
+    }
 
     if (isRecording)
     {
@@ -34,15 +105,7 @@ void StatusView::handleStatusUpdate(float levelL, float levelR, bool isRecording
         if (!m_blinkTimer->isActive())
             m_blinkTimer->start();
 
-        qint64 samples = sampleCount;
-        qint64 seconds = (samples / 48000) % 60;
-        qint64 minutes = (samples / 48000 / 60) % 60;
-        qint64 hours = samples / 48000 / 60 / 60;
-
-        ui->lTime->setText(QString("%1:%2:%3")
-                              .arg(hours)
-                              .arg(minutes, 2, 10, QChar('0'))
-                              .arg(seconds, 2, 10, QChar('0')));
+        ui->lTime->setText(Util::formatTime(uint64_t(sampleCount), uint64_t(m_format.sampleRate)));
     }
     else
     {
@@ -54,6 +117,91 @@ void StatusView::handleStatusUpdate(float levelL, float levelR, bool isRecording
     }
 }
 
+void StatusView::handleDropoutStats(const DropoutStats &stats)
+{
+    m_lostFrames = stats.droppedFrames + stats.encoderDroppedFrames;
+    m_inputOverflows = stats.inputOverflows;
+
+    m_dropoutDetails = tr("Frames lost in the capture buffer: %1\n"
+                          "Frames lost in the encoder queue: %2\n"
+                          "Input overflows reported by the driver: %3\n"
+                          "Monitor output underflows: %4\n"
+                          "Highest capture buffer fill level: %5%")
+                           .arg(stats.droppedFrames)
+                           .arg(stats.encoderDroppedFrames)
+                           .arg(stats.inputOverflows)
+                           .arg(stats.outputUnderflows)
+                           .arg(int(stats.ringBufferPeakFill * 100));
+
+    updateDropouts();
+}
+
+void StatusView::handleCallbackTiming(const CallbackTimingSnapshot &timing)
+{
+    m_timing = timing;
+    updateDropouts();
+}
+
+void StatusView::updateDropouts()
+{
+    QString text;
+    if (m_lostFrames || m_inputOverflows)
+    {
+        text = tr("Dropouts: %1 ms lost, %2 driver overflows")
+                   .arg(m_format.framesToMsecs(m_lostFrames))
+                   .arg(m_inputOverflows);
+    }
+    else
+    {
+        text = tr("No dropouts");
+    }
+
+    // a late callback is where dropouts come from, so it's worth a mention even without any
+    if (m_timing.overBudget)
+        text += tr(", %n late callback(s)", nullptr, int(qMin<qint64>(m_timing.overBudget, INT_MAX)));
+
+    ui->lDropouts->setText(text);
+
+    QString toolTip = m_dropoutDetails;
+    if (m_timing.callbacks)
+    {
+        auto ms = [](qint64 nanos) { return QString::number(nanos / 1e6, 'f', 2); };
+        toolTip += tr("\nAudio callback: typically %1 ms, 99.9% below %2 ms, at most %3 ms of %4 ms\n"
+                      "Audio callback load: %5%, %6 of %7 callbacks took too long")
+                       .arg(ms(m_timing.p50Nanos), ms(m_timing.p999Nanos), ms(m_timing.maxNanos), ms(m_timing.budgetNanos))
+                       .arg(qRound(m_timing.load * 100))
+                       .arg(m_timing.overBudget)
+                       .arg(m_timing.callbacks);
+    }
+    ui->lDropouts->setToolTip(toolTip);
+}
+
+void StatusView::setStreamFormat(const StreamFormat &format)
+{
+    m_format = format;
+
+    // The first two channels keep the big meters, the others get small ones below
+    const bool multichannel = format.channels > 2;
+    ui->labelL->setText(multichannel ? QStringLiteral("1") : tr("L"));
+    ui->lebelR->setText(multichannel ? QStringLiteral("2") : tr("R"));
+
+    qDeleteAll(ui->wChannelMeters->findChildren<QWidget *>(QString(), Qt::FindDirectChildrenOnly));
+    m_channelMeters.clear();
+
+    for (int c = 2; c < format.channels; ++c)
+    {
+        int row = (c - 2) / METERS_PER_ROW;
+        int column = (c - 2) % METERS_PER_ROW * 2;
+
+        FancyProgressBar *meter = new FancyProgressBar(ui->wChannelMeters);
+        ui->channelMeterLayout->addWidget(new QLabel(QString::number(c + 1), ui->wChannelMeters), row, column);
+        ui->channelMeterLayout->addWidget(meter, row, column + 1);
+        m_channelMeters << meter;
+    }
+
+    ui->wChannelMeters->setVisible(multichannel);
+}
+
 void StatusView::blink()
 {
     ui->lStatus->setVisible(!ui->lStatus->isVisible());
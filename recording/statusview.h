@@ -1,12 +1,20 @@
 #ifndef RECORDINGSTATUSVIEW_H
 #define RECORDINGSTATUSVIEW_H
 
+#include <QVector>
 #include <QWidget>
 
+#include "callbacktiming.h"
+#include "streamformat.h"
+
 class QTimer;
 
 namespace Recording {
 
+struct DropoutStats;
+struct Levels;
+class FancyProgressBar;
+
 namespace Ui {
 class RecordingStatusView;
 }
@@ -20,14 +28,27 @@ public:
     ~StatusView();
 
 public slots:
-    void handleStatusUpdate(float levelL, float levelR, bool isRecording, qint64 sampleCount);
+    void handleStatusUpdate(const Recording::Levels &levels, bool isRecording, qint64 sampleCount);
+    void handleDropoutStats(const Recording::DropoutStats &stats);
+    void handleCallbackTiming(const Recording::CallbackTimingSnapshot &timing);
+    void setStreamFormat(const Recording::StreamFormat &format);
 
 private slots:
     void blink();
 
 private:
+    void updateDropouts();
+
     Ui::RecordingStatusView *ui;
     QTimer *m_blinkTimer;
+    StreamFormat m_format;
+    qint64 m_lostFrames { 0 };
+    qint64 m_inputOverflows { 0 };
+    QString m_dropoutDetails;
+    CallbackTimingSnapshot m_timing;
+
+    // from the third channel on, the first two use meterL and meterR
+    QVector<FancyProgressBar *> m_channelMeters;
 };
 
 } // namespace Recording
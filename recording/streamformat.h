@@ -0,0 +1,36 @@
+#ifndef RECORDING_STREAMFORMAT_H
+#define RECORDING_STREAMFORMAT_H
+
+#include <QMetaType>
+
+namespace Recording {
+
+/*
+ * The format audio travels through the recording pipeline in, as
+ * negotiated with the input device when the stream is opened.
+ *
+ * Samples are always interleaved 32 bit floats: PortAudio converts from
+ * whatever the hardware delivers much better than we could, and the
+ * encoders want floats anyway. Everything behind the audio callback
+ * (ring buffer, meters, encoders, time display) is set up from this.
+ */
+struct StreamFormat
+{
+    // Most input channels we record, big interfaces beyond that get cut off
+    static constexpr int MAX_CHANNELS = 32;
+
+    int sampleRate = 48000;
+    int channels = 2;
+
+    int frameBytes() const { return channels * int(sizeof(float)); }
+    qint64 framesToMsecs(qint64 frames) const { return frames * 1000 / sampleRate; }
+
+    bool operator==(const StreamFormat &o) const { return sampleRate == o.sampleRate && channels == o.channels; }
+    bool operator!=(const StreamFormat &o) const { return !(*this == o); }
+};
+
+} // namespace Recording
+
+Q_DECLARE_METATYPE(Recording::StreamFormat)
+
+#endif // RECORDING_STREAMFORMAT_H
@@ -0,0 +1,87 @@
+#include "truepeakmeter.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Recording {
+
+TruePeakMeter::TruePeakMeter()
+{
+    configure(48000, 2);
+}
+
+void TruePeakMeter::configure(int sampleRate, int channels)
+{
+    m_channels = channels;
+    m_factor = sampleRate < 96000 ? 4 : sampleRate < 192000 ? 2 : 1;
+
+    // Windowed sinc lowpass at the original Nyquist frequency, split into phases.
+    // Each phase is normalized to unity gain, so DC passes through unchanged.
+    const int taps = TAPS_PER_PHASE * m_factor;
+    const double center = (taps - 1) / 2.0;
+
+    m_coeffs.assign(size_t(taps), 0.0f);
+    for (int phase = 0; phase < m_factor; ++phase)
+    {
+        double sum = 0;
+        for (int k = 0; k < TAPS_PER_PHASE; ++k)
+        {
+            int n = k * m_factor + phase;
+            double x = (n - center) / m_factor;
+            double sinc = x == 0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+            double window = 0.5 - 0.5 * std::cos(2.0 * M_PI * (n + 0.5) / taps);
+            m_coeffs[size_t(phase * TAPS_PER_PHASE + k)] = float(sinc * window);
+            sum += sinc * window;
+        }
+        for (int k = 0; k < TAPS_PER_PHASE; ++k)
+            m_coeffs[size_t(phase * TAPS_PER_PHASE + k)] /= float(sum);
+    }
+
+    m_history.assign(size_t(channels * 2 * TAPS_PER_PHASE), 0.0f);
+    reset();
+}
+
+void TruePeakMeter::reset()
+{
+    std::fill(m_history.begin(), m_history.end(), 0.0f);
+    m_historyPos = 0;
+}
+
+void TruePeakMeter::process(const float *samples, int64_t frames, float *peaks)
+{
+    if (m_factor == 1)
+    {
+        for (int64_t i = 0; i < frames * m_channels; ++i)
+            peaks[i % m_channels] = std::max(peaks[i % m_channels], std::fabs(samples[i]));
+        return;
+    }
+
+    for (int64_t i = 0; i < frames; ++i)
+    {
+        for (int c = 0; c < m_channels; ++c)
+        {
+            float *hist = &m_history[size_t(c * 2 * TAPS_PER_PHASE)];
+            float x = samples[i * m_channels + c];
+            hist[m_historyPos] = x;
+            hist[m_historyPos + TAPS_PER_PHASE] = x;
+
+            // window of the most recent samples, oldest first
+            const float *window = hist + m_historyPos + 1;
+
+            float peak = peaks[c];
+            for (int phase = 0; phase < m_factor; ++phase)
+            {
+                const float *coeffs = &m_coeffs[size_t(phase * TAPS_PER_PHASE)];
+                float y = 0;
+                for (int k = 0; k < TAPS_PER_PHASE; ++k)
+                    y += coeffs[k] * window[k];
+                peak = std::max(peak, std::fabs(y));
+            }
+            peaks[c] = peak;
+        }
+
+        m_historyPos = (m_historyPos + 1) % TAPS_PER_PHASE;
+    }
+}
+
+} // namespace Recording
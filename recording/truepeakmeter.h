@@ -0,0 +1,43 @@
+#ifndef RECORDING_TRUEPEAKMETER_H
+#define RECORDING_TRUEPEAKMETER_H
+
+#include <cstdint>
+#include <vector>
+
+namespace Recording {
+
+/*
+ * Estimates the true (inter-sample) peak according to ITU-R BS.1770
+ * Annex 2 by oversampling with a polyphase FIR interpolator: 4x below
+ * 96 kHz, 2x below 192 kHz, not at all above.
+ *
+ * All memory is allocated in configure().
+ */
+class TruePeakMeter
+{
+public:
+    TruePeakMeter();
+
+    void configure(int sampleRate, int channels);
+    void reset();
+
+    // Raises peaks[c] to the true peak magnitude of channel c, if it is higher
+    void process(const float *samples, int64_t frames, float *peaks);
+
+private:
+    static const int TAPS_PER_PHASE = 12;
+
+    int m_channels = 0;
+    int m_factor = 1;
+
+    std::vector<float> m_coeffs;  // [phase][tap]
+
+    // per channel, every sample is stored twice, so that the last
+    // TAPS_PER_PHASE samples are always available contiguously
+    std::vector<float> m_history; // [channel][2 * TAPS_PER_PHASE]
+    int m_historyPos = 0;
+};
+
+} // namespace Recording
+
+#endif // RECORDING_TRUEPEAKMETER_H
@@ -0,0 +1,303 @@
+#include "virtualaudiobackend.h"
+
+#include <QtGlobal>
+
+#include <chrono>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace Recording {
+
+namespace {
+    // for the synthetic signal, looped
+    const int SYNTHETIC_SECONDS = 10;
+
+    const int MAX_OUTPUT_CHANNELS = 2;
+}
+
+/*
+ * One open stream: the thread playing the sound card's interrupt.
+ * Everything the callback gets is allocated up front.
+ */
+class VirtualAudioBackend::Stream : public QThread
+{
+public:
+    Stream(const VirtualDeviceConfig &config, int inChannels, int outChannels, double sampleRate,
+           unsigned long framesPerBuffer, PaStreamCallback *callback, void *userData)
+        : m_config(config), m_inChannels(inChannels), m_outChannels(outChannels),
+          m_framesPerBuffer(framesPerBuffer), m_callback(callback), m_userData(userData)
+    {
+        m_input.resize(size_t(framesPerBuffer) * size_t(inChannels));
+        m_output.resize(size_t(framesPerBuffer) * size_t(outChannels));
+
+        const double bufferSeconds = framesPerBuffer / sampleRate;
+        m_info.structVersion = 1;
+        m_info.inputLatency = inChannels ? bufferSeconds * m_config.hardwareBuffers : 0;
+        m_info.outputLatency = outChannels ? bufferSeconds * m_config.hardwareBuffers : 0;
+        m_info.sampleRate = sampleRate;
+    }
+
+    ~Stream() override
+    {
+        halt();
+    }
+
+    void halt()
+    {
+        m_stopping.store(true, std::memory_order_relaxed);
+        wait();
+        m_stopping.store(false, std::memory_order_relaxed);
+    }
+
+    const PaStreamInfo *info() const { return &m_info; }
+
+protected:
+    void run() override;
+
+private:
+    int deliver(qint64 buffer, double bufferSeconds, double now, PaStreamCallbackFlags flags);
+
+    const VirtualDeviceConfig m_config;
+    const int m_inChannels;
+    const int m_outChannels;
+    const unsigned long m_framesPerBuffer;
+    PaStreamCallback *const m_callback;
+    void *const m_userData;
+
+    PaStreamInfo m_info {};
+    std::vector<float> m_input;
+    std::vector<float> m_output;
+    qint64 m_position { 0 };     // in the source
+
+    std::atomic_bool m_stopping { false };
+};
+
+void VirtualAudioBackend::Stream::run()
+{
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+
+    // wall clock time per buffer
+    const double period = m_framesPerBuffer / (m_info.sampleRate * m_config.speed);
+    const double bufferSeconds = m_framesPerBuffer / m_info.sampleRate;
+
+    const double stall = m_config.stallMsecs / 1000.0;
+    const double stallInterval = m_config.stallIntervalMsecs / 1000.0;
+    double nextStall = stall > 0 && stallInterval > 0 ? stallInterval : std::numeric_limits<double>::infinity();
+
+    // the same jitter in every run
+    std::minstd_rand random(1);
+    std::uniform_real_distribution<double> jitter(0.0, m_config.jitterMsecs / 1000.0);
+
+    const Clock::time_point start = Clock::now();
+    qint64 buffer = 0;      // next one to deliver
+    PaStreamCallbackFlags flags = 0;
+
+    while (!m_stopping.load(std::memory_order_relaxed))
+    {
+        // the interrupt comes when the buffer is full, the thread runs a bit later
+        double wakeup = period * double(buffer + 1);
+        if (m_config.jitterMsecs > 0)
+            wakeup += jitter(random);
+        if (wakeup >= nextStall)
+        {
+            wakeup += stall;
+            nextStall += stallInterval;
+        }
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(Seconds(wakeup)));
+
+        const double now = Seconds(Clock::now() - start).count();
+        const qint64 due = qint64(now / period);
+
+        // whatever the hardware couldn't hold any more is gone
+        if (due - buffer > m_config.hardwareBuffers)
+        {
+            const qint64 lost = due - buffer - m_config.hardwareBuffers;
+            m_position += lost * qint64(m_framesPerBuffer);
+            buffer += lost;
+            flags |= (m_inChannels ? paInputOverflow : 0) | (m_outChannels ? paOutputUnderflow : 0);
+        }
+
+        for (; buffer < due && !m_stopping.load(std::memory_order_relaxed); ++buffer)
+        {
+            if (deliver(buffer, bufferSeconds, now, flags) != paContinue)
+                return;
+            flags = 0;
+        }
+    }
+}
+
+int VirtualAudioBackend::Stream::deliver(qint64 buffer, double bufferSeconds, double now, PaStreamCallbackFlags flags)
+{
+    if (m_inChannels)
+    {
+        const AudioSource &source = *m_config.source;
+        const int sourceChannels = source.format().channels;
+        float *in = m_input.data();
+
+        for (qint64 done = 0; done < qint64(m_framesPerBuffer); )
+        {
+            qint64 frames = qint64(m_framesPerBuffer) - done;
+            const float *s = source.block(m_position, &frames);
+
+            for (qint64 i = 0; i < frames; ++i, s += sourceChannels, in += m_inChannels)
+                for (int c = 0; c < m_inChannels; ++c)
+                    in[c] = c < sourceChannels ? s[c] : 0.0f;
+
+            done += frames;
+            m_position += frames;
+        }
+    }
+
+    PaStreamCallbackTimeInfo timeInfo;
+    timeInfo.currentTime = now * m_config.speed;
+    timeInfo.inputBufferAdcTime = double(buffer) * bufferSeconds;
+    timeInfo.outputBufferDacTime = double(buffer + 1) * bufferSeconds + m_info.outputLatency;
+
+    return m_callback(m_inChannels ? m_input.data() : nullptr,
+                      m_outChannels ? m_output.data() : nullptr,
+                      m_framesPerBuffer, &timeInfo, flags, m_userData);
+}
+
+VirtualAudioBackend::VirtualAudioBackend(const VirtualDeviceConfig &config)
+    : m_config(config)
+{
+    // the device runs in the format of what it plays
+    if (m_config.source && m_config.source->isValid())
+    {
+        m_config.sampleRate = m_config.source->format().sampleRate;
+        m_config.channels = m_config.source->format().channels;
+    }
+    else
+    {
+        StreamFormat format;
+        format.sampleRate = m_config.sampleRate;
+        format.channels = m_config.channels;
+        m_config.source = std::make_shared<AudioSource>(AudioSource::synthetic(format, qint64(format.sampleRate) * SYNTHETIC_SECONDS));
+    }
+
+    m_config.framesPerBuffer = qMax(1, m_config.framesPerBuffer);
+    m_config.hardwareBuffers = qMax(1, m_config.hardwareBuffers);
+    m_config.speed = m_config.speed > 0 ? m_config.speed : 1.0;
+
+    const double latency = double(m_config.framesPerBuffer) / m_config.sampleRate;
+
+    m_inputInfo.structVersion = 2;
+    m_inputInfo.name = "Virtual input";
+    m_inputInfo.maxInputChannels = m_config.channels;
+    m_inputInfo.defaultLowInputLatency = latency;
+    m_inputInfo.defaultHighInputLatency = latency * m_config.hardwareBuffers;
+    m_inputInfo.defaultSampleRate = m_config.sampleRate;
+
+    m_outputInfo.structVersion = 2;
+    m_outputInfo.name = "Virtual output";
+    m_outputInfo.maxOutputChannels = MAX_OUTPUT_CHANNELS;
+    m_outputInfo.defaultLowOutputLatency = latency;
+    m_outputInfo.defaultHighOutputLatency = latency * m_config.hardwareBuffers;
+    m_outputInfo.defaultSampleRate = m_config.sampleRate;
+}
+
+VirtualAudioBackend::~VirtualAudioBackend() = default;
+
+QString VirtualAudioBackend::name() const
+{
+    return QStringLiteral("Virtual");
+}
+
+PaDeviceIndex VirtualAudioBackend::deviceCount() const
+{
+    return 2;
+}
+
+const PaDeviceInfo *VirtualAudioBackend::deviceInfo(PaDeviceIndex device) const
+{
+    switch (device)
+    {
+    case INPUT_DEVICE:  return &m_inputInfo;
+    case OUTPUT_DEVICE: return &m_outputInfo;
+    default:            return nullptr;
+    }
+}
+
+PaError VirtualAudioBackend::isFormatSupported(const PaStreamParameters *input, const PaStreamParameters *output,
+                                               double sampleRate) const
+{
+    if (!input && !output)
+        return paInvalidDevice;
+
+    if (input)
+    {
+        if (input->device != INPUT_DEVICE)
+            return paInvalidDevice;
+        if (input->channelCount < 1 || input->channelCount > m_config.channels)
+            return paInvalidChannelCount;
+        if (input->sampleFormat != paFloat32)
+            return paSampleFormatNotSupported;
+    }
+
+    if (output)
+    {
+        if (output->device != OUTPUT_DEVICE)
+            return paInvalidDevice;
+        if (output->channelCount < 1 || output->channelCount > MAX_OUTPUT_CHANNELS)
+            return paInvalidChannelCount;
+        if (output->sampleFormat != paFloat32)
+            return paSampleFormatNotSupported;
+    }
+
+    if (int(sampleRate) != m_config.sampleRate)
+        return paInvalidSampleRate;
+
+    return paNoError;
+}
+
+PaError VirtualAudioBackend::openStream(PaStream **stream, const PaStreamParameters *input, const PaStreamParameters *output,
+                                        double sampleRate, unsigned long framesPerBuffer, PaStreamFlags /*flags*/,
+                                        PaStreamCallback *callback, void *userData)
+{
+    PaError err = isFormatSupported(input, output, sampleRate);
+    if (err != paNoError)
+        return err;
+
+    // only callback streams, nobody here uses blocking I/O
+    if (!callback)
+        return paIncompatibleStreamHostApi;
+
+    if (framesPerBuffer == paFramesPerBufferUnspecified)
+        framesPerBuffer = (unsigned long)m_config.framesPerBuffer;
+
+    *stream = new Stream(m_config, input ? input->channelCount : 0, output ? output->channelCount : 0,
+                         sampleRate, framesPerBuffer, callback, userData);
+    return paNoError;
+}
+
+PaError VirtualAudioBackend::startStream(PaStream *stream)
+{
+    Stream *s = static_cast<Stream *>(stream);
+    if (s->isRunning())
+        return paStreamIsNotStopped;
+
+    s->start(QThread::TimeCriticalPriority);
+    return paNoError;
+}
+
+PaError VirtualAudioBackend::stopStream(PaStream *stream)
+{
+    static_cast<Stream *>(stream)->halt();
+    return paNoError;
+}
+
+PaError VirtualAudioBackend::closeStream(PaStream *stream)
+{
+    delete static_cast<Stream *>(stream);
+    return paNoError;
+}
+
+const PaStreamInfo *VirtualAudioBackend::streamInfo(PaStream *stream) const
+{
+    return static_cast<Stream *>(stream)->info();
+}
+
+} // namespace Recording
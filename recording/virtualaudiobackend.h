@@ -0,0 +1,89 @@
+#ifndef RECORDING_VIRTUALAUDIOBACKEND_H
+#define RECORDING_VIRTUALAUDIOBACKEND_H
+
+#include <QThread>
+
+#include <atomic>
+#include <memory>
+
+#include "audiobackend.h"
+#include "audiosource.h"
+
+namespace Recording {
+
+// How the virtual device behaves, all times in milliseconds of wall clock
+struct VirtualDeviceConfig
+{
+    int sampleRate = 48000;
+    int channels = 2;
+
+    // Used if the stream is opened with paFramesPerBufferUnspecified
+    int framesPerBuffer = 480;
+
+    // How many buffers the "hardware" holds. A callback thread that is
+    // late by more than that loses input and reports an overflow.
+    int hardwareBuffers = 4;
+
+    // Every callback comes up to this much late, evenly distributed
+    double jitterMsecs = 0;
+
+    // Every stallIntervalMsecs, the callback thread sleeps stallMsecs on top
+    double stallMsecs = 0;
+    double stallIntervalMsecs = 0;
+
+    // The device clock runs this many times faster than the wall clock
+    double speed = 1.0;
+
+    // What the input delivers, looped. A synthetic test signal in the
+    // stream's format if there is none.
+    std::shared_ptr<const AudioSource> source;
+};
+
+/*
+ * A sound card that isn't there, for reproducible load tests: one input
+ * and one output device, running the real audio callback from a thread
+ * of their own at the pace of the configured buffer size.
+ *
+ * Jitter and stalls delay the callback thread like a busy system would.
+ * Buffers that fell due in the meantime are delivered back to back, up
+ * to the hardware buffer size; what doesn't fit is lost and reported
+ * with paInputOverflow (and paOutputUnderflow for the output), as a
+ * driver would. The output is thrown away.
+ */
+class VirtualAudioBackend : public AudioBackend
+{
+public:
+    // The devices the backend offers
+    static constexpr PaDeviceIndex INPUT_DEVICE = 0;
+    static constexpr PaDeviceIndex OUTPUT_DEVICE = 1;
+
+    explicit VirtualAudioBackend(const VirtualDeviceConfig &config);
+    ~VirtualAudioBackend() override;
+
+    QString name() const override;
+
+    PaDeviceIndex deviceCount() const override;
+    const PaDeviceInfo *deviceInfo(PaDeviceIndex device) const override;
+
+    PaError isFormatSupported(const PaStreamParameters *input, const PaStreamParameters *output,
+                              double sampleRate) const override;
+
+    PaError openStream(PaStream **stream, const PaStreamParameters *input, const PaStreamParameters *output,
+                       double sampleRate, unsigned long framesPerBuffer, PaStreamFlags flags,
+                       PaStreamCallback *callback, void *userData) override;
+    PaError startStream(PaStream *stream) override;
+    PaError stopStream(PaStream *stream) override;
+    PaError closeStream(PaStream *stream) override;
+    const PaStreamInfo *streamInfo(PaStream *stream) const override;
+
+private:
+    class Stream;
+
+    VirtualDeviceConfig m_config;
+    PaDeviceInfo m_inputInfo {};
+    PaDeviceInfo m_outputInfo {};
+};
+
+} // namespace Recording
+
+#endif // RECORDING_VIRTUALAUDIOBACKEND_H
@@ -0,0 +1,249 @@
+#include "wavencoderstream.h"
+
+#include <QFile>
+#include <QtEndian>
+
+#include <cmath>
+#include <cstring>
+
+namespace Recording {
+
+namespace {
+    const qint64 CONVERT_CHUNK_FRAMES = 4096;
+    const int BYTES_PER_SAMPLE = 3;
+
+    const float FULL_SCALE_24 = 8388607.0f;
+
+    // RIFF header, JUNK chunk (becomes ds64 for RF64), fmt chunk, data chunk header.
+    // More than two channels take the longer WAVE_FORMAT_EXTENSIBLE fmt chunk.
+    const qint64 JUNK_OFFSET = 12;
+    const int DS64_SIZE = 28;
+    const qint64 FMT_OFFSET = JUNK_OFFSET + 8 + DS64_SIZE;
+    const int PCM_FMT_SIZE = 16;
+    const int EXTENSIBLE_FMT_SIZE = 40;
+    const qint64 MAX_HEADER_SIZE = FMT_OFFSET + 8 + EXTENSIBLE_FMT_SIZE + 8;
+
+    // KSDATAFORMAT_SUBTYPE_PCM
+    const char PCM_SUBFORMAT[16] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+                                     char(0x80), 0x00, 0x00, char(0xAA), 0x00, 0x38, char(0x9B), 0x71 };
+
+    qint64 headerSize(int fmtSize) { return FMT_OFFSET + 8 + fmtSize + 8; }
+
+    const quint64 RIFF_LIMIT = 0xFFFFFFFFull;
+
+    void put16(char *p, quint16 v) { qToLittleEndian(v, reinterpret_cast<uchar*>(p)); }
+    void put32(char *p, quint32 v) { qToLittleEndian(v, reinterpret_cast<uchar*>(p)); }
+    void put64(char *p, quint64 v) { qToLittleEndian(v, reinterpret_cast<uchar*>(p)); }
+
+    // Writes the sizes into the header, as RF64 if plain RIFF can't hold them,
+    // and returns to where we were. Any padding byte must already be written.
+    bool patchSizes(QIODevice *device, qint64 headerSize, quint64 dataBytes, int blockAlign)
+    {
+        if (device->isSequential())
+            return true;
+
+        const qint64 dataSizeOffset = headerSize - 4;
+        const quint64 riffSize = quint64(headerSize) - 8 + dataBytes + (dataBytes & 1);
+        const qint64 end = device->pos();
+        char buf[8 + DS64_SIZE];
+
+        if (riffSize <= RIFF_LIMIT)
+        {
+            put32(buf, quint32(riffSize));
+            if (!device->seek(4) || device->write(buf, 4) != 4)
+                return false;
+
+            put32(buf, quint32(dataBytes));
+            if (!device->seek(dataSizeOffset) || device->write(buf, 4) != 4)
+                return false;
+        }
+        else
+        {
+            memcpy(buf, "RF64", 4);
+            put32(buf + 4, 0xFFFFFFFFu);
+            if (!device->seek(0) || device->write(buf, 8) != 8)
+                return false;
+
+            memcpy(buf, "ds64", 4);
+            put32(buf + 4, DS64_SIZE);
+            put64(buf + 8, riffSize);
+            put64(buf + 16, dataBytes);
+            put64(buf + 24, dataBytes / quint64(blockAlign));
+            put32(buf + 32, 0); // no table entries
+            if (!device->seek(JUNK_OFFSET) || device->write(buf, sizeof(buf)) != qint64(sizeof(buf)))
+                return false;
+
+            put32(buf, 0xFFFFFFFFu);
+            if (!device->seek(dataSizeOffset) || device->write(buf, 4) != 4)
+                return false;
+        }
+
+        return device->seek(end);
+    }
+}
+
+WavEncoderStream::WavEncoderStream(QObject *parent)
+: EncoderStream(parent)
+{}
+
+WavEncoderStream::~WavEncoderStream()
+{
+    close();
+}
+
+bool WavEncoderStream::open(const EncoderTags &, const StreamFormat &format, QIODevice *output)
+{
+    m_device = output;
+    m_format = format;
+    m_dataBytes = 0;
+
+    m_convertBuffer = std::make_unique<char[]>(size_t(CONVERT_CHUNK_FRAMES * format.channels * BYTES_PER_SAMPLE));
+
+    if (!writeHeader())
+    {
+        error(tr("WAV Error: Could not write to file: %1").arg(output->errorString()));
+        m_device = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool WavEncoderStream::writeHeader()
+{
+    const bool extensible = m_format.channels > 2;
+    const int fmtSize = extensible ? EXTENSIBLE_FMT_SIZE : PCM_FMT_SIZE;
+    m_headerSize = headerSize(fmtSize);
+
+    char header[MAX_HEADER_SIZE] = {};
+    const int blockAlign = m_format.channels * BYTES_PER_SAMPLE;
+
+    // sizes are filled in by patchSizes()
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVE", 4);
+
+    memcpy(header + JUNK_OFFSET, "JUNK", 4);
+    put32(header + JUNK_OFFSET + 4, DS64_SIZE);
+
+    char *fmt = header + FMT_OFFSET;
+    memcpy(fmt, "fmt ", 4);
+    put32(fmt + 4, quint32(fmtSize));
+    put16(fmt + 8, extensible ? 0xFFFE : 1); // WAVE_FORMAT_EXTENSIBLE or PCM
+    put16(fmt + 10, quint16(m_format.channels));
+    put32(fmt + 12, quint32(m_format.sampleRate));
+    put32(fmt + 16, quint32(m_format.sampleRate * blockAlign));
+    put16(fmt + 20, quint16(blockAlign));
+    put16(fmt + 22, BYTES_PER_SAMPLE * 8);
+
+    if (extensible)
+    {
+        put16(fmt + 24, 22);                   // size of the extension
+        put16(fmt + 26, BYTES_PER_SAMPLE * 8); // valid bits
+        put32(fmt + 28, 0);                    // no speaker positions, just numbered channels
+        memcpy(fmt + 32, PCM_SUBFORMAT, sizeof(PCM_SUBFORMAT));
+    }
+
+    memcpy(header + m_headerSize - 8, "data", 4);
+
+    return m_device->write(header, m_headerSize) == m_headerSize;
+}
+
+void WavEncoderStream::close()
+{
+    if (!m_device)
+        return;
+
+    // chunks have to be padded to an even length
+    bool ok = !(m_dataBytes & 1) || m_device->write("\0", 1) == 1;
+
+    if (!ok || !patchSizes(m_device, m_headerSize, m_dataBytes, m_format.channels * BYTES_PER_SAMPLE))
+        error(tr("WAV Error: Could not finish the file header: %1").arg(m_device->errorString()));
+
+    m_device = nullptr;
+}
+
+bool WavEncoderStream::sync()
+{
+    if (!m_device)
+        return true;
+
+    return patchSizes(m_device, m_headerSize, m_dataBytes, m_format.channels * BYTES_PER_SAMPLE) && flushToDisk(m_device);
+}
+
+bool WavEncoderStream::repairFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadWrite))
+        return false;
+
+    // only our own layouts, see writeHeader()
+    QByteArray header = file.read(MAX_HEADER_SIZE);
+    if (header.size() < FMT_OFFSET + 8
+            || (!header.startsWith("RIFF") && !header.startsWith("RF64"))
+            || header.mid(8, 4) != "WAVE"
+            || header.mid(int(FMT_OFFSET), 4) != "fmt ")
+        return false;
+
+    int fmtSize = int(qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(header.constData() + FMT_OFFSET + 4)));
+    if (fmtSize != PCM_FMT_SIZE && fmtSize != EXTENSIBLE_FMT_SIZE)
+        return false;
+
+    const qint64 size = headerSize(fmtSize);
+    if (header.size() < size || header.mid(int(size) - 8, 4) != "data")
+        return false;
+
+    int blockAlign = qFromLittleEndian<quint16>(reinterpret_cast<const uchar*>(header.constData() + FMT_OFFSET + 20));
+    if (blockAlign <= 0)
+        return false;
+
+    // drop a partially written frame at the end
+    quint64 dataBytes = quint64(file.size() - size);
+    dataBytes -= dataBytes % quint64(blockAlign);
+
+    if (!file.resize(size + qint64(dataBytes)) || !file.seek(file.size()))
+        return false;
+
+    if ((dataBytes & 1) && file.write("\0", 1) != 1)
+        return false;
+
+    return patchSizes(&file, size, dataBytes, blockAlign) && file.flush();
+}
+
+qint64 WavEncoderStream::writeAudio(float *buffer, qint64 numSamples)
+{
+    if (!m_device)
+        return -1;
+
+    const int channels = m_format.channels;
+
+    for (qint64 done = 0; done < numSamples; done += CONVERT_CHUNK_FRAMES)
+    {
+        qint64 frames = qMin(CONVERT_CHUNK_FRAMES, numSamples - done);
+        const float *in = buffer + done * channels;
+        char *out = m_convertBuffer.get();
+
+        for (qint64 i = 0; i < frames * channels; ++i)
+        {
+            qint32 s = qint32(std::lrint(qBound(-1.0f, in[i], 1.0f) * FULL_SCALE_24));
+            out[0] = char(s & 0xFF);
+            out[1] = char((s >> 8) & 0xFF);
+            out[2] = char((s >> 16) & 0xFF);
+            out += BYTES_PER_SAMPLE;
+        }
+
+        qint64 bytes = out - m_convertBuffer.get();
+        if (m_device->write(m_convertBuffer.get(), bytes) != bytes)
+        {
+            error(tr("WAV Error: Could not write to file: %1").arg(m_device->errorString()));
+
+            m_device = nullptr;
+            return -1;
+        }
+
+        m_dataBytes += quint64(bytes);
+    }
+
+    return numSamples;
+}
+
+} // namespace Recording
@@ -0,0 +1,53 @@
+#ifndef RECORDING_WAVENCODERSTREAM_H
+#define RECORDING_WAVENCODERSTREAM_H
+
+#include <memory>
+
+#include "encoderstream.h"
+#include "streamformat.h"
+
+class QIODevice;
+
+namespace Recording {
+
+/*
+ * Uncompressed 24 bit PCM in a WAV file. More than two channels are
+ * written as WAVE_FORMAT_EXTENSIBLE without speaker positions.
+ *
+ * The header reserves room for an RF64 ds64 chunk (EBU Tech 3306), so
+ * that recordings growing beyond the 4 GiB RIFF limit can be turned into
+ * RF64 in place when the stream is closed. Smaller files stay plain WAV.
+ * The sizes in the header are updated by sync() and close(), if the
+ * output device can seek. repairFile() does the same for a file whose
+ * writer died.
+ */
+class WavEncoderStream: public EncoderStream
+{
+    Q_OBJECT
+public:
+    explicit WavEncoderStream(QObject *parent = nullptr);
+    ~WavEncoderStream();
+
+    bool open(const EncoderTags &tags, const StreamFormat &format, QIODevice *output) override;
+    qint64 writeAudio(float *samples, qint64 count) override;
+    void close() override;
+    bool sync() override;
+
+    // Fixes up the header of a file we wrote but couldn't close
+    static bool repairFile(const QString &fileName);
+
+private:
+    bool writeHeader();
+
+    QIODevice   *m_device { nullptr };
+    StreamFormat m_format;
+    qint64       m_headerSize { 0 };
+    quint64      m_dataBytes { 0 };
+
+    // allocated in open(), so that writeAudio() doesn't have to
+    std::unique_ptr<char[]> m_convertBuffer;
+};
+
+} // namespace Recording
+
+#endif // RECORDING_WAVENCODERSTREAM_H
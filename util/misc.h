@@ -3,7 +3,6 @@
 
 #include <QString>
 #include <QDebug>
-#include <chrono>
 
 // credits to https://stackoverflow.com/a/16795664/1331519
 template<typename... Args> struct SELECT_SIGNAL_OVERLOAD {
@@ -13,28 +12,11 @@ template<typename... Args> struct SELECT_SIGNAL_OVERLOAD {
     }
 };
 
-#ifndef Q_NO_DEBUG
-
-#define MEASURE_TIME(expression) \
-    do { \
-        auto _time_measure__start = std::chrono::steady_clock::now(); \
-        expression; \
-        auto _time_measure__end = std::chrono::steady_clock::now(); \
-        std::chrono::duration<double> _time_measure__diff = _time_measure__end - _time_measure__start; \
-        qDebug() << "TIME:" <<  _time_measure__diff.count() << "seconds for" << #expression; \
-    } while(0)
-
-#else
-
-#define MEASURE_TIME(expression) expression
-
-#endif
-
 namespace Util {
-    inline QString formatTime(uint64_t samples) {
-        uint64_t seconds = samples/48000 % 60;
-        uint64_t minutes = samples/48000/60 % 60;
-        uint64_t hours   = samples/48000/60/60;
+    inline QString formatTime(uint64_t samples, uint64_t sampleRate) {
+        uint64_t seconds = samples/sampleRate % 60;
+        uint64_t minutes = samples/sampleRate/60 % 60;
+        uint64_t hours   = samples/sampleRate/60/60;
 
         return QString("%1:%2:%3").arg(hours).arg(minutes, 2, 10, QChar('0')).arg(seconds, 2, 10, QChar('0'));
     }
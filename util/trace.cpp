@@ -0,0 +1,223 @@
+#include "trace.h"
+
+#include <QFile>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace Util {
+namespace Trace {
+
+namespace Detail {
+    std::atomic_bool enabled { false };
+
+    qint64 now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+namespace {
+    // per thread, about 500 KiB
+    const int BUFFER_EVENTS = 16384;
+
+    struct Event
+    {
+        const char *category;
+        const char *name;
+        qint64 start;
+        qint64 end;
+    };
+
+    struct ThreadBuffer
+    {
+        std::unique_ptr<Event[]> events { std::make_unique<Event[]>(BUFFER_EVENTS) };
+        std::atomic<int> count { 0 };
+        std::atomic<qint64> dropped { 0 };
+        std::atomic<int> session { -1 };    // the trace the events belong to
+        std::atomic_bool inUse { true };    // false once its thread has ended
+
+        // set on registration, under the registry mutex
+        QString threadName;
+    };
+
+    QMutex registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;
+
+    std::atomic<int> currentSession { 0 };
+    std::atomic<qint64> sessionStart { 0 };
+
+    // Hands the buffer back when its thread ends
+    struct ThreadSlot
+    {
+        ThreadBuffer *buffer = nullptr;
+
+        ~ThreadSlot()
+        {
+            if (buffer)
+                buffer->inUse.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local ThreadSlot threadSlot;
+
+    ThreadBuffer *registerThread(int session)
+    {
+        QMutexLocker lock(&registryMutex);
+
+        // take over the buffer of an ended thread, unless it still holds
+        // events of the running trace
+        ThreadBuffer *buffer = nullptr;
+        for (const std::unique_ptr<ThreadBuffer> &candidate : registry)
+        {
+            if (!candidate->inUse.load(std::memory_order_acquire)
+                && candidate->session.load(std::memory_order_relaxed) != session)
+            {
+                buffer = candidate.get();
+                break;
+            }
+        }
+
+        if (!buffer)
+        {
+            registry.push_back(std::make_unique<ThreadBuffer>());
+            buffer = registry.back().get();
+        }
+
+        buffer->inUse.store(true, std::memory_order_relaxed);
+        buffer->session.store(-1, std::memory_order_relaxed);
+        buffer->threadName = QThread::currentThread()->objectName();
+
+        return buffer;
+    }
+
+    ThreadBuffer *threadBuffer()
+    {
+        const int session = currentSession.load(std::memory_order_acquire);
+
+        ThreadBuffer *buffer = threadSlot.buffer;
+        if (!buffer)
+            buffer = threadSlot.buffer = registerThread(session);
+
+        // first event of this trace, forget the previous one
+        if (buffer->session.load(std::memory_order_relaxed) != session)
+        {
+            buffer->count.store(0, std::memory_order_relaxed);
+            buffer->dropped.store(0, std::memory_order_relaxed);
+            buffer->session.store(session, std::memory_order_release);
+        }
+
+        return buffer;
+    }
+
+    QString escaped(QString s)
+    {
+        return s.replace('\\', QLatin1String("\\\\")).replace('"', QLatin1String("\\\""));
+    }
+
+    QString micros(qint64 nanos)
+    {
+        return QString::number(double(nanos) / 1000.0, 'f', 3);
+    }
+}
+
+void Detail::record(const char *category, const char *name, qint64 start, qint64 end)
+{
+    ThreadBuffer *buffer = threadBuffer();
+
+    // only this thread writes, the exporter reads up to count
+    const int i = buffer->count.load(std::memory_order_relaxed);
+    if (i >= BUFFER_EVENTS)
+    {
+        buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    buffer->events[i] = Event { category, name, start, end };
+    buffer->count.store(i + 1, std::memory_order_release);
+}
+
+void start()
+{
+    sessionStart.store(Detail::now(), std::memory_order_relaxed);
+    currentSession.fetch_add(1, std::memory_order_acq_rel);
+    Detail::enabled.store(true, std::memory_order_relaxed);
+}
+
+void stop()
+{
+    Detail::enabled.store(false, std::memory_order_relaxed);
+}
+
+bool exportChromeJson(const QString &fileName, QString *errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    const int session = currentSession.load(std::memory_order_acquire);
+    const qint64 origin = sessionStart.load(std::memory_order_relaxed);
+
+    QTextStream out(&file);
+    out << "{\"traceEvents\":[";
+
+    const char *separator = "\n";
+    int tid = 0;
+
+    QMutexLocker lock(&registryMutex);
+    for (const std::unique_ptr<ThreadBuffer> &buffer : registry)
+    {
+        if (buffer->session.load(std::memory_order_acquire) != session)
+            continue;
+
+        ++tid;
+        const QString threadName = buffer->threadName.isEmpty() ? QString("Thread %1").arg(tid) : buffer->threadName;
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+            << ",\"args\":{\"name\":\"" << escaped(threadName) << "\"}}";
+        separator = ",\n";
+
+        const int count = buffer->count.load(std::memory_order_acquire);
+        qint64 last = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const Event &e = buffer->events[i];
+
+            // zones that started before this trace count from its beginning
+            const qint64 start = qMax(e.start, origin);
+            out << separator << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category
+                << "\",\"ph\":\"X\",\"ts\":" << micros(start - origin) << ",\"dur\":" << micros(qMax<qint64>(e.end - start, 0))
+                << ",\"pid\":1,\"tid\":" << tid << "}";
+            last = qMax(last, e.end - origin);
+        }
+
+        const qint64 dropped = buffer->dropped.load(std::memory_order_relaxed);
+        if (dropped)
+        {
+            out << separator << "{\"name\":\"events dropped\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" << micros(last)
+                << ",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"count\":" << dropped << "}}";
+        }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out.flush();
+
+    if (file.error() != QFileDevice::NoError)
+    {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace Trace
+} // namespace Util
@@ -0,0 +1,82 @@
+#ifndef UTIL_TRACE_H
+#define UTIL_TRACE_H
+
+#include <QString>
+
+#include <atomic>
+
+/*
+ * Performance tracing: scoped zones recorded per thread and exported in
+ * the Chrome trace event format, which chrome://tracing and Perfetto
+ * (ui.perfetto.dev) open.
+ *
+ *     void render()
+ *     {
+ *         TRACE_ZONE("pdf", "render");
+ *         ...
+ *     }
+ *
+ * While no trace is running a zone costs one relaxed atomic load. Each
+ * thread writes into a fixed-size buffer of its own without any locks;
+ * only its first zone in a trace takes a mutex to register the buffer,
+ * so keep zones out of the audio callback. A full buffer drops further
+ * events and counts them.
+ *
+ * Category and name have to be string literals, only the pointers are
+ * stored. Building with CONFIG+=no_tracing removes all zones.
+ */
+
+namespace Util {
+namespace Trace {
+
+namespace Detail {
+    extern std::atomic_bool enabled;
+
+    qint64 now();
+    void record(const char *category, const char *name, qint64 start, qint64 end);
+}
+
+inline bool isEnabled() { return Detail::enabled.load(std::memory_order_relaxed); }
+
+// Starts a new trace, dropping what the previous one recorded
+void start();
+void stop();
+
+// Writes what was recorded, call after stop()
+bool exportChromeJson(const QString &fileName, QString *errorString = nullptr);
+
+class Zone
+{
+public:
+    Zone(const char *category, const char *name)
+        : m_category(category), m_name(name), m_start(isEnabled() ? Detail::now() : -1) {}
+
+    ~Zone()
+    {
+        if (m_start >= 0 && isEnabled())
+            Detail::record(m_category, m_name, m_start, Detail::now());
+    }
+
+    Zone(const Zone &) = delete;
+    Zone &operator=(const Zone &) = delete;
+
+private:
+    const char *m_category;
+    const char *m_name;
+    qint64 m_start;
+};
+
+} // namespace Trace
+} // namespace Util
+
+#define UTIL_TRACE_CONCAT_(a, b) a##b
+#define UTIL_TRACE_CONCAT(a, b) UTIL_TRACE_CONCAT_(a, b)
+
+#ifndef UTIL_NO_TRACING
+#  define TRACE_ZONE(category, name) \
+    Util::Trace::Zone UTIL_TRACE_CONCAT(_trace_zone_, __LINE__)(category, name)
+#else
+#  define TRACE_ZONE(category, name) do {} while (0)
+#endif
+
+#endif // UTIL_TRACE_H
@@ -0,0 +1,13 @@
+# Helpers shared by the application and the benchmark
+
+# CONFIG+=no_tracing compiles all TRACE_ZONEs away
+no_tracing: DEFINES += UTIL_NO_TRACING
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+    $$PWD/trace.cpp
+
+HEADERS += \
+    $$PWD/misc.h \
+    $$PWD/trace.h